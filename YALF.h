@@ -1,23 +1,54 @@
 // Copyright (c) 2024 Matt M Halenza
 // SPDX-License-Identifier: MIT
 #pragma once
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
 #include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <ios>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <ranges>
 #include <source_location>
+#include <span>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
 #include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <variant>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include <assert.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define YALF_JSON_SIMD
+#endif
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 namespace YALF {
 
@@ -80,6 +111,24 @@ std::span<LogLevel const> getLogLevelList()
     return levels;
 }
 
+// The syslog(3) severity (LOG_EMERG = 0 ... LOG_DEBUG = 7) of a level, as used by journald's PRIORITY and syslog.
+// Fatal is LOG_ALERT rather than LOG_EMERG, which journald broadcasts to every terminal.
+inline
+int getSyslogSeverity(LogLevel level)
+{
+    switch (level) {
+        case LogLevel::Fatal: return 1;
+        case LogLevel::Critical: return 2;
+        case LogLevel::Error: return 3;
+        case LogLevel::Warning: return 4;
+        case LogLevel::Notice: return 5;
+        case LogLevel::Info: return 6;
+        case LogLevel::Debug: return 7;
+        case LogLevel::Noise: return 7;
+    }
+    return 7;
+}
+
 #ifndef YALF_TIMESTAMP_RESOLUTION
 #define YALF_TIMESTAMP_RESOLUTION std::micro
 #endif
@@ -90,13 +139,281 @@ using LogEntryTimestampResolution = YALF_TIMESTAMP_RESOLUTION;
 using LogEntryTimestampClock = YALF_TIMESTAMP_CLOCK;
 using LogEntryTimestampDuration = std::chrono::duration<LogEntryTimestampClock::rep, LogEntryTimestampResolution>;
 using LogEntryTimestamp = std::chrono::time_point<LogEntryTimestampClock, LogEntryTimestampDuration>;
+
+template <class Clock>
+concept HasToSys = requires(std::chrono::time_point<Clock, LogEntryTimestampDuration> t)
+{
+    Clock::to_sys(t);
+};
+
+// A timestamp as wall-clock (system_clock) time, for output formats that require UTC.
+// Clocks without a to_sys() (eg. steady_clock) are converted using the current offset between the two clocks.
+template <class Clock>
+std::chrono::sys_time<LogEntryTimestampDuration> toSystemTime(std::chrono::time_point<Clock, LogEntryTimestampDuration> timestamp)
+{
+    if constexpr (std::is_same_v<Clock, std::chrono::system_clock>)
+        return timestamp;
+    else if constexpr (HasToSys<Clock>)
+        return std::chrono::time_point_cast<LogEntryTimestampDuration>(Clock::to_sys(timestamp));
+    else
+        return std::chrono::time_point_cast<LogEntryTimestampDuration>(std::chrono::system_clock::now() + (timestamp - Clock::now()));
+}
+
+#ifndef YALF_MAX_DOMAINS
+#define YALF_MAX_DOMAINS 1024
+#endif
+using DomainId = std::uint32_t;
+inline constexpr DomainId InvalidDomainId = std::numeric_limits<DomainId>::max();
+
+// Assigns a small integer ID to each distinct domain name, see Domain.
+// Names are stored for the lifetime of the program.
+class DomainRegistry
+{
+public:
+    static DomainRegistry& get()
+    {
+        static DomainRegistry registry;
+        return registry;
+    }
+
+    // Returns the ID of `name`, registering it if needed, and a view of the stored name.
+    // Once YALF_MAX_DOMAINS names are registered, further names get InvalidDomainId.
+    std::pair<DomainId, std::string_view> intern(std::string_view name)
+    {
+        std::lock_guard g{ this->m };
+        if (auto const it = this->ids.find(name); it != this->ids.end())
+            return { it->second, it->first };
+        std::string_view const stored = this->names.emplace_back(name);
+        DomainId const id = this->next_id < YALF_MAX_DOMAINS ? this->next_id++ : InvalidDomainId;
+        this->ids.emplace(stored, id);
+        return { id, stored };
+    }
+    std::size_t size() const
+    {
+        std::lock_guard g{ this->m };
+        return this->next_id;
+    }
+
+private:
+    DomainRegistry() = default;
+
+    mutable std::mutex m;
+    std::deque<std::string> names; // Stable storage for the keys of `ids`
+    std::unordered_map<std::string_view, DomainId> ids;
+    DomainId next_id = 0;
+};
+
+// A registered domain, which filters can check with an indexed load instead of comparing strings.
+// Construct these once (eg. as statics) and pass them to the LOG_* macros in place of a domain string.
+class Domain
+{
+public:
+    explicit Domain(std::string_view name_)
+        : id(InvalidDomainId)
+        , name()
+    {
+        std::tie(this->id, this->name) = DomainRegistry::get().intern(name_);
+    }
+
+    DomainId getId() const { return this->id; }
+    std::string_view getName() const { return this->name; }
+
+private:
+    DomainId id;
+    std::string_view name;
+};
+
+// A domain name with static storage duration, eg. a string literal, that sinks which keep entries around can refer to instead of copying.
+// The constructor is consteval, so it only accepts constants (string literals, or constexpr views of them).
+// Unlike a Domain it is not registered, so filters compare it as a string.
+class StaticDomain
+{
+public:
+    consteval StaticDomain(std::string_view name_)
+        : name(name_)
+    {}
+
+    constexpr std::string_view getName() const { return this->name; }
+
+private:
+    std::string_view name;
+};
+
+namespace literals {
+
+// eg. LOG_INFO("Net"_domain, ...), after `using namespace YALF::literals;`
+consteval StaticDomain operator""_domain(char const* str, std::size_t len)
+{
+    return StaticDomain{ std::string_view{ str, len } };
+}
+
+}
+
+// The domain of a log call: a string, a registered Domain, or a StaticDomain.
+struct DomainRef
+{
+    template <class T>
+        requires std::convertible_to<T const&, std::string_view>
+    DomainRef(T const& name_)
+        : name(name_)
+        , id(InvalidDomainId)
+        , is_static(false)
+    {}
+    DomainRef(Domain const& domain)
+        : name(domain.getName())
+        , id(domain.getId())
+        , is_static(true) // Registered names are never freed
+    {}
+    DomainRef(StaticDomain domain)
+        : name(domain.getName())
+        , id(InvalidDomainId)
+        , is_static(true)
+    {}
+
+    std::string_view name;
+    DomainId id;
+    bool is_static;
+};
+
+// A structured key/value field of an entry, see kv() and the LOG_*_KV macros.
+// Strings are not copied, so a Field is only valid as long as the strings it refers to.
+struct Field
+{
+    std::string_view key;
+    std::variant<std::int64_t, std::uint64_t, double, bool, std::string_view> value;
+};
+
+template <class T>
+Field kv(std::string_view key, T const& value)
+{
+    if constexpr (std::is_same_v<T, bool>)
+        return Field{ key, value };
+    else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+        return Field{ key, static_cast<std::int64_t>(value) };
+    else if constexpr (std::is_integral_v<T>)
+        return Field{ key, static_cast<std::uint64_t>(value) };
+    else if constexpr (std::is_floating_point_v<T>)
+        return Field{ key, static_cast<double>(value) };
+    else if constexpr (std::is_enum_v<T>)
+        return kv(key, static_cast<std::underlying_type_t<T>>(value));
+    else if constexpr (std::is_convertible_v<T const&, std::string_view>)
+        return Field{ key, std::string_view{ value } };
+    else
+        static_assert(std::is_convertible_v<T const&, std::string_view>, "kv() values must be arithmetic, enums, or convertible to std::string_view");
+}
+
+// An owning copy of a list of fields, for sinks that keep entries beyond the log call.
+class OwnedFields
+{
+public:
+    OwnedFields() = default;
+    // The fields refer into `strings`, which may use the small string buffer, so copies and moves rebuild them
+    OwnedFields(OwnedFields const& other) { this->assign(other.get()); }
+    OwnedFields& operator=(OwnedFields const& other) { if (this != &other) this->assign(other.get()); return *this; }
+
+    void assign(std::span<Field const> fields_)
+    {
+        // Copy the strings first so that the views into `strings` are not invalidated by its growth
+        std::size_t size = 0;
+        for (auto const& f : fields_)
+            size += f.key.size() + (std::holds_alternative<std::string_view>(f.value) ? std::get<std::string_view>(f.value).size() : 0);
+        this->strings.clear();
+        this->strings.reserve(size);
+        this->fields.clear();
+        for (auto const& f : fields_) {
+            auto const key = this->store(f.key);
+            if (std::holds_alternative<std::string_view>(f.value))
+                this->fields.push_back(Field{ key, this->store(std::get<std::string_view>(f.value)) });
+            else
+                this->fields.push_back(Field{ key, f.value });
+        }
+    }
+    std::span<Field const> get() const { return this->fields; }
+
+private:
+    std::string_view store(std::string_view str)
+    {
+        auto const offset = this->strings.size();
+        this->strings.append(str);
+        return std::string_view{ this->strings }.substr(offset, str.size());
+    }
+
+    std::string strings;
+    std::vector<Field> fields;
+};
+
+// Where an entry was logged.
+// Converts implicitly from std::source_location, and can also be made from its parts for entries that did not come from a log call in this process (eg. the ones yalfd reads from ShmSink's ring).
+// As with std::source_location, the strings are not copied: they must stay valid for as long as any sink may refer to the entry, see StringTable.
+class SourceLocation
+{
+public:
+    constexpr SourceLocation() noexcept = default;
+    constexpr SourceLocation(std::source_location const& loc) noexcept
+        : file(loc.file_name())
+        , function(loc.function_name())
+        , line_number(loc.line())
+        , column_number(loc.column())
+    {}
+    constexpr SourceLocation(char const* file_, char const* function_, std::uint_least32_t line_, std::uint_least32_t column_) noexcept
+        : file(file_)
+        , function(function_)
+        , line_number(line_)
+        , column_number(column_)
+    {}
+
+    constexpr char const* file_name() const noexcept { return this->file; }
+    constexpr char const* function_name() const noexcept { return this->function; }
+    constexpr std::uint_least32_t line() const noexcept { return this->line_number; }
+    constexpr std::uint_least32_t column() const noexcept { return this->column_number; }
+
+private:
+    char const* file = "";
+    char const* function = "";
+    std::uint_least32_t line_number = 0;
+    std::uint_least32_t column_number = 0;
+};
+
+// Keeps one NUL-terminated copy of each distinct string it is given, for as long as it exists.
+// Gives a SourceLocation made from parts strings that stay valid, and the same address for equal strings, as std::source_location's have (PbFileSink's callsite table relies on it).
+class StringTable
+{
+public:
+    char const* intern(std::string_view str)
+    {
+        if (auto const it = this->index.find(str); it != this->index.end())
+            return it->data();
+        auto const& stored = this->storage.emplace_back(str);
+        this->index.insert(stored);
+        return stored.c_str();
+    }
+
+private:
+    std::deque<std::string> storage; // Never moves its elements
+    std::unordered_set<std::string_view> index;
+};
+
 struct EntryMetadata
 {
     LogLevel level;
     std::string_view domain;
+    DomainId domain_id = InvalidDomainId; // Set when logging with a Domain
+    bool static_domain = false; // The domain is a Domain or a StaticDomain, so it stays valid after the log call and need not be copied
     std::optional<std::string_view> instance;
-    std::source_location source_location;
+    SourceLocation source_location;
     LogEntryTimestamp timestamp;
+    std::uint64_t suppressed = 0; // Calls from this callsite suppressed by a LOG_EVERY_N/LOG_EVERY_T/LOG_SAMPLED since its previous entry
+    std::span<Field const> fields; // Set when logging with a LOG_*_KV macro
+};
+
+// The level of a log call, plus the number of calls suppressed before it by one of the limiting macros.
+// Converts implicitly from LogLevel, so Logger::log can still be called with just a level.
+struct LogCall
+{
+    LogCall(LogLevel level_, std::uint64_t suppressed_ = 0) : level(level_), suppressed(suppressed_) {}
+
+    LogLevel level;
+    std::uint64_t suppressed;
 };
 
 template <typename ObjectType>
@@ -121,35 +438,272 @@ class Filter
 {
 protected:
     Filter() = default;
+    // Copies the rules; the copy resolves and caches levels on its own.
+    Filter(Filter const& other)
+        : default_level(other.default_level)
+        , domains(other.domains)
+        , wildcards(other.wildcards)
+    {}
+    Filter& operator=(Filter const& other)
+    {
+        this->default_level = other.default_level;
+        this->domains = other.domains;
+        this->wildcards = other.wildcards;
+        this->invalidateCache();
+        return *this;
+    }
 public:
-    virtual ~Filter() = default;
+    virtual ~Filter()
+    {
+        delete[] this->cached_levels.load(std::memory_order_relaxed);
+    }
 
     virtual bool checkFilter(EntryMetadata const& entry) const
     {
-        auto const it = std::ranges::find_if(
-            this->domains,
-            [&](std::string const& domain) -> bool { return entry.domain.compare(domain) == 0; },
-            &decltype(this->domains)::value_type::first);
-        if (it != this->domains.end())
-            return entry.level <= it->second;
-        else
-            return entry.level <= this->default_level;
+        if (entry.domain_id >= YALF_MAX_DOMAINS)
+            return entry.level <= this->resolveLogLevel(entry.domain);
+        // Registered domains cache their resolved level, tagged with the configuration generation it was resolved in
+        auto const generation_ = this->generation.load(std::memory_order_acquire);
+        auto& cached = this->levelCache()[entry.domain_id];
+        auto level = cached.load(std::memory_order_relaxed);
+        if ((level >> 8) != generation_) {
+            level = (generation_ << 8) | static_cast<std::uint32_t>(this->resolveLogLevel(entry.domain));
+            cached.store(level, std::memory_order_relaxed);
+        }
+        return static_cast<std::uint32_t>(entry.level) <= (level & 0xFF);
     }
 
-    virtual void setDefaultLogLevel(LogLevel level){ this->default_level = level; }
-    virtual void setDomainLogLevel(std::string_view domain, LogLevel level){ this->domains[std::string{ domain }] = level; }
-    virtual void clearDomainLogLevel(std::string_view domain){ this->domains.erase(std::string{ domain }); }
+    virtual void setDefaultLogLevel(LogLevel level){ this->default_level = level; this->invalidateCache(); }
+    // `domain` may be an exact domain, or "Prefix.*" to match every domain below "Prefix" (eg. "Net.Tcp.Conn" for "Net.*").
+    virtual void setDomainLogLevel(std::string_view domain, LogLevel level){ this->rulesFor(domain)[std::string{ stripWildcard(domain) }] = level; this->invalidateCache(); }
+    virtual void clearDomainLogLevel(std::string_view domain){ this->rulesFor(domain).erase(std::string{ stripWildcard(domain) }); this->invalidateCache(); }
+
+protected:
+    // An exact rule wins, then the wildcard rule with the longest prefix, then the default level.
+    LogLevel resolveLogLevel(std::string_view domain) const
+    {
+        if (auto const it = this->domains.find(domain); it != this->domains.end())
+            return it->second;
+        if (!this->wildcards.empty()) {
+            for (auto pos = domain.rfind('.'); pos != std::string_view::npos; pos = pos == 0 ? std::string_view::npos : domain.rfind('.', pos - 1)) {
+                if (auto const it = this->wildcards.find(domain.substr(0, pos + 1)); it != this->wildcards.end())
+                    return it->second;
+            }
+            if (auto const it = this->wildcards.find(std::string_view{}); it != this->wildcards.end())
+                return it->second;
+        }
+        return this->default_level;
+    }
+    void invalidateCache()
+    {
+        // Generation 0 marks the initial, unresolved, cache entries
+        auto const next = (this->generation.load(std::memory_order_relaxed) + 1) & 0xFFFFFF;
+        this->generation.store(next == 0 ? 1 : next, std::memory_order_release);
+    }
 
 private:
+    struct StringHash
+    {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view str) const { return std::hash<std::string_view>{}(str); }
+    };
+    using RuleMap = std::unordered_map<std::string, LogLevel, StringHash, std::equal_to<>>;
+
+    // The cache is only allocated once an entry with a registered domain is checked, so filters that never see one stay small.
+    std::atomic<std::uint32_t>* levelCache() const
+    {
+        auto* cache = this->cached_levels.load(std::memory_order_acquire);
+        if (cache)
+            return cache;
+        auto* const fresh = new std::atomic<std::uint32_t>[YALF_MAX_DOMAINS]{};
+        if (this->cached_levels.compare_exchange_strong(cache, fresh, std::memory_order_acq_rel))
+            return fresh;
+        delete[] fresh; // Another thread installed its cache first
+        return cache;
+    }
+
+    static bool isWildcard(std::string_view domain) { return domain == "*" || domain.ends_with(".*"); }
+    // "Net.*" is stored as "Net." and "*" as ""
+    static std::string_view stripWildcard(std::string_view domain) { return isWildcard(domain) ? domain.substr(0, domain.size() - 1) : domain; }
+    RuleMap& rulesFor(std::string_view domain) { return isWildcard(domain) ? this->wildcards : this->domains; }
+
     LogLevel default_level = LogLevel::Info;
-    std::unordered_map<std::string, LogLevel> domains;
+    RuleMap domains;
+    RuleMap wildcards;
+    std::atomic<std::uint32_t> generation = 1;
+    mutable std::atomic<std::atomic<std::uint32_t>*> cached_levels{ nullptr }; // YALF_MAX_DOMAINS entries, see levelCache()
+};
+
+#ifdef YALF_ENABLE_STATS
+#ifndef YALF_STATS_SHARDS
+#define YALF_STATS_SHARDS 16
+#endif
+
+// A log-linear (HDR-style) histogram of durations in nanoseconds: every power of two is split into 8 buckets, so any value is within 12.5% of its bucket's lower bound.
+struct LatencyHistogram
+{
+    static constexpr unsigned SubBucketBits = 3;
+    static constexpr unsigned SubBuckets = 1u << SubBucketBits;
+    static constexpr unsigned MaxMagnitude = 36; // ~68s, longer durations are counted in the last bucket
+    static constexpr std::size_t BucketCount = (MaxMagnitude - SubBucketBits + 2) * SubBuckets;
+
+    static std::size_t bucketIndex(std::uint64_t ns)
+    {
+        if (ns < SubBuckets)
+            return static_cast<std::size_t>(ns);
+        auto const magnitude = std::min<unsigned>(static_cast<unsigned>(std::bit_width(ns)) - 1, MaxMagnitude);
+        auto const sub = (ns >> (magnitude - SubBucketBits)) & (SubBuckets - 1);
+        return std::min<std::size_t>((magnitude - SubBucketBits + 1) * SubBuckets + sub, BucketCount - 1);
+    }
+    static std::uint64_t bucketLowerBound(std::size_t index)
+    {
+        if (index < SubBuckets)
+            return index;
+        auto const magnitude = index / SubBuckets + SubBucketBits - 1;
+        return (SubBuckets + index % SubBuckets) << (magnitude - SubBucketBits);
+    }
+
+    std::uint64_t count() const
+    {
+        std::uint64_t total = 0;
+        for (auto const n : this->buckets)
+            total += n;
+        return total;
+    }
+    // The lower bound of the bucket holding the `p` quantile, eg. percentile(0.99) for p99.
+    std::chrono::nanoseconds percentile(double p) const
+    {
+        auto const total = this->count();
+        if (total == 0)
+            return std::chrono::nanoseconds{ 0 };
+        auto const rank = std::min(total - 1, static_cast<std::uint64_t>(p * static_cast<double>(total)));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < BucketCount; i++) {
+            seen += this->buckets[i];
+            if (seen > rank)
+                return std::chrono::nanoseconds{ bucketLowerBound(i) };
+        }
+        return std::chrono::nanoseconds{ bucketLowerBound(BucketCount - 1) };
+    }
+
+    std::array<std::uint64_t, BucketCount> buckets{};
+};
+
+// A snapshot of the statistics of one sink, see Logger::stats().
+struct SinkStats
+{
+    std::uint64_t accepted = 0; // Entries passed to Sink::log
+    std::uint64_t filtered = 0; // Entries rejected by the sink's filter
+    std::uint64_t dropped = 0; // Entries the sink accepted but discarded
+    std::uint64_t bytes_written = 0;
+    std::uint64_t lock_acquisitions = 0;
+    std::chrono::nanoseconds lock_wait{ 0 }; // Total time spent waiting on the sink's internal mutex
+    LatencyHistogram log_latency; // Time spent in Sink::log
+};
+
+namespace detail {
+
+// Each thread updates one of YALF_STATS_SHARDS cache-line sized shards, so the counters are not contended even though they are shared.
+inline
+std::size_t statsShardIndex()
+{
+    static std::atomic<std::size_t> next_shard{ 0 };
+    thread_local std::size_t const shard = next_shard.fetch_add(1, std::memory_order_relaxed) % YALF_STATS_SHARDS;
+    return shard;
+}
+
+class SinkStatsCounters
+{
+public:
+    void countAccepted(std::chrono::nanoseconds log_time) { auto& s = this->shard(); add(s.accepted, 1); add(s.log_latency[LatencyHistogram::bucketIndex(toCount(log_time))], 1); }
+    void countFiltered() { add(this->shard().filtered, 1); }
+    void countDropped() { add(this->shard().dropped, 1); }
+    void countBytesWritten(std::size_t bytes) { add(this->shard().bytes_written, bytes); }
+    void countLockWait(std::chrono::nanoseconds wait) { auto& s = this->shard(); add(s.lock_acquisitions, 1); add(s.lock_wait_ns, toCount(wait)); }
+
+    SinkStats snapshot() const
+    {
+        SinkStats stats;
+        for (auto const& s : this->shards) {
+            stats.accepted += s.accepted.load(std::memory_order_relaxed);
+            stats.filtered += s.filtered.load(std::memory_order_relaxed);
+            stats.dropped += s.dropped.load(std::memory_order_relaxed);
+            stats.bytes_written += s.bytes_written.load(std::memory_order_relaxed);
+            stats.lock_acquisitions += s.lock_acquisitions.load(std::memory_order_relaxed);
+            stats.lock_wait += std::chrono::nanoseconds{ s.lock_wait_ns.load(std::memory_order_relaxed) };
+            for (std::size_t i = 0; i < LatencyHistogram::BucketCount; i++)
+                stats.log_latency.buckets[i] += s.log_latency[i].load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<std::uint64_t> accepted{ 0 };
+        std::atomic<std::uint64_t> filtered{ 0 };
+        std::atomic<std::uint64_t> dropped{ 0 };
+        std::atomic<std::uint64_t> bytes_written{ 0 };
+        std::atomic<std::uint64_t> lock_acquisitions{ 0 };
+        std::atomic<std::uint64_t> lock_wait_ns{ 0 };
+        std::array<std::atomic<std::uint64_t>, LatencyHistogram::BucketCount> log_latency{};
+    };
+
+    static void add(std::atomic<std::uint64_t>& counter, std::uint64_t n) { counter.fetch_add(n, std::memory_order_relaxed); }
+    static std::uint64_t toCount(std::chrono::nanoseconds d) { return static_cast<std::uint64_t>(std::max<std::chrono::nanoseconds::rep>(d.count(), 0)); }
+    Shard& shard() { return this->shards[statsShardIndex()]; }
+
+    std::array<Shard, YALF_STATS_SHARDS> shards;
 };
 
+}
+#endif
+
 class Sink : public Filter
 {
 public:
     Sink() = default;
     virtual void log(EntryMetadata const& meta, std::string_view msg) = 0;
+    // Writes out anything the sink has buffered; DeferredSink calls this each time it has drained its queue.
+    virtual void flush() {}
+
+    #ifdef YALF_ENABLE_STATS
+    // Wrapping sinks override this to fold in the statistics of the sink they wrap.
+    virtual SinkStats getStats() const { return this->stats_counters.snapshot(); }
+    #endif
+
+protected:
+    // Helpers for implementations to report what they did; these compile to nothing unless YALF_ENABLE_STATS is defined.
+    void countBytesWritten([[maybe_unused]] std::size_t bytes)
+    {
+        #ifdef YALF_ENABLE_STATS
+        this->stats_counters.countBytesWritten(bytes);
+        #endif
+    }
+    void countDropped()
+    {
+        #ifdef YALF_ENABLE_STATS
+        this->stats_counters.countDropped();
+        #endif
+    }
+    // Locks the sink's internal mutex, recording how long that took.
+    [[nodiscard]] std::unique_lock<std::mutex> lockTimed(std::mutex& m)
+    {
+        #ifdef YALF_ENABLE_STATS
+        auto const before = std::chrono::steady_clock::now();
+        std::unique_lock lock{ m };
+        this->stats_counters.countLockWait(std::chrono::steady_clock::now() - before);
+        return lock;
+        #else
+        return std::unique_lock{ m };
+        #endif
+    }
+
+private:
+    #ifdef YALF_ENABLE_STATS
+    friend class Logger;
+    mutable detail::SinkStatsCounters stats_counters;
+    #endif
 };
 
 inline
@@ -162,22 +716,349 @@ std::string_view truncateFilename(std::string_view filename)
     #endif
     return filename;
 }
+
+namespace detail {
+
+inline
+bool needsJsonEscape(char c)
+{
+    return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+}
+
+inline
+char const* findJsonEscapeScalar(char const* p, char const* end)
+{
+    while (p != end && !needsJsonEscape(*p))
+        p++;
+    return p;
+}
+
+#if defined(YALF_JSON_SIMD)
+// Bytes that need escaping are '"', '\\', and anything <= 0x1F, which is where the unsigned max with 0x1F equals 0x1F.
+inline
+char const* findJsonEscapeSse2(char const* p, char const* end)
+{
+    auto const quote = _mm_set1_epi8('"');
+    auto const backslash = _mm_set1_epi8('\\');
+    auto const control = _mm_set1_epi8(0x1F);
+    for (; end - p >= 16; p += 16) {
+        auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+        auto const hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)), _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+        if (auto const mask = static_cast<unsigned>(_mm_movemask_epi8(hits)); mask != 0)
+            return p + std::countr_zero(mask);
+    }
+    return findJsonEscapeScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+inline
+char const* findJsonEscapeAvx2(char const* p, char const* end)
+{
+    auto const quote = _mm256_set1_epi8('"');
+    auto const backslash = _mm256_set1_epi8('\\');
+    auto const control = _mm256_set1_epi8(0x1F);
+    for (; end - p >= 32; p += 32) {
+        auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+        auto const hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)), _mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control));
+        if (auto const mask = static_cast<unsigned>(_mm256_movemask_epi8(hits)); mask != 0)
+            return p + std::countr_zero(mask);
+    }
+    return findJsonEscapeSse2(p, end);
+}
+#endif
+
+// Returns the first character in [p, end) that must be escaped in a JSON string, or `end`.
+inline
+char const* findJsonEscape(char const* p, char const* end)
+{
+    #if defined(YALF_JSON_SIMD)
+    static bool const has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2 ? findJsonEscapeAvx2(p, end) : findJsonEscapeSse2(p, end);
+    #else
+    return findJsonEscapeScalar(p, end);
+    #endif
+}
+
+}
+
+// Appends `str` as a quoted JSON string.
+// Runs of characters that need no escaping are found 16 or 32 bytes at a time where SSE2/AVX2 are available, and copied as a whole.
+inline
+void appendJsonString(std::string& out, std::string_view str)
+{
+    out.reserve(out.size() + str.size() + 2);
+    out += '"';
+    auto const* p = str.data();
+    auto const* const end = p + str.size();
+    while (true) {
+        auto const* const q = detail::findJsonEscape(p, end);
+        out.append(p, q);
+        if (q == end)
+            break;
+        switch (*q) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: std::format_to(std::back_inserter(out), "\\u{:04x}", static_cast<unsigned>(*q)); break;
+        }
+        p = q + 1;
+    }
+    out += '"';
+}
+
+// Appends the fields as ` key=value key="quoted value"` (logfmt), or nothing if there are none.
+inline
+void appendFieldsLogfmt(std::string& out, std::span<Field const> fields)
+{
+    for (auto const& f : fields) {
+        out += ' ';
+        out += f.key;
+        out += '=';
+        std::visit([&](auto const& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, std::string_view>) {
+                bool const quote = v.empty() || std::ranges::any_of(v, [](char c) { return c == ' ' || c == '=' || detail::needsJsonEscape(c); });
+                if (quote)
+                    appendJsonString(out, v);
+                else
+                    out += v;
+            }
+            else {
+                std::format_to(std::back_inserter(out), "{}", v);
+            }
+        }, f.value);
+    }
+}
+
+// Appends the fields as a JSON object, `{"key":value,...}`.
+inline
+void appendFieldsJson(std::string& out, std::span<Field const> fields)
+{
+    out += '{';
+    for (auto const& f : fields) {
+        if (&f != fields.data())
+            out += ',';
+        appendJsonString(out, f.key);
+        out += ':';
+        std::visit([&](auto const& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, std::string_view>)
+                appendJsonString(out, v);
+            else if (std::is_same_v<T, double> && !std::isfinite(static_cast<double>(v)))
+                out += "null";
+            else
+                std::format_to(std::back_inserter(out), "{}", v);
+        }, f.value);
+    }
+    out += '}';
+}
+
+// The fields of an entry used by the format string language, so that entries that did not come from a std::source_location (eg. read back from a file) can be formatted too.
+struct FormattableEntry
+{
+    LogLevel level;
+    std::string_view domain;
+    std::optional<std::string_view> instance;
+    std::string_view file_name;
+    std::string_view function_name;
+    std::uint_least32_t line;
+    std::uint_least32_t column;
+    LogEntryTimestamp timestamp;
+    std::uint64_t suppressed = 0;
+    std::span<Field const> fields = {};
+};
+
+inline
+FormattableEntry makeFormattableEntry(EntryMetadata const& meta)
+{
+    return FormattableEntry{
+        .level = meta.level,
+        .domain = meta.domain,
+        .instance = meta.instance,
+        .file_name = meta.source_location.file_name(),
+        .function_name = meta.source_location.function_name(),
+        .line = meta.source_location.line(),
+        .column = meta.source_location.column(),
+        .timestamp = meta.timestamp,
+        .suppressed = meta.suppressed,
+        .fields = meta.fields,
+    };
+}
+
+// Appends the entry to `out` as described by `fmt`, see the Format String Reference.
+inline
+void formatEntryTo(std::string& out, std::string_view fmt, FormattableEntry const& entry, std::string_view msg)
+{
+    if (out.empty())
+        out.reserve(fmt.size() + msg.size());
+    auto out_it = std::back_inserter(out);
+
+    #ifdef YALF_USE_LOCALTIME
+    auto const local_timestamp = std::chrono::zoned_time{ std::chrono::current_zone(), entry.timestamp }.get_local_time();
+    #else
+    auto const local_timestamp = entry.timestamp;
+    #endif
+
+    size_t s = 0;
+    while (s < fmt.size()) {
+        if (fmt[s] != '%') {
+            auto p = fmt.find('%', s);
+            if (p == std::string_view::npos) {
+                out += fmt.substr(s);
+                s = fmt.size();
+            }
+            else {
+                out += fmt.substr(s, p - s);
+                s += (p - s);
+            }
+        }
+        else if (s < fmt.size() - 1) {
+            char const fc = fmt[s + 1];
+            switch (fc) {
+                case '%': out_it = '%'; break;
+                case 'n':
+                    #ifdef _MSC_VER
+                    out_it = '\r';
+                    #endif
+                    out_it = '\n';
+                    break;
+                // Timestamps
+                case 'y': std::format_to(out_it, "{:%y}", local_timestamp); break;
+                case 'Y': std::format_to(out_it, "{:%Y}", local_timestamp); break;
+                case 'b': std::format_to(out_it, "{:%b}", local_timestamp); break;
+                case 'B': std::format_to(out_it, "{:%B}", local_timestamp); break;
+                case 'm': std::format_to(out_it, "{:%m}", local_timestamp); break;
+                case 'd': std::format_to(out_it, "{:%d}", local_timestamp); break;
+                case 'e': std::format_to(out_it, "{:%e}", local_timestamp); break;
+                case 'a': std::format_to(out_it, "{:%a}", local_timestamp); break;
+                case 'A': std::format_to(out_it, "{:%A}", local_timestamp); break;
+                case 'H': std::format_to(out_it, "{:%H}", local_timestamp); break;
+                case 'M': std::format_to(out_it, "{:%M}", local_timestamp); break;
+                case 'S': std::format_to(out_it, "{:%S}", local_timestamp); break;
+                // Source Location
+                case 'F': out += truncateFilename(entry.file_name); break;
+                case 'f': out += entry.function_name; break;
+                case 'l': out += std::to_string(entry.line); break;
+                case 'c': out += std::to_string(entry.column); break;
+                // Domain, Instance, Level, Msg
+                case 'D': out += entry.domain; break;
+                case 'I': out += entry.instance.value_or(std::string_view{ "" }); break;
+                case 'L': std::format_to(out_it, "{: >8}", getLogLevelString(entry.level)); break;
+                case 'x': out += msg; break;
+                case 'K': appendFieldsLogfmt(out, entry.fields); break;
+                case 'J':
+                    if (!entry.fields.empty()) {
+                        out += ' ';
+                        appendFieldsJson(out, entry.fields);
+                    }
+                    break;
+                case 'N': if (entry.suppressed != 0) std::format_to(out_it, "[{} suppressed] ", entry.suppressed); break;
+                // Colors
+                case 'R': out += "\033[0m"; break; // Reset colors
+                case 'C': // Foreground Colors
+                    if (s < fmt.size() - 2) {
+                        char const cc = fmt[s + 2];
+                        switch (cc) {
+                            case 'x': out += "\033[30m"; break; // %Cx = Black
+                            case 'r': out += "\033[31m"; break; // %Cr = Red
+                            case 'g': out += "\033[32m"; break; // %Cg = Green
+                            case 'y': out += "\033[33m"; break; // %Cy = Yellow
+                            case 'b': out += "\033[34m"; break; // %Cb = Blue
+                            case 'm': out += "\033[35m"; break; // %Cm = Magenta
+                            case 'c': out += "\033[36m"; break; // %Cc = Cyan
+                            case 'w': out += "\033[37m"; break; // %Cw = White (Light Gray)
+                            case 'X': out += "\033[90m"; break; // %CX = Bright Black (Dark Gray)
+                            case 'R': out += "\033[91m"; break; // %CR = Bright Red
+                            case 'G': out += "\033[92m"; break; // %CG = Bright Green
+                            case 'Y': out += "\033[93m"; break; // %CY = Bright Yellow
+                            case 'B': out += "\033[94m"; break; // %CB = Bright Blue
+                            case 'M': out += "\033[95m"; break; // %CM = Bright Magenta
+                            case 'C': out += "\033[96m"; break; // %CC = Bright Cyan
+                            case 'W': out += "\033[97m"; break; // %CW = Bright White
+                            default: break;
+                        }
+                        s++;
+                    }
+                    break;
+                case 'Q': // Background Colors
+                    if (s < fmt.size() - 2) {
+                        char const cc = fmt[s + 2];
+                        switch (cc) {
+                            case 'x': out += "\033[40m"; break;
+                            case 'r': out += "\033[41m"; break;
+                            case 'g': out += "\033[42m"; break;
+                            case 'y': out += "\033[43m"; break;
+                            case 'b': out += "\033[44m"; break;
+                            case 'm': out += "\033[45m"; break;
+                            case 'c': out += "\033[46m"; break;
+                            case 'w': out += "\033[47m"; break;
+                            case 'X': out += "\033[100m"; break;
+                            case 'R': out += "\033[101m"; break;
+                            case 'G': out += "\033[102m"; break;
+                            case 'Y': out += "\033[103m"; break;
+                            case 'B': out += "\033[104m"; break;
+                            case 'M': out += "\033[105m"; break;
+                            case 'C': out += "\033[106m"; break;
+                            case 'W': out += "\033[107m"; break;
+                            default: break;
+                        }
+                        s++;
+                    }
+                    break;
+                default: break;
+            }
+            s += 2;
+        }
+        else {
+            break; // Trailing lone '%'
+        }
+    }
+}
+
+// Removes the color identifiers (%C?, %Q?, and %R) from a format string, so that formatting does not have to skip them.
+inline
+std::string stripColorCodes(std::string_view fmt)
+{
+    std::string out;
+    out.reserve(fmt.size());
+    size_t s = 0;
+    while (s < fmt.size()) {
+        if (fmt[s] != '%' || s == fmt.size() - 1) {
+            out += fmt[s++];
+            continue;
+        }
+        char const fc = fmt[s + 1];
+        if (fc == 'C' || fc == 'Q')
+            s += std::min<size_t>(3, fmt.size() - s);
+        else if (fc == 'R')
+            s += 2;
+        else {
+            out += fmt.substr(s, 2);
+            s += 2;
+        }
+    }
+    return out;
+}
+
 class FormattedStringSink : public Sink
 {
 public:
     FormattedStringSink()
         : Sink()
-        , default_fmt("%H:%M:%S %F:%l %D[%I] %L:  %x%R%n")
+        , default_fmt("%H:%M:%S %F:%l %D[%I] %L:  %N%x%K%R%n")
         , fmts()
+        , colors(true)
     {}
 
     void setFormat(std::string_view fmt)
     {
-        this->default_fmt = std::string{ fmt };
+        this->default_fmt = this->colors ? std::string{ fmt } : stripColorCodes(fmt);
     }
     void setFormat(LogLevel level, std::string_view fmt)
     {
-        this->fmts[level] = std::string{ fmt };
+        this->fmts[level] = this->colors ? std::string{ fmt } : stripColorCodes(fmt);
     }
     void clearFormat(LogLevel level)
     {
@@ -194,148 +1075,191 @@ protected:
     }
     std::string formatEntry(EntryMetadata const& meta, std::string_view msg)
     {
-        std::string_view fmt = this->getFormatString(meta.level);
         std::string out;
-        out.reserve(fmt.size());
-        auto out_it = std::back_inserter(out);
-
-        #ifdef YALF_USE_LOCALTIME
-        auto const local_timestamp = std::chrono::zoned_time{ std::chrono::current_zone(), meta.timestamp }.get_local_time();
-        #else
-        auto const local_timestamp = meta.timestamp;
-        #endif
-
-        size_t s = 0;
-        while (s < fmt.size()) {
-            if (fmt[s] != '%') {
-                auto p = fmt.find('%', s);
-                if (p == std::string_view::npos) {
-                    out += fmt.substr(s);
-                    s = fmt.size();
-                }
-                else {
-                    out += fmt.substr(s, p - s);
-                    s += (p - s);
-                }
-            }
-            else if (s < fmt.size() - 1) {
-                char const fc = fmt[s + 1];
-                switch (fc) {
-                    case '%': out_it = '%'; break;
-                    case 'n':
-                        #ifdef _MSC_VER
-                        out_it = '\r';
-                        #endif
-                        out_it = '\n';
-                        break;
-                    // Timestamps
-                    case 'y': std::format_to(out_it, "{:%y}", local_timestamp); break;
-                    case 'Y': std::format_to(out_it, "{:%Y}", local_timestamp); break;
-                    case 'b': std::format_to(out_it, "{:%b}", local_timestamp); break;
-                    case 'B': std::format_to(out_it, "{:%B}", local_timestamp); break;
-                    case 'm': std::format_to(out_it, "{:%m}", local_timestamp); break;
-                    case 'd': std::format_to(out_it, "{:%d}", local_timestamp); break;
-                    case 'e': std::format_to(out_it, "{:%e}", local_timestamp); break;
-                    case 'a': std::format_to(out_it, "{:%a}", local_timestamp); break;
-                    case 'A': std::format_to(out_it, "{:%A}", local_timestamp); break;
-                    case 'H': std::format_to(out_it, "{:%H}", local_timestamp); break;
-                    case 'M': std::format_to(out_it, "{:%M}", local_timestamp); break;
-                    case 'S': std::format_to(out_it, "{:%S}", local_timestamp); break;
-                    // Source Location
-                    case 'F': out += truncateFilename(meta.source_location.file_name()); break;
-                    case 'f': out += meta.source_location.function_name(); break;
-                    case 'l': out += std::to_string(meta.source_location.line()); break;
-                    case 'c': out += std::to_string(meta.source_location.column()); break;
-                    // Domain, Instance, Level, Msg
-                    case 'D': out += meta.domain; break;
-                    case 'I': out += meta.instance.value_or(std::string_view{ "" }); break;
-                    case 'L': std::format_to(out_it, "{: >8}", getLogLevelString(meta.level)); break;
-                    case 'x': out += msg; break;
-                    // Colors
-                    case 'R': out += "\033[0m"; break; // Reset colors
-                    case 'C': // Foreground Colors
-                        if (s < fmt.size() - 2) {
-                            char const cc = fmt[s + 2];
-                            switch (cc) {
-                                case 'x': out += "\033[30m"; break; // %Cx = Black
-                                case 'r': out += "\033[31m"; break; // %Cr = Red
-                                case 'g': out += "\033[32m"; break; // %Cg = Green
-                                case 'y': out += "\033[33m"; break; // %Cy = Yellow
-                                case 'b': out += "\033[34m"; break; // %Cb = Blue
-                                case 'm': out += "\033[35m"; break; // %Cm = Magenta
-                                case 'c': out += "\033[36m"; break; // %Cc = Cyan
-                                case 'w': out += "\033[37m"; break; // %Cw = White (Light Gray)
-                                case 'X': out += "\033[90m"; break; // %CX = Bright Black (Dark Gray)
-                                case 'R': out += "\033[91m"; break; // %CR = Bright Red
-                                case 'G': out += "\033[92m"; break; // %CG = Bright Green
-                                case 'Y': out += "\033[93m"; break; // %CY = Bright Yellow
-                                case 'B': out += "\033[94m"; break; // %CB = Bright Blue
-                                case 'M': out += "\033[95m"; break; // %CM = Bright Magenta
-                                case 'C': out += "\033[96m"; break; // %CC = Bright Cyan
-                                case 'W': out += "\033[97m"; break; // %CW = Bright White
-                                default: break;
-                            }
-                            s++;
-                        }
-                        break;
-                    case 'Q': // Background Colors
-                        if (s < fmt.size() - 2) {
-                            char const cc = fmt[s + 2];
-                            switch (cc) {
-                                case 'x': out += "\033[40m"; break;
-                                case 'r': out += "\033[41m"; break;
-                                case 'g': out += "\033[42m"; break;
-                                case 'y': out += "\033[43m"; break;
-                                case 'b': out += "\033[44m"; break;
-                                case 'm': out += "\033[45m"; break;
-                                case 'c': out += "\033[46m"; break;
-                                case 'w': out += "\033[47m"; break;
-                                case 'X': out += "\033[100m"; break;
-                                case 'R': out += "\033[101m"; break;
-                                case 'G': out += "\033[102m"; break;
-                                case 'Y': out += "\033[103m"; break;
-                                case 'B': out += "\033[104m"; break;
-                                case 'M': out += "\033[105m"; break;
-                                case 'C': out += "\033[106m"; break;
-                                case 'W': out += "\033[107m"; break;
-                                default: break;
-                            }
-                            s++;
-                        }
-                        break;
-                    default: break;
-                }
-                s += 2;
-            }
-        }
+        formatEntryTo(out, this->getFormatString(meta.level), makeFormattableEntry(meta), msg);
         return out;
     }
+    // Strips the color identifiers from the current and any future format strings.
+    void disableColors()
+    {
+        this->colors = false;
+        this->default_fmt = stripColorCodes(this->default_fmt);
+        for (auto& [level, fmt] : this->fmts)
+            fmt = stripColorCodes(fmt);
+    }
 private:
     std::string default_fmt;
     std::unordered_map<LogLevel, std::string> fmts;
+    bool colors;
 };
 
+namespace detail {
+
+inline
+bool isStdoutTerminal()
+{
+    #ifdef _WIN32
+    return ::_isatty(::_fileno(stdout)) != 0;
+    #else
+    return ::isatty(STDOUT_FILENO) != 0;
+    #endif
+}
+
+// Writes all of `data` to the stdout file descriptor; returns false if it fails (eg. the pipe was closed).
+inline
+bool writeStdout(std::string_view data)
+{
+    while (!data.empty()) {
+        #ifdef _WIN32
+        auto const n = ::_write(::_fileno(stdout), data.data(), static_cast<unsigned>(std::min<size_t>(data.size(), 1u << 30)));
+        #else
+        auto const n = ::write(STDOUT_FILENO, data.data(), data.size());
+        #endif
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(n));
+    }
+    return true;
+}
+
+}
+
+struct ConsoleOptions
+{
+    // Entries are collected in a buffer of this size and written to the stdout file descriptor directly
+    std::size_t buffer_size = 64 * 1024;
+    // Write each entry as soon as it is logged; by default only when stdout is a terminal
+    std::optional<bool> line_buffered = std::nullopt;
+    // Entries of this level or more severe are written at once, along with everything buffered before them
+    LogLevel flush_level = LogLevel::Warning;
+    // Buffered entries are written at most this long after they were logged; 0 to only write them when the buffer is full
+    std::chrono::milliseconds flush_interval = std::chrono::milliseconds{ 100 };
+    // Emit the %C, %Q, and %R color codes; by default only when stdout is a terminal
+    std::optional<bool> colors = std::nullopt;
+};
+
+// Without options, writes each entry through std::cout.
+// With ConsoleOptions, bypasses iostreams and writes with write(2) from its own buffer; output written through std::cout or stdio in the meantime may then be interleaved out of order.
 class ConsoleSink : public FormattedStringSink
 {
 public:
     ConsoleSink()
         : FormattedStringSink()
         , m()
+        , direct(false)
+        , options()
+        , line_buffered(true)
+        , buffer()
+        , stopping(false)
+        , cv()
+        , flusher()
     {}
+    explicit ConsoleSink(ConsoleOptions options_)
+        : FormattedStringSink()
+        , m()
+        , direct(true)
+        , options(std::move(options_))
+        , line_buffered(this->options.line_buffered.value_or(detail::isStdoutTerminal()))
+        , buffer()
+        , stopping(false)
+        , cv()
+        , flusher()
+    {
+        if (!this->options.colors.value_or(detail::isStdoutTerminal()))
+            this->disableColors();
+        this->buffer.reserve(this->options.buffer_size);
+        if (!this->line_buffered && this->options.flush_interval.count() > 0)
+            this->flusher = std::thread{ [this] { this->flushPeriodically(); } };
+    }
+    ~ConsoleSink()
+    {
+        if (!this->direct)
+            return;
+        {
+            std::lock_guard lg{ this->m };
+            this->stopping = true;
+        }
+        this->cv.notify_one();
+        if (this->flusher.joinable())
+            this->flusher.join();
+        this->writeBuffer();
+    }
     virtual void log(EntryMetadata const& meta, std::string_view msg) override
     {
-        std::string const str = this->formatEntry(meta, msg);
-        std::lock_guard g{ this->m };
-        std::cout.write(str.c_str(), str.length());
+        if (!this->direct) {
+            std::string const str = this->formatEntry(meta, msg);
+            auto const g = this->lockTimed(this->m);
+            std::cout.write(str.c_str(), str.length());
+            this->countBytesWritten(str.length());
+            return;
+        }
+        thread_local std::string str;
+        str.clear();
+        formatEntryTo(str, this->getFormatString(meta.level), makeFormattableEntry(meta), msg);
+        auto const g = this->lockTimed(this->m);
+        bool const was_empty = this->buffer.empty();
+        if (this->buffer.size() + str.size() > this->options.buffer_size)
+            this->writeBuffer();
+        if (str.size() >= this->options.buffer_size)
+            detail::writeStdout(str);
+        else
+            this->buffer += str;
+        this->countBytesWritten(str.size());
+        if (this->line_buffered || meta.level <= this->options.flush_level)
+            this->writeBuffer();
+        else if (was_empty && this->flusher.joinable())
+            this->cv.notify_one();
+    }
+    virtual void flush() override
+    {
+        auto const g = this->lockTimed(this->m);
+        if (this->direct)
+            this->writeBuffer();
+        else
+            std::cout.flush();
     }
+private:
+    // Requires m
+    void writeBuffer()
+    {
+        if (!this->buffer.empty())
+            detail::writeStdout(this->buffer);
+        this->buffer.clear();
+    }
+    void flushPeriodically()
+    {
+        std::unique_lock lock{ this->m };
+        while (!this->stopping) {
+            this->cv.wait(lock, [this] { return this->stopping || !this->buffer.empty(); });
+            // Give the buffer time to fill, unless something else writes it out first
+            this->cv.wait_for(lock, this->options.flush_interval, [this] { return this->stopping || this->buffer.empty(); });
+            this->writeBuffer();
+        }
+    }
+
 private:
     std::mutex m;
+    bool const direct;
+    ConsoleOptions const options;
+    bool const line_buffered;
+    std::string buffer; // m
+    bool stopping; // m
+    std::condition_variable cv;
+    std::thread flusher;
 };
 inline
 std::unique_ptr<FormattedStringSink> makeConsoleSink()
 {
     return std::make_unique<ConsoleSink>();
 }
+inline
+std::unique_ptr<FormattedStringSink> makeConsoleSink(ConsoleOptions options)
+{
+    return std::make_unique<ConsoleSink>(std::move(options));
+}
 
 class FileSink : public FormattedStringSink
 {
@@ -350,8 +1274,9 @@ public:
     virtual void log(EntryMetadata const& meta, std::string_view msg) override
     {
         std::string const str = this->formatEntry(meta, msg);
-        std::lock_guard g{ this->m };
+        auto const g = this->lockTimed(this->m);
         this->of.write(str.c_str(), str.length());
+        this->countBytesWritten(str.length());
     }
 private:
     std::mutex m;
@@ -364,94 +1289,384 @@ std::unique_ptr<FormattedStringSink> makeFileSink(std::filesystem::path filename
     return std::make_unique<FileSink>(filename);
 }
 
+// The name of a type, demangled where the ABI supports it.
+template <class T>
+std::string getTypeName()
+{
+    #if __has_include(<cxxabi.h>)
+    int status = 0;
+    std::unique_ptr<char, decltype(&std::free)> const demangled{ abi::__cxa_demangle(typeid(T).name(), nullptr, nullptr, &status), &std::free };
+    if (status == 0 && demangled)
+        return demangled.get();
+    #endif
+    return typeid(T).name();
+}
+
+// The Domain used when logging with an object of type T: T::getDomain() if it has a static one, otherwise the name of T.
+template <class T>
+Domain const& getTypeDomain()
+{
+    static Domain const domain = [] {
+        if constexpr (HasClassGetDomain<T>)
+            return Domain{ T::getDomain() };
+        else
+            return Domain{ getTypeName<T>() };
+    }();
+    return domain;
+}
+
+#ifndef YALF_MAX_SINKS
+#define YALF_MAX_SINKS 64
+#endif
+static_assert(YALF_MAX_SINKS <= 64, "The sinks that accept an entry are tracked in a 64-bit mask");
+
+#ifndef YALF_READER_SHARDS
+#define YALF_READER_SHARDS 16
+#endif
+
+namespace detail {
+
+// Each thread counts itself in one of YALF_READER_SHARDS cache-line sized shards, so that readers do not contend on a shared reference count.
+inline
+std::size_t readerShardIndex()
+{
+    static std::atomic<std::size_t> next_shard{ 0 };
+    thread_local std::size_t const shard = next_shard.fetch_add(1, std::memory_order_relaxed) % YALF_READER_SHARDS;
+    return shard;
+}
+
+// Tells a writer when the readers of a published pointer are done with the value it replaced, so that it can destroy it.
+// Readers enter() before loading the pointer (with memory_order_seq_cst, so the load cannot move before their count) and stay until the Guard is destroyed.
+// A writer stores the new pointer (memory_order_seq_cst) and then calls synchronize(), which waits for every reader that may have loaded the old one.
+// Readers count themselves under the current epoch's parity; synchronize() flips the epoch twice and waits for each parity's count to drain, so readers that arrive meanwhile cannot hold it up for long.
+class ReaderEpochs
+{
+public:
+    class Guard
+    {
+    public:
+        Guard(Guard const&) = delete;
+        Guard& operator=(Guard const&) = delete;
+        ~Guard() { this->count.fetch_sub(1, std::memory_order_release); }
+
+    private:
+        friend class ReaderEpochs;
+        explicit Guard(std::atomic<std::uint64_t>& count_)
+            : count(count_)
+        {
+            this->count.fetch_add(1, std::memory_order_seq_cst);
+        }
+
+        std::atomic<std::uint64_t>& count;
+    };
+
+    [[nodiscard]] Guard enter() const
+    {
+        auto const parity = this->epoch.load(std::memory_order_relaxed) & 1;
+        return Guard{ this->shards[readerShardIndex()].readers[parity] };
+    }
+
+    // Must not be called by a reader, which would wait for itself.
+    void synchronize() const
+    {
+        for (int round = 0; round < 2; round++) {
+            auto const parity = this->epoch.fetch_add(1, std::memory_order_seq_cst) & 1;
+            for (auto const& shard : this->shards) {
+                while (shard.readers[parity].load(std::memory_order_seq_cst) != 0)
+                    std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::array<std::atomic<std::uint64_t>, 2> readers{}; // By epoch parity
+    };
+
+    mutable std::atomic<std::uint64_t> epoch{ 0 };
+    mutable std::array<Shard, YALF_READER_SHARDS> shards;
+};
+
+}
+
 class Logger final
 {
 public:
-    Logger() = default;
-    ~Logger() = default;
+    Logger()
+        : sinks(new SinkList const{})
+        , readers()
+        , writer_mutex()
+    {}
+    ~Logger()
+    {
+        delete this->sinks.load(std::memory_order_relaxed);
+    }
+    Logger(Logger const&) = delete;
+    Logger& operator=(Logger const&) = delete;
 
+    // Sinks can be added and removed while other threads are logging, but not from within a sink's log().
+    // removeSink() waits for the log calls that are using the sink to return, and destroys it on the calling thread.
     void addSink(std::string name, std::unique_ptr<Sink> sink)
     {
-        this->sinks.emplace(name, std::move(sink));
+        this->updateSinks([&](SinkList& sinks_) {
+            if (std::ranges::find(sinks_, name, &NamedSink::name) != sinks_.end())
+                return;
+            if (sinks_.size() >= YALF_MAX_SINKS)
+                throw std::runtime_error(std::format("Failed to add sink {0}, a Logger can only have {1} sinks", name, YALF_MAX_SINKS));
+            sinks_.push_back(NamedSink{ std::move(name), std::move(sink) });
+        });
     }
+    // The reference is only valid until the sink is removed.
     Sink& getSink(std::string name) const
     {
-        auto it = this->sinks.find(name);
-        if (it != this->sinks.end())
-            return *it->second;
+        auto const guard = this->readers.enter();
+        auto const& sinks_ = *this->sinks.load(std::memory_order_seq_cst);
+        auto it = std::ranges::find(sinks_, name, &NamedSink::name);
+        if (it != sinks_.end())
+            return *it->sink;
         throw std::runtime_error(std::format("Failed to find sink {0}", name));
     }
     void removeSink(std::string name)
     {
-        this->sinks.erase(name);
+        this->updateSinks([&](SinkList& sinks_) { std::erase_if(sinks_, [&](NamedSink const& s) { return s.name == name; }); });
+    }
+
+    #ifdef YALF_ENABLE_STATS
+    // A snapshot of the statistics of every sink, by name.
+    std::unordered_map<std::string, SinkStats> stats() const
+    {
+        std::unordered_map<std::string, SinkStats> out;
+        auto const guard = this->readers.enter();
+        for (auto const& [name, sink] : *this->sinks.load(std::memory_order_seq_cst))
+            out.emplace(name, sink->getStats());
+        return out;
     }
+    #endif
 
 private:
-    void dolog(LogLevel level, std::string_view domain, std::optional<std::string_view> instance, std::source_location src_location, std::string_view fmt, std::format_args args) const
+    struct NamedSink;
+    // Contiguous and in the order they were added, so that a log call walks one array.
+    using SinkList = std::vector<NamedSink>;
+
+public:
+    // Passed to the callable of a lazy log call, see logLazy(); the message is produced, and the arguments evaluated, only once a sink has accepted the entry.
+    class Emitter
+    {
+    public:
+        template <class... Args>
+        void operator()(std::format_string<Args...> fmt, Args&&... args)
+        {
+            this->vformat(fmt.get(), std::make_format_args(args...));
+        }
+        // Logs `msg` as is (it is not a format string).
+        void message(std::string_view msg)
+        {
+            this->emit(msg, {});
+        }
+        // Logs `msg` as is with structured fields.
+        template <std::same_as<Field>... Fields>
+        void fields(std::string_view msg, Fields const&... fields)
+        {
+            std::array<Field, sizeof...(Fields)> const field_array{ fields... };
+            this->emit(msg, field_array);
+        }
+
+    private:
+        friend class Logger;
+        Emitter(SinkList const& sinks_, std::uint64_t accepted_, EntryMetadata& meta_)
+            : sinks(sinks_)
+            , accepted(accepted_)
+            , meta(meta_)
+        {}
+        void vformat(std::string_view fmt, std::format_args args)
+        {
+            this->emit(std::vformat(fmt, args), {});
+        }
+        void emit(std::string_view msg, std::span<Field const> fields)
+        {
+            this->meta.fields = fields;
+            for (auto remaining = this->accepted; remaining != 0; remaining &= remaining - 1) {
+                auto& sink = *this->sinks[static_cast<std::size_t>(std::countr_zero(remaining))].sink;
+                #ifdef YALF_ENABLE_STATS
+                auto const before = std::chrono::steady_clock::now();
+                sink.log(this->meta, msg);
+                sink.stats_counters.countAccepted(std::chrono::steady_clock::now() - before);
+                #else
+                sink.log(this->meta, msg);
+                #endif
+            }
+        }
+
+        SinkList const& sinks;
+        std::uint64_t const accepted;
+        EntryMetadata& meta;
+    };
+
+    // Whether any sink accepts entries of `level` in `domain`, eg. to skip building expensive diagnostics.
+    // Only the level and domain are known, so a sink that filters on anything else sees an entry without an instance.
+    bool isEnabled(LogLevel level, DomainRef domain) const
     {
         EntryMetadata const meta = {
             .level = level,
-            .domain = domain,
+            .domain = domain.name,
+            .domain_id = domain.id,
+            .static_domain = domain.is_static,
+            .instance = std::nullopt,
+            .source_location = {},
+            .timestamp = {},
+            .suppressed = 0,
+            .fields = {},
+        };
+        auto const guard = this->readers.enter();
+        return std::ranges::any_of(*this->sinks.load(std::memory_order_seq_cst), [&](NamedSink const& s) { return s.sink->checkFilter(meta); });
+    }
+
+private:
+    // A non-owning reference to the callable that produces the message of an entry.
+    struct Producer
+    {
+        template <class Func>
+        Producer(Func const& func)
+            : callable(&func)
+            , invoke([](void const* f, Emitter& e) { (*static_cast<Func const*>(f))(e); })
+        {}
+        void const* callable;
+        void (*invoke)(void const*, Emitter&);
+    };
+
+    // If `instance_address` is given, the instance is that address in hex, which is only rendered once a sink has accepted the entry.
+    // `produce` is only called once a sink has accepted the entry.  Returns whether one did.
+    bool dolog(LogCall call, DomainRef domain, std::optional<std::string_view> instance, std::source_location src_location, Producer produce, void const* instance_address = nullptr) const
+    {
+        EntryMetadata meta = {
+            .level = call.level,
+            .domain = domain.name,
+            .domain_id = domain.id,
+            .static_domain = domain.is_static,
             .instance = instance,
             .source_location = src_location,
             .timestamp = std::chrono::time_point_cast<LogEntryTimestampDuration>(std::chrono::system_clock::now()),
+            .suppressed = call.suppressed,
+            .fields = {},
         };
-        bool const passed = [&] {
-            for (auto&& sink : this->sinks | std::views::values) {
-                if (sink->checkFilter(meta))
-                    return true;
-            }
+        auto const guard = this->readers.enter();
+        auto const& sinks_ = *this->sinks.load(std::memory_order_seq_cst);
+        // Each filter is evaluated once; bit i is set if sink i accepts the entry
+        std::uint64_t accepted = 0;
+        for (std::size_t i = 0; i < sinks_.size(); i++) {
+            if (sinks_[i].sink->checkFilter(meta))
+                accepted |= std::uint64_t{ 1 } << i;
+        }
+        #ifdef YALF_ENABLE_STATS
+        for (std::size_t i = 0; i < sinks_.size(); i++) {
+            if (!(accepted & (std::uint64_t{ 1 } << i)))
+                sinks_[i].sink->stats_counters.countFiltered();
+        }
+        #endif
+        if (accepted == 0)
             return false;
-        }();
-        if (passed) {
-            std::string const msg = std::vformat(fmt, args);
-            for (auto&& sink : this->sinks | std::views::values) {
-                if (sink->checkFilter(meta))
-                    sink->log(meta, msg);
-            }
+        std::array<char, 2 + 2 * sizeof(void*)> address_buf;
+        if (instance_address) {
+            address_buf[0] = '0';
+            address_buf[1] = 'x';
+            auto const end = std::to_chars(address_buf.data() + 2, address_buf.data() + address_buf.size(), reinterpret_cast<std::uintptr_t>(instance_address), 16).ptr;
+            meta.instance = std::string_view{ address_buf.data(), static_cast<std::size_t>(end - address_buf.data()) };
         }
+        Emitter emitter{ sinks_, accepted, meta };
+        produce.invoke(produce.callable, emitter);
+        return true;
     }
 
 public:
     template <class... Args>
-    void log(LogLevel level, std::string_view domain, std::source_location src_location, std::format_string<Args...> fmt, Args&&... args) const
+    void log(LogCall call, DomainRef domain, std::source_location src_location, std::format_string<Args...> fmt, Args&&... args) const
     {
-        this->dolog(level, domain, std::nullopt, src_location, fmt.get(), std::make_format_args(args...));
+        this->dolog(call, domain, std::nullopt, src_location, [&](Emitter& e) { e.vformat(fmt.get(), std::make_format_args(args...)); });
     }
 
     template <class... Args>
-    void log(LogLevel level, std::string_view domain, std::string_view instance, std::source_location src_location, std::format_string<Args...> fmt, Args&&... args) const
+    void log(LogCall call, DomainRef domain, std::string_view instance, std::source_location src_location, std::format_string<Args...> fmt, Args&&... args) const
     {
-        this->dolog(level, domain, instance, src_location, fmt.get(), std::make_format_args(args...));
+        this->dolog(call, domain, instance, src_location, [&](Emitter& e) { e.vformat(fmt.get(), std::make_format_args(args...)); });
+    }
+
+    // Logs `msg` as is (it is not a format string) with structured fields, see the LOG_*_KV macros.
+    template <std::same_as<Field>... Fields>
+    void logFields(LogCall call, DomainRef domain, std::source_location src_location, std::string_view msg, Fields const&... fields) const
+    {
+        this->dolog(call, domain, std::nullopt, src_location, [&](Emitter& e) { e.fields(msg, fields...); });
     }
 
     template <class ObjectType, class... Args>
         requires std::is_class_v<ObjectType>
-    void log(LogLevel level, ObjectType const* obj, std::source_location src_location, std::format_string<Args...> fmt, Args&&... args) const
+    void log(LogCall call, ObjectType const* obj, std::source_location src_location, std::format_string<Args...> fmt, Args&&... args) const
     {
-        auto const domain = [&] {
-            if constexpr (HasInstanceGetDomain<ObjectType>) {
-                return obj->getDomain();
-            }
-            else if constexpr (HasClassGetDomain<ObjectType>) {
-                return ObjectType::getDomain();
-            }
-            else {
-                return typeid(ObjectType).name();
-            }
-        }();
-        auto const instance = [&] {
-            if constexpr (HasGetName<ObjectType>) {
-                return obj->getName();
-            }
-            else {
-                return std::format("{}", (void*)obj);
-            }
-        }();
-        this->dolog(level, domain, instance, src_location, fmt.get(), std::make_format_args(args...));
+        this->logLazy(call, obj, src_location, [&](Emitter& e) { e.vformat(fmt.get(), std::make_format_args(args...)); });
+    }
+
+    // Filters the entry first and only then calls `produce(Emitter&)`, which logs the message through the Emitter, so that its arguments are only evaluated if a sink accepts the entry.
+    // The LOG_* macros wrap their arguments in such a callable.
+    // Returns whether a sink accepted the entry.
+    template <std::invocable<Emitter&> Func>
+    bool logLazy(LogCall call, DomainRef domain, std::source_location src_location, Func const& produce) const
+    {
+        return this->dolog(call, domain, std::nullopt, src_location, produce);
+    }
+
+    template <std::invocable<Emitter&> Func>
+    bool logLazy(LogCall call, DomainRef domain, std::string_view instance, std::source_location src_location, Func const& produce) const
+    {
+        return this->dolog(call, domain, instance, src_location, produce);
+    }
+
+    template <class ObjectType, std::invocable<Emitter&> Func>
+        requires std::is_class_v<ObjectType>
+    bool logLazy(LogCall call, ObjectType const* obj, std::source_location src_location, Func const& produce) const
+    {
+        // Per-instance domains can change, per-class ones are registered once per type
+        if constexpr (HasInstanceGetDomain<ObjectType> && !HasClassGetDomain<ObjectType>) {
+            auto const domain = obj->getDomain(); // May own the string
+            return this->dologObject(call, std::string_view{ domain }, obj, src_location, produce);
+        }
+        else {
+            return this->dologObject(call, getTypeDomain<ObjectType>(), obj, src_location, produce);
+        }
     }
 private:
-    std::unordered_map<std::string, std::unique_ptr<Sink>> sinks;
+    template <class ObjectType>
+    bool dologObject(LogCall call, DomainRef domain, ObjectType const* obj, std::source_location src_location, Producer produce) const
+    {
+        if constexpr (HasGetName<ObjectType>) {
+            return this->dolog(call, domain, obj->getName(), src_location, produce);
+        }
+        else {
+            return this->dolog(call, domain, std::nullopt, src_location, produce, static_cast<void const*>(obj));
+        }
+    }
+
+private:
+    struct NamedSink
+    {
+        std::string name;
+        std::shared_ptr<Sink> sink;
+    };
+
+    // Copy-on-write: log calls only load the current list, writers publish a modified copy.
+    // The old list, and any sink that only it holds, is destroyed here once no log call can still be using it.
+    template <class Func>
+    void updateSinks(Func&& f)
+    {
+        std::lock_guard g{ this->writer_mutex };
+        auto updated = std::make_unique<SinkList>(*this->sinks.load(std::memory_order_relaxed));
+        f(*updated);
+        std::unique_ptr<SinkList const> const old{ this->sinks.exchange(updated.release(), std::memory_order_seq_cst) };
+        this->readers.synchronize();
+    }
+
+    std::atomic<SinkList const*> sinks; // Owned
+    detail::ReaderEpochs readers; // Log calls that may be using `sinks`
+    std::mutex writer_mutex; // Serializes updateSinks
 };
 
 #ifdef YALF_IMPLEMENTATION
@@ -479,21 +1694,222 @@ Logger& getGlobalLogger()
     return *global_logger;
 }
 
+// Per-callsite state for the limiting macros (LOG_EVERY_N etc.).
+// admit() returns std::nullopt if the call is suppressed, otherwise the number of calls suppressed since the last admitted one.
+// If no sink accepts an admitted call, carry() hands its count back so that the next entry reports it.
+class EveryNLimiter
+{
+public:
+    explicit EveryNLimiter(std::uint64_t n_)
+        : n(std::max<std::uint64_t>(n_, 1))
+        , calls(0)
+        , carried(0)
+    {}
+    std::optional<std::uint64_t> admit()
+    {
+        auto const c = this->calls.fetch_add(1, std::memory_order_relaxed);
+        if (c % this->n != 0)
+            return std::nullopt;
+        auto const carried_over = this->carried.load(std::memory_order_relaxed) != 0 ? this->carried.exchange(0, std::memory_order_relaxed) : 0;
+        return (c == 0 ? 0 : this->n - 1) + carried_over;
+    }
+    void carry(std::uint64_t suppressed_)
+    {
+        this->carried.fetch_add(suppressed_, std::memory_order_relaxed);
+    }
+private:
+    std::uint64_t const n;
+    std::atomic<std::uint64_t> calls;
+    std::atomic<std::uint64_t> carried;
+};
+
+class FirstNLimiter
+{
+public:
+    explicit FirstNLimiter(std::uint64_t n_)
+        : n(n_)
+        , calls(0)
+    {}
+    std::optional<std::uint64_t> admit()
+    {
+        // Once the limit is reached the callsite only ever reads the counter
+        if (this->calls.load(std::memory_order_relaxed) >= this->n || this->calls.fetch_add(1, std::memory_order_relaxed) >= this->n)
+            return std::nullopt;
+        return 0;
+    }
+    void carry(std::uint64_t) {} // Admitted calls never follow suppressed ones
+private:
+    std::uint64_t const n;
+    std::atomic<std::uint64_t> calls;
+};
+
+// A token bucket of `burst` tokens refilled at `per_second` tokens per second, implemented as a lock-free GCRA.
+// A `per_second` of 0 (or less) suppresses every call.
+class RateLimiter
+{
+public:
+    explicit RateLimiter(double per_second, double burst = 0)
+        : never(!(per_second > 0))
+        , interval(this->never ? 0 : toNanoseconds(1e9 / per_second))
+        , tolerance(this->never ? 0 : toNanoseconds(1e9 / per_second * (std::max({ burst, per_second, 1.0 }) - 1)))
+        , theoretical_arrival(0)
+        , suppressed(0)
+    {}
+    std::optional<std::uint64_t> admit()
+    {
+        if (this->never) {
+            this->suppressed.fetch_add(1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        auto const now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        auto tat = this->theoretical_arrival.load(std::memory_order_relaxed);
+        while (true) {
+            auto const start = std::max(tat, now);
+            if (start - now > this->tolerance) {
+                this->suppressed.fetch_add(1, std::memory_order_relaxed);
+                return std::nullopt;
+            }
+            if (this->theoretical_arrival.compare_exchange_weak(tat, start + this->interval, std::memory_order_relaxed))
+                return this->suppressed.exchange(0, std::memory_order_relaxed);
+        }
+    }
+    void carry(std::uint64_t suppressed_)
+    {
+        this->suppressed.fetch_add(suppressed_, std::memory_order_relaxed);
+    }
+private:
+    // Tiny rates would overflow, so intervals are capped at 2^62 ns (about 146 years)
+    static std::int64_t toNanoseconds(double ns) { return static_cast<std::int64_t>(std::min(ns, 0x1p62)); }
+
+    bool const never;
+    std::int64_t const interval; // ns per token
+    std::int64_t const tolerance; // ns that the bucket may run ahead of `now`
+    std::atomic<std::int64_t> theoretical_arrival;
+    std::atomic<std::uint64_t> suppressed;
+};
+
+namespace detail {
+
+// xorshift64*, one generator per thread
+inline
+std::uint64_t fastRandom()
+{
+    thread_local std::uint64_t state = [] {
+        auto const seed = static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^ std::hash<std::thread::id>{}(std::this_thread::get_id());
+        return (seed * 0x9E3779B97F4A7C15ull) | 1;
+    }();
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1Dull;
+}
+
+}
+
+// Admits each call with the given probability. The suppressed count is kept per thread, in a PerThread.
+class SamplingLimiter
+{
+public:
+    explicit SamplingLimiter(double probability)
+        : threshold(static_cast<std::uint64_t>(std::clamp(probability, 0.0, 1.0) * 0x1p53))
+    {}
+    class PerThread
+    {
+    public:
+        constexpr explicit PerThread(SamplingLimiter const& limiter_) : limiter(limiter_) {}
+        std::optional<std::uint64_t> admit() { return this->limiter.admit(this->suppressed); }
+        void carry(std::uint64_t suppressed_) { this->suppressed += suppressed_; }
+    private:
+        SamplingLimiter const& limiter;
+        std::uint64_t suppressed = 0;
+    };
+    std::optional<std::uint64_t> admit(std::uint64_t& suppressed) const
+    {
+        if ((detail::fastRandom() >> 11) >= this->threshold) {
+            suppressed++;
+            return std::nullopt;
+        }
+        return std::exchange(suppressed, 0);
+    }
+private:
+    std::uint64_t const threshold; // probability * 2^53
+};
+
 }
 
-#define LOG_FATAL(domain_or_obj, ...)       ::YALF::getGlobalLogger().log(::YALF::LogLevel::Fatal,    domain_or_obj,    std::source_location::current(), __VA_ARGS__)
-#define LOG_FATAL_I(domain, instance, ...)  ::YALF::getGlobalLogger().log(::YALF::LogLevel::Fatal,    domain, instance, std::source_location::current(), __VA_ARGS__)
-#define LOG_CRIT(domain_or_obj, ...)        ::YALF::getGlobalLogger().log(::YALF::LogLevel::Critical, domain_or_obj,    std::source_location::current(), __VA_ARGS__)
-#define LOG_CRIT_I(domain, instance, ...)   ::YALF::getGlobalLogger().log(::YALF::LogLevel::Critical, domain, instance, std::source_location::current(), __VA_ARGS__)
-#define LOG_NOTICE(domain_or_obj, ...)      ::YALF::getGlobalLogger().log(::YALF::LogLevel::Notice,   domain_or_obj,    std::source_location::current(), __VA_ARGS__)
-#define LOG_NOTICE_I(domain, instance, ...) ::YALF::getGlobalLogger().log(::YALF::LogLevel::Notice,   domain, instance, std::source_location::current(), __VA_ARGS__)
-#define LOG_ERROR(domain_or_obj, ...)       ::YALF::getGlobalLogger().log(::YALF::LogLevel::Error,    domain_or_obj,    std::source_location::current(), __VA_ARGS__)
-#define LOG_ERROR_I(domain, instance, ...)  ::YALF::getGlobalLogger().log(::YALF::LogLevel::Error,    domain, instance, std::source_location::current(), __VA_ARGS__)
-#define LOG_WARN(domain_or_obj, ...)        ::YALF::getGlobalLogger().log(::YALF::LogLevel::Warning,  domain_or_obj,    std::source_location::current(), __VA_ARGS__)
-#define LOG_WARN_I(domain, instance, ...)   ::YALF::getGlobalLogger().log(::YALF::LogLevel::Warning,  domain, instance, std::source_location::current(), __VA_ARGS__)
-#define LOG_INFO(domain_or_obj, ...)        ::YALF::getGlobalLogger().log(::YALF::LogLevel::Info,     domain_or_obj,    std::source_location::current(), __VA_ARGS__)
-#define LOG_INFO_I(domain, instance, ...)   ::YALF::getGlobalLogger().log(::YALF::LogLevel::Info,     domain, instance, std::source_location::current(), __VA_ARGS__)
-#define LOG_DEBUG(domain_or_obj, ...)       ::YALF::getGlobalLogger().log(::YALF::LogLevel::Debug,    domain_or_obj,    std::source_location::current(), __VA_ARGS__)
-#define LOG_DEBUG_I(domain, instance, ...)  ::YALF::getGlobalLogger().log(::YALF::LogLevel::Debug,    domain, instance, std::source_location::current(), __VA_ARGS__)
-#define LOG_NOISE(domain_or_obj, ...)       ::YALF::getGlobalLogger().log(::YALF::LogLevel::Noise,    domain_or_obj,    std::source_location::current(), __VA_ARGS__)
-#define LOG_NOISE_I(domain, instance, ...)  ::YALF::getGlobalLogger().log(::YALF::LogLevel::Noise,    domain, instance, std::source_location::current(), __VA_ARGS__)
+// The arguments are only evaluated if a sink accepts the entry: they are wrapped in a callable that Logger::logLazy calls after filtering.
+#define YALF_LOG_ARGS(...)   [&](::YALF::Logger::Emitter& yalf_emit_) { yalf_emit_(__VA_ARGS__); }
+#define YALF_LOG_FIELDS(...) [&](::YALF::Logger::Emitter& yalf_emit_) { yalf_emit_.fields(__VA_ARGS__); }
+#define YALF_LOG_LAZY(func)  [&](::YALF::Logger::Emitter& yalf_emit_) { yalf_emit_.message(std::invoke(func)); }
+
+#define LOG_FATAL(domain_or_obj, ...)       ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Fatal,    domain_or_obj,    std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_FATAL_I(domain, instance, ...)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Fatal,    domain, instance, std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_CRIT(domain_or_obj, ...)        ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Critical, domain_or_obj,    std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_CRIT_I(domain, instance, ...)   ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Critical, domain, instance, std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_NOTICE(domain_or_obj, ...)      ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Notice,   domain_or_obj,    std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_NOTICE_I(domain, instance, ...) ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Notice,   domain, instance, std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_ERROR(domain_or_obj, ...)       ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Error,    domain_or_obj,    std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_ERROR_I(domain, instance, ...)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Error,    domain, instance, std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_WARN(domain_or_obj, ...)        ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Warning,  domain_or_obj,    std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_WARN_I(domain, instance, ...)   ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Warning,  domain, instance, std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_INFO(domain_or_obj, ...)        ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Info,     domain_or_obj,    std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_INFO_I(domain, instance, ...)   ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Info,     domain, instance, std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_DEBUG(domain_or_obj, ...)       ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Debug,    domain_or_obj,    std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_DEBUG_I(domain, instance, ...)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Debug,    domain, instance, std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_NOISE(domain_or_obj, ...)       ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Noise,    domain_or_obj,    std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+#define LOG_NOISE_I(domain, instance, ...)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Noise,    domain, instance, std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))
+
+// Structured variants: `msg` is logged as is, followed by any number of kv(key, value) fields.
+// eg. LOG_INFO_KV("Net", "Connection closed", YALF::kv("peer", peer), YALF::kv("bytes", n));
+#define LOG_FATAL_KV(domain, msg, ...)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Fatal,    domain, std::source_location::current(), YALF_LOG_FIELDS(msg __VA_OPT__(,) __VA_ARGS__))
+#define LOG_CRIT_KV(domain, msg, ...)   ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Critical, domain, std::source_location::current(), YALF_LOG_FIELDS(msg __VA_OPT__(,) __VA_ARGS__))
+#define LOG_NOTICE_KV(domain, msg, ...) ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Notice,   domain, std::source_location::current(), YALF_LOG_FIELDS(msg __VA_OPT__(,) __VA_ARGS__))
+#define LOG_ERROR_KV(domain, msg, ...)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Error,    domain, std::source_location::current(), YALF_LOG_FIELDS(msg __VA_OPT__(,) __VA_ARGS__))
+#define LOG_WARN_KV(domain, msg, ...)   ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Warning,  domain, std::source_location::current(), YALF_LOG_FIELDS(msg __VA_OPT__(,) __VA_ARGS__))
+#define LOG_INFO_KV(domain, msg, ...)   ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Info,     domain, std::source_location::current(), YALF_LOG_FIELDS(msg __VA_OPT__(,) __VA_ARGS__))
+#define LOG_DEBUG_KV(domain, msg, ...)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Debug,    domain, std::source_location::current(), YALF_LOG_FIELDS(msg __VA_OPT__(,) __VA_ARGS__))
+#define LOG_NOISE_KV(domain, msg, ...)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Noise,    domain, std::source_location::current(), YALF_LOG_FIELDS(msg __VA_OPT__(,) __VA_ARGS__))
+
+// Lazy variants: `func` is a callable returning the message (anything convertible to std::string_view), which is logged as is and only called if a sink accepts the entry.
+// eg. LOG_DEBUG_LAZY("Net", [&] { return dumpState(); });
+#define LOG_FATAL_LAZY(domain_or_obj, func)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Fatal,    domain_or_obj, std::source_location::current(), YALF_LOG_LAZY(func))
+#define LOG_CRIT_LAZY(domain_or_obj, func)   ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Critical, domain_or_obj, std::source_location::current(), YALF_LOG_LAZY(func))
+#define LOG_NOTICE_LAZY(domain_or_obj, func) ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Notice,   domain_or_obj, std::source_location::current(), YALF_LOG_LAZY(func))
+#define LOG_ERROR_LAZY(domain_or_obj, func)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Error,    domain_or_obj, std::source_location::current(), YALF_LOG_LAZY(func))
+#define LOG_WARN_LAZY(domain_or_obj, func)   ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Warning,  domain_or_obj, std::source_location::current(), YALF_LOG_LAZY(func))
+#define LOG_INFO_LAZY(domain_or_obj, func)   ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Info,     domain_or_obj, std::source_location::current(), YALF_LOG_LAZY(func))
+#define LOG_DEBUG_LAZY(domain_or_obj, func)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Debug,    domain_or_obj, std::source_location::current(), YALF_LOG_LAZY(func))
+#define LOG_NOISE_LAZY(domain_or_obj, func)  ::YALF::getGlobalLogger().logLazy(::YALF::LogLevel::Noise,    domain_or_obj, std::source_location::current(), YALF_LOG_LAZY(func))
+
+// Limiting variants, which keep their state in a static per-callsite limiter and report how many calls they suppressed in the next entry (see %N).
+// `level` is the name of a LogLevel, eg. LOG_EVERY_N(Warning, 1000, "Net", "Dropped packet {}", id);
+// The suppressed count goes back to the limiter if no sink accepts the entry, so it is reported by the next entry that is logged.
+#define YALF_LOG_IF_ADMITTED(limiter, level, domain_or_obj, ...) \
+    if (auto const yalf_admitted_ = (limiter).admit()) \
+        if (!::YALF::getGlobalLogger().logLazy(::YALF::LogCall{ ::YALF::LogLevel::level, *yalf_admitted_ }, domain_or_obj, std::source_location::current(), YALF_LOG_ARGS(__VA_ARGS__))) \
+            (limiter).carry(*yalf_admitted_)
+// Logs the 1st, (n+1)th, (2n+1)th, ... call
+#define LOG_EVERY_N(level, n, domain_or_obj, ...) \
+    do { \
+        static ::YALF::EveryNLimiter yalf_limiter_{ n }; \
+        YALF_LOG_IF_ADMITTED(yalf_limiter_, level, domain_or_obj, __VA_ARGS__); \
+    } while (false)
+// Logs only the first n calls
+#define LOG_FIRST_N(level, n, domain_or_obj, ...) \
+    do { \
+        static ::YALF::FirstNLimiter yalf_limiter_{ n }; \
+        YALF_LOG_IF_ADMITTED(yalf_limiter_, level, domain_or_obj, __VA_ARGS__); \
+    } while (false)
+// Logs at most `per_second` calls per second, allowing bursts of up to `per_second` calls; 0 logs none
+#define LOG_EVERY_T(level, per_second, domain_or_obj, ...) \
+    do { \
+        static ::YALF::RateLimiter yalf_limiter_{ per_second }; \
+        YALF_LOG_IF_ADMITTED(yalf_limiter_, level, domain_or_obj, __VA_ARGS__); \
+    } while (false)
+// Logs each call with the given probability
+#define LOG_SAMPLED(level, probability, domain_or_obj, ...) \
+    do { \
+        static ::YALF::SamplingLimiter const yalf_sampler_{ probability }; \
+        static thread_local ::YALF::SamplingLimiter::PerThread yalf_limiter_{ yalf_sampler_ }; \
+        YALF_LOG_IF_ADMITTED(yalf_limiter_, level, domain_or_obj, __VA_ARGS__); \
+    } while (false)
@@ -0,0 +1,240 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "YALF.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace YALF {
+
+struct DedupOptions
+{
+    // While a run of duplicates continues, a summary is emitted at most this often.
+    std::chrono::milliseconds summary_interval = std::chrono::seconds{ 5 };
+};
+
+// Collapses runs of identical entries (same callsite, domain, instance, message, and fields) in the style of syslog's "last message repeated N times".
+// The first entry of a run is passed on; the rest are counted and passed on as a single summary entry, which is the last duplicate with `suppressed` set to the number of duplicates it stands for.
+// A summary is emitted when the run ends, once `summary_interval` has passed since the run's previous summary, and when the sink is destroyed.
+// A background thread emits the summary of a run that has stopped, so it is not held until the next entry arrives.
+class DedupSink : public Sink
+{
+public:
+    DedupSink(std::unique_ptr<Sink> underlying_, DedupOptions options_ = {})
+        : Sink()
+        , underlying(std::move(underlying_))
+        , options(options_)
+        , mtx()
+        , cv()
+        , stop_requested(false)
+        , last{}
+        , last_hash(0)
+        , repeats(0)
+        , last_summary()
+        , summarizer()
+    {
+        this->summarizer = std::thread{ &DedupSink::doSummaryWork, this };
+    }
+
+    ~DedupSink()
+    {
+        {
+            std::lock_guard lg{ this->mtx };
+            this->stop_requested = true;
+        }
+        this->cv.notify_one();
+        this->summarizer.join();
+        this->flushSummary();
+    }
+
+    virtual bool checkFilter(EntryMetadata const& entry) const override
+    {
+        return this->underlying->checkFilter(entry);
+    }
+    virtual void setDefaultLogLevel(LogLevel level) override
+    {
+        return this->underlying->setDefaultLogLevel(level);
+    }
+    virtual void setDomainLogLevel(std::string_view domain, LogLevel level) override
+    {
+        return this->underlying->setDomainLogLevel(domain, level);
+    }
+    virtual void clearDomainLogLevel(std::string_view domain) override
+    {
+        return this->underlying->clearDomainLogLevel(domain);
+    }
+
+    virtual void log(EntryMetadata const& meta, std::string_view msg) override
+    {
+        auto const hash = hashEntry(meta, msg);
+        auto lg = this->lockTimed(this->mtx);
+        if (this->last.valid && hash == this->last_hash && this->matchesLast(meta, msg)) {
+            bool const run_started = this->repeats == 0;
+            this->repeats += 1 + meta.suppressed;
+            this->last.timestamp = meta.timestamp;
+            this->countDropped();
+            if (std::chrono::steady_clock::now() - this->last_summary >= this->options.summary_interval)
+                this->flushSummary();
+            lg.unlock();
+            // The summarizer only waits for a deadline while duplicates are pending
+            if (run_started)
+                this->cv.notify_one();
+            return;
+        }
+        this->flushSummary();
+        this->underlying->log(meta, msg);
+        this->remember(meta, msg, hash);
+    }
+    virtual void flush() override
+    {
+        {
+            auto const lg = this->lockTimed(this->mtx);
+            if (std::chrono::steady_clock::now() - this->last_summary >= this->options.summary_interval)
+                this->flushSummary();
+        }
+        this->underlying->flush();
+    }
+
+    #ifdef YALF_ENABLE_STATS
+    virtual SinkStats getStats() const override
+    {
+        auto stats = Sink::getStats();
+        auto const underlying_stats = this->underlying->getStats();
+        stats.bytes_written += underlying_stats.bytes_written;
+        stats.dropped += underlying_stats.dropped;
+        return stats;
+    }
+    #endif
+
+private:
+    // An owning copy of the first entry of the current run
+    struct LastEntry
+    {
+        bool valid;
+        LogLevel level;
+        std::string_view domain; // A static domain, or domain_storage
+        std::string domain_storage;
+        DomainId domain_id;
+        bool static_domain;
+        std::optional<std::string> instance;
+        SourceLocation source_location;
+        LogEntryTimestamp timestamp;
+        std::string message;
+        OwnedFields fields;
+    };
+
+    static std::size_t hashEntry(EntryMetadata const& meta, std::string_view msg)
+    {
+        auto const combine = [](std::size_t seed, std::size_t h) { return seed ^ (h + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2)); };
+        auto h = std::hash<std::string_view>{}(msg);
+        h = combine(h, std::hash<std::string_view>{}(meta.source_location.file_name()));
+        h = combine(h, (std::size_t{ meta.source_location.line() } << 16) ^ meta.source_location.column());
+        h = combine(h, std::hash<std::string_view>{}(meta.domain));
+        h = combine(h, meta.instance ? std::hash<std::string_view>{}(*meta.instance) : 0);
+        for (auto const& f : meta.fields) {
+            h = combine(h, std::hash<std::string_view>{}(f.key));
+            h = combine(h, std::visit([](auto const& v) { return std::hash<std::decay_t<decltype(v)>>{}(v); }, f.value));
+        }
+        return h;
+    }
+
+    // Equal hashes are confirmed by comparing the entry with the stored one, so a collision does not drop a distinct entry
+    bool matchesLast(EntryMetadata const& meta, std::string_view msg) const
+    {
+        auto const& l = this->last;
+        auto const same_field = [](Field const& a, Field const& b) { return a.key == b.key && a.value == b.value; };
+        return l.level == meta.level
+            && l.domain == meta.domain
+            && l.message == msg
+            && (l.instance ? meta.instance && *l.instance == *meta.instance : !meta.instance)
+            && l.source_location.line() == meta.source_location.line()
+            && l.source_location.column() == meta.source_location.column()
+            && std::string_view{ l.source_location.file_name() } == meta.source_location.file_name()
+            && std::ranges::equal(l.fields.get(), meta.fields, same_field);
+    }
+
+    void remember(EntryMetadata const& meta, std::string_view msg, std::size_t hash)
+    {
+        // assign() keeps the strings' capacity, so a steady stream of distinct entries does not allocate
+        this->last.valid = true;
+        this->last.level = meta.level;
+        if (meta.static_domain) {
+            this->last.domain = meta.domain;
+        }
+        else {
+            this->last.domain_storage.assign(meta.domain);
+            this->last.domain = this->last.domain_storage;
+        }
+        this->last.domain_id = meta.domain_id;
+        this->last.static_domain = meta.static_domain;
+        if (meta.instance) {
+            if (!this->last.instance)
+                this->last.instance.emplace();
+            this->last.instance->assign(*meta.instance);
+        }
+        else {
+            this->last.instance.reset();
+        }
+        this->last.source_location = meta.source_location;
+        this->last.timestamp = meta.timestamp;
+        this->last.message.assign(msg);
+        this->last.fields.assign(meta.fields);
+        this->last_hash = hash;
+        this->repeats = 0;
+        this->last_summary = std::chrono::steady_clock::now();
+    }
+
+    void flushSummary()
+    {
+        if (this->repeats == 0)
+            return;
+        EntryMetadata const meta = {
+            .level = this->last.level,
+            .domain = this->last.domain,
+            .domain_id = this->last.domain_id,
+            .static_domain = this->last.static_domain,
+            .instance = this->last.instance,
+            .source_location = this->last.source_location,
+            .timestamp = this->last.timestamp,
+            .suppressed = this->repeats - 1, // The summary entry itself is the last duplicate
+            .fields = this->last.fields.get(),
+        };
+        this->underlying->log(meta, this->last.message);
+        this->repeats = 0;
+        this->last_summary = std::chrono::steady_clock::now();
+    }
+
+    void doSummaryWork()
+    {
+        std::unique_lock lg{ this->mtx };
+        while (!this->stop_requested) {
+            if (this->repeats == 0) {
+                this->cv.wait(lg);
+                continue;
+            }
+            auto const deadline = this->last_summary + this->options.summary_interval;
+            if (std::chrono::steady_clock::now() >= deadline) {
+                this->flushSummary();
+                this->underlying->flush();
+            }
+            else {
+                this->cv.wait_until(lg, deadline);
+            }
+        }
+    }
+
+private:
+    std::unique_ptr<Sink> underlying;
+    DedupOptions const options;
+    std::mutex mtx; // Everything below
+    std::condition_variable cv;
+    bool stop_requested;
+    LastEntry last;
+    std::size_t last_hash;
+    std::uint64_t repeats;
+    std::chrono::steady_clock::time_point last_summary;
+    std::thread summarizer;
+};
+
+}
@@ -3,37 +3,120 @@
 #pragma once
 #include "YALF.h"
 #include <condition_variable>
+#include <cstring>
 #include <thread>
 #include <mutex>
-#include <queue>
+
+#ifndef YALF_DEFERRED_INLINE_BYTES
+#define YALF_DEFERRED_INLINE_BYTES 256
+#endif
 
 namespace YALF {
 
+// A recycled slot of DeferredSink's queue.
+// The domain (unless it is static), instance, message, and field strings are packed into `inline_data`, or into `overflow` if they do not fit; both are kept when the slot is reused.
 struct DeferredLogEntry {
+    // Overflow buffers larger than this are released when the slot is reused, so that one huge message does not pin its memory forever
+    static constexpr std::size_t max_retained_overflow = 64 * 1024;
+
     LogLevel level;
-    std::string domain;
-    std::optional<std::string> instance;
-    std::source_location source_location;
+    std::string_view domain;
+    DomainId domain_id;
+    bool static_domain;
+    std::optional<std::string_view> instance;
+    SourceLocation source_location;
     LogEntryTimestamp timestamp;
-    std::string message;
+    std::uint64_t suppressed;
+    std::vector<Field> fields;
+    std::string_view message;
+    DeferredLogEntry* next = nullptr; // In the queue or the free list
+    std::string overflow;
+    std::array<char, YALF_DEFERRED_INLINE_BYTES> inline_data;
+
+    void assign(EntryMetadata const& meta, std::string_view msg)
+    {
+        // A static domain is referred to rather than copied; the source location's strings always are
+        std::size_t size = (meta.static_domain ? 0 : meta.domain.size()) + meta.instance.value_or(std::string_view{}).size() + msg.size();
+        for (auto const& f : meta.fields)
+            size += f.key.size() + (std::holds_alternative<std::string_view>(f.value) ? std::get<std::string_view>(f.value).size() : 0);
+        char* p = this->inline_data.data();
+        if (size > this->inline_data.size()) {
+            if (this->overflow.size() < size)
+                this->overflow.resize(size);
+            p = this->overflow.data();
+        }
+        auto const store = [&](std::string_view str) {
+            std::string_view const stored{ p, str.size() };
+            if (!str.empty())
+                std::memcpy(p, str.data(), str.size());
+            p += str.size();
+            return stored;
+        };
+        this->level = meta.level;
+        this->domain = meta.static_domain ? meta.domain : store(meta.domain);
+        this->domain_id = meta.domain_id;
+        this->static_domain = meta.static_domain;
+        this->instance = meta.instance ? std::optional<std::string_view>{ store(*meta.instance) } : std::nullopt;
+        this->source_location = meta.source_location;
+        this->timestamp = meta.timestamp;
+        this->suppressed = meta.suppressed;
+        this->message = store(msg);
+        this->fields.clear();
+        for (auto const& f : meta.fields) {
+            auto const key = store(f.key);
+            if (auto const* s = std::get_if<std::string_view>(&f.value))
+                this->fields.push_back(Field{ key, store(*s) });
+            else
+                this->fields.push_back(Field{ key, f.value });
+        }
+    }
+    EntryMetadata metadata() const
+    {
+        return EntryMetadata{
+            .level = this->level,
+            .domain = this->domain,
+            .domain_id = this->domain_id,
+            .static_domain = this->static_domain,
+            .instance = this->instance,
+            .source_location = this->source_location,
+            .timestamp = this->timestamp,
+            .suppressed = this->suppressed,
+            .fields = this->fields,
+        };
+    }
+    void recycle()
+    {
+        if (this->overflow.capacity() > max_retained_overflow)
+            std::string{}.swap(this->overflow);
+    }
 };
 
 class DeferredSink : public Sink
 {
 public:
-    DeferredSink(std::unique_ptr<Sink> underlying_)
+    // `initial_slots` entries can be queued before the pool has to grow; growing allocates, and touches fresh memory, on the logging thread.
+    DeferredSink(std::unique_ptr<Sink> underlying_, std::size_t initial_slots = 1024)
         : Sink()
         , underlying(std::move(underlying_))
         , stop_requested(false)
         , mtx{}
         , cv()
-        , queue{}
-        , worker(&DeferredSink::doBackgroundWork, this)
-    {}
+        , head(nullptr)
+        , tail(nullptr)
+        , free_list(nullptr)
+        , blocks()
+        , worker()
+    {
+        this->grow(std::max<std::size_t>(initial_slots, 1));
+        this->worker = std::thread{ &DeferredSink::doBackgroundWork, this };
+    }
 
     ~DeferredSink()
     {
-        this->stop_requested = true;
+        {
+            std::lock_guard lg{ this->mtx };
+            this->stop_requested = true;
+        }
         this->cv.notify_one();
         this->worker.join();
     }
@@ -57,51 +140,91 @@ public:
 
     virtual void log(EntryMetadata const& meta, std::string_view msg) override
     {
-        DeferredLogEntry dle = {
-            .level = meta.level,
-            .domain = std::string{meta.domain},
-            .instance = [&]() -> std::optional<std::string> { if (meta.instance){ return std::string{meta.instance.value()}; } else { return std::nullopt; } }(),
-            .source_location = meta.source_location,
-            .timestamp = meta.timestamp,
-            .message = std::string{msg},
-        };
+        // Once the pool has grown to the largest backlog, this reuses slots (and their buffers) and does not allocate.
+        // Copying into the slot under the lock costs less than taking a second lock for the free list.
+        bool was_empty;
         {
-            std::lock_guard lg {this->mtx};
-            this->queue.push(std::move(dle));
+            auto const lg = this->lockTimed(this->mtx);
+            auto* const entry = this->acquire();
+            entry->assign(meta, msg);
+            was_empty = this->head == nullptr;
+            (was_empty ? this->head : this->tail->next) = entry;
+            this->tail = entry;
         }
-        this->cv.notify_one();
+        // The worker only waits while the queue is empty
+        if (was_empty)
+            this->cv.notify_one();
+    }
+
+    #ifdef YALF_ENABLE_STATS
+    // Bytes and drops happen in the underlying sink, on the worker thread.
+    virtual SinkStats getStats() const override
+    {
+        auto stats = Sink::getStats();
+        auto const underlying_stats = this->underlying->getStats();
+        stats.bytes_written += underlying_stats.bytes_written;
+        stats.dropped += underlying_stats.dropped;
+        return stats;
     }
+    #endif
 
 private:
+    static constexpr std::size_t block_size = 64; // Slots allocated at a time when the free list is empty
+
+    // Requires mtx, or that the worker has not started
+    void grow(std::size_t count)
+    {
+        // Value-initialized, so that the pages are touched here rather than one by one as the slots are first used
+        auto& block = this->blocks.emplace_back(std::make_unique<DeferredLogEntry[]>(count));
+        for (std::size_t i = count; i-- > 0; ) {
+            block[i].next = this->free_list;
+            this->free_list = &block[i];
+        }
+    }
+    // Requires mtx
+    DeferredLogEntry* acquire()
+    {
+        if (!this->free_list)
+            this->grow(block_size);
+        auto* const entry = this->free_list;
+        this->free_list = entry->next;
+        entry->next = nullptr;
+        return entry;
+    }
+
     void doBackgroundWork()
     {
-        while (!this->stop_requested){
-            std::unique_lock lg {this->mtx};
-            this->cv.wait(lg, [&]{ return this->stop_requested || !this->queue.empty(); });
-            while (!this->queue.empty()){
-                auto const& entry = this->queue.front();
-                lg.unlock();
-                auto const instance = [&]() -> std::optional<std::string> { if (entry.instance){ return entry.instance.value(); } else { return std::nullopt; }}();
-                EntryMetadata const meta = {
-                    .level = entry.level,
-                    .domain = entry.domain,
-                    .instance = instance,
-                    .source_location = entry.source_location,
-                    .timestamp = entry.timestamp,
-                };
-                this->underlying->log(meta, entry.message);
-                lg.lock();
-                this->queue.pop();
+        std::unique_lock lg{ this->mtx };
+        while (true) {
+            this->cv.wait(lg, [&]{ return this->stop_requested || this->head != nullptr; });
+            if (!this->head)
+                break; // Stopping, and drained
+            // Take everything queued so far, so producers only contend with the worker once per batch
+            auto* const batch = std::exchange(this->head, nullptr);
+            this->tail = nullptr;
+            lg.unlock();
+            DeferredLogEntry* last = nullptr;
+            for (auto* entry = batch; entry; entry = entry->next) {
+                this->underlying->log(entry->metadata(), entry->message);
+                entry->recycle();
+                last = entry;
             }
+            this->underlying->flush();
+            lg.lock();
+            last->next = this->free_list;
+            this->free_list = batch;
         }
     }
 
 private:
     std::unique_ptr<Sink> underlying;
-    std::atomic_bool stop_requested;
-    std::mutex mtx; // cv, queue
+    bool stop_requested; // mtx
+    std::mutex mtx; // cv, head, tail, free_list, blocks
     std::condition_variable cv;
-    std::queue<DeferredLogEntry> queue;
+    DeferredLogEntry* head; // The oldest queued entry
+    DeferredLogEntry* tail;
+    DeferredLogEntry* free_list;
+    std::vector<std::unique_ptr<DeferredLogEntry[]>> blocks; // Owns every slot
     std::thread worker;
 };
 
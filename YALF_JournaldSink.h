@@ -0,0 +1,257 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "YALF.h"
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef __linux__
+#error "YALF_JournaldSink.h requires Linux"
+#endif
+
+namespace YALF {
+
+struct JournaldOptions
+{
+    // journald's native protocol socket; point it elsewhere to log to a stand-in
+    std::filesystem::path socket_path = "/run/systemd/journal/socket";
+    // SYSLOG_IDENTIFIER, the program's name if empty
+    std::string identifier = {};
+};
+
+namespace detail {
+
+// Builds one entry of journald's native protocol as a list of iovecs that point at the entry's strings where they are, instead of concatenating them.
+// Each field is `KEY=value\n`, or `KEY\n<64-bit little-endian length>value\n` if the value contains a newline.
+// The few bytes that do not exist elsewhere (numbers, lengths, field names) are put in `scratch`, which is reserved up front so that it never moves.
+class JournalEntryBuilder
+{
+public:
+    void reset(std::size_t field_count)
+    {
+        this->iov.clear();
+        this->scratch.clear();
+        this->scratch.reserve(field_count * MaxScratchPerField);
+    }
+
+    void add(std::string_view key, std::string_view value)
+    {
+        this->push(key);
+        if (value.find('\n') == std::string_view::npos) {
+            this->push("=");
+        }
+        else {
+            std::array<char, 9> prefix{ '\n' };
+            auto const size = static_cast<std::uint64_t>(value.size());
+            for (std::size_t i = 0; i < 8; i++)
+                prefix[1 + i] = static_cast<char>((size >> (8 * i)) & 0xFF);
+            this->push(this->stash({ prefix.data(), prefix.size() }));
+        }
+        this->push(value);
+        this->push("\n");
+    }
+    template <class T>
+        requires std::is_arithmetic_v<T>
+    void add(std::string_view key, T value)
+    {
+        std::array<char, 32> buf;
+        auto const end = std::format_to_n(buf.data(), buf.size(), "{}", value).out;
+        this->add(key, this->stash({ buf.data(), static_cast<std::size_t>(end - buf.data()) }));
+    }
+    // Adds a structured field, with its key made into a valid journal field name: upper case letters, digits and underscores, starting with a letter.
+    void addField(Field const& field)
+    {
+        std::array<char, 64> name;
+        std::size_t n = 0;
+        if (field.key.empty() || !std::isalpha(static_cast<unsigned char>(field.key.front())))
+            name[n++] = 'F';
+        for (char c : field.key) {
+            if (n == name.size())
+                break;
+            name[n++] = std::isalnum(static_cast<unsigned char>(c)) ? static_cast<char>(std::toupper(static_cast<unsigned char>(c))) : '_';
+        }
+        auto const key = this->stash({ name.data(), n });
+        std::visit([&](auto const& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, std::string_view>)
+                this->add(key, v);
+            else if constexpr (std::is_same_v<T, bool>)
+                this->add(key, v ? std::string_view{ "true" } : std::string_view{ "false" });
+            else
+                this->add(key, v);
+        }, field.value);
+    }
+
+    std::span<iovec const> get() const { return this->iov; }
+    std::size_t size() const
+    {
+        std::size_t total = 0;
+        for (auto const& v : this->iov)
+            total += v.iov_len;
+        return total;
+    }
+
+private:
+    // A field name, a number and a length prefix
+    static constexpr std::size_t MaxScratchPerField = 64 + 32 + 9;
+
+    void push(std::string_view s)
+    {
+        this->iov.push_back(iovec{ const_cast<char*>(s.data()), s.size() });
+    }
+    std::string_view stash(std::string_view s)
+    {
+        assert(this->scratch.size() + s.size() <= this->scratch.capacity());
+        auto const offset = this->scratch.size();
+        this->scratch.append(s);
+        return std::string_view{ this->scratch }.substr(offset, s.size());
+    }
+
+    std::vector<iovec> iov;
+    std::string scratch;
+};
+
+}
+
+// Sends entries to systemd-journald over its native protocol, keeping the metadata as separate journal fields:
+// MESSAGE, PRIORITY, CODE_FILE, CODE_LINE, CODE_FUNC, SYSLOG_IDENTIFIER, YALF_DOMAIN, YALF_INSTANCE, YALF_SUPPRESSED, and one field per structured field.
+// Each entry is one datagram; entries too large for a datagram are written to a sealed memfd whose descriptor is sent instead, as sd_journal_send() does.
+// The socket is not locked, datagrams are sent atomically.
+class JournaldSink : public Sink
+{
+public:
+    JournaldSink(JournaldOptions options_ = {})
+        : Sink()
+        , options(std::move(options_))
+        , address{}
+        , address_size(0)
+        , fd(-1)
+    {
+        auto const path = this->options.socket_path.native();
+        if (path.size() >= sizeof(this->address.sun_path))
+            throw std::invalid_argument(std::format("Journal socket path {} is too long", path));
+        this->address.sun_family = AF_UNIX;
+        std::memcpy(this->address.sun_path, path.c_str(), path.size() + 1);
+        this->address_size = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+        if (this->options.identifier.empty())
+            this->options.identifier = defaultIdentifier();
+
+        this->fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (this->fd < 0)
+            throw std::runtime_error(std::format("Failed to create journal socket: {}", std::strerror(errno)));
+        // Best effort; larger datagrams avoid the memfd path
+        int const sndbuf = 8 * 1024 * 1024;
+        ::setsockopt(this->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    }
+    ~JournaldSink()
+    {
+        ::close(this->fd);
+    }
+    JournaldSink(JournaldSink const&) = delete;
+    JournaldSink& operator=(JournaldSink const&) = delete;
+
+    virtual void log(EntryMetadata const& meta, std::string_view msg) override
+    {
+        thread_local detail::JournalEntryBuilder entry;
+        entry.reset(9 + meta.fields.size());
+        entry.add("MESSAGE", msg);
+        entry.add("PRIORITY", getSyslogSeverity(meta.level));
+        entry.add("CODE_FILE", std::string_view{ meta.source_location.file_name() });
+        entry.add("CODE_LINE", meta.source_location.line());
+        entry.add("CODE_FUNC", std::string_view{ meta.source_location.function_name() });
+        if (!this->options.identifier.empty())
+            entry.add("SYSLOG_IDENTIFIER", this->options.identifier);
+        entry.add("YALF_DOMAIN", meta.domain);
+        if (meta.instance)
+            entry.add("YALF_INSTANCE", *meta.instance);
+        if (meta.suppressed != 0)
+            entry.add("YALF_SUPPRESSED", meta.suppressed);
+        for (auto const& f : meta.fields)
+            entry.addField(f);
+
+        if (this->send(entry.get()))
+            this->countBytesWritten(entry.size());
+        else
+            this->countDropped();
+    }
+
+private:
+    static std::string defaultIdentifier()
+    {
+        #ifdef __GLIBC__
+        return program_invocation_short_name;
+        #else
+        return {};
+        #endif
+    }
+
+    bool send(std::span<iovec const> iov) const
+    {
+        if (iov.size() <= IOV_MAX) {
+            msghdr mh{};
+            mh.msg_name = const_cast<sockaddr_un*>(&this->address);
+            mh.msg_namelen = this->address_size;
+            mh.msg_iov = const_cast<iovec*>(iov.data());
+            mh.msg_iovlen = iov.size();
+            if (::sendmsg(this->fd, &mh, MSG_NOSIGNAL) >= 0)
+                return true;
+            if (errno != EMSGSIZE && errno != ENOBUFS)
+                return false;
+        }
+        return this->sendViaMemfd(iov);
+    }
+
+    // journald reads the entry from a sealed memfd passed with SCM_RIGHTS in an otherwise empty datagram.
+    bool sendViaMemfd(std::span<iovec const> iov) const
+    {
+        int const mfd = ::memfd_create("yalf-journal", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (mfd < 0)
+            return false;
+        bool ok = true;
+        for (std::size_t i = 0; ok && i < iov.size(); i += IOV_MAX) {
+            auto const chunk = iov.subspan(i, std::min<std::size_t>(IOV_MAX, iov.size() - i));
+            std::size_t expected = 0;
+            for (auto const& v : chunk)
+                expected += v.iov_len;
+            ok = ::writev(mfd, chunk.data(), static_cast<int>(chunk.size())) == static_cast<ssize_t>(expected);
+        }
+        ok = ok && ::fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0;
+        if (ok) {
+            alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int))> control{};
+            msghdr mh{};
+            mh.msg_name = const_cast<sockaddr_un*>(&this->address);
+            mh.msg_namelen = this->address_size;
+            mh.msg_control = control.data();
+            mh.msg_controllen = control.size();
+            cmsghdr* const cmsg = CMSG_FIRSTHDR(&mh);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(cmsg), &mfd, sizeof(int));
+            ok = ::sendmsg(this->fd, &mh, MSG_NOSIGNAL) >= 0;
+        }
+        ::close(mfd);
+        return ok;
+    }
+
+private:
+    JournaldOptions options;
+    sockaddr_un address;
+    socklen_t address_size;
+    int fd;
+};
+inline
+std::unique_ptr<Sink> makeJournaldSink(JournaldOptions options = {})
+{
+    return std::make_unique<JournaldSink>(std::move(options));
+}
+
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "YALF.h"
+
+namespace YALF {
+
+// Appends the entry as a single-line JSON object, without the trailing newline:
+// {"timestamp":"2024-05-01T12:00:00.123456Z","level":"Info","domain":"Net","instance":"conn1","file":"...","line":12,"function":"...","message":"...","fields":{...}}
+// "instance" is omitted if the entry has none, "suppressed" is present if it is non-zero, and "fields" if there are any.
+inline
+void formatJsonLine(std::string& out, EntryMetadata const& meta, std::string_view msg)
+{
+    auto out_it = std::back_inserter(out);
+    std::format_to(out_it, "{{\"timestamp\":\"{:%FT%T}Z\",\"level\":\"{}\",\"domain\":", toSystemTime(meta.timestamp), getLogLevelString(meta.level));
+    appendJsonString(out, meta.domain);
+    if (meta.instance) {
+        out += ",\"instance\":";
+        appendJsonString(out, *meta.instance);
+    }
+    out += ",\"file\":";
+    appendJsonString(out, meta.source_location.file_name());
+    std::format_to(out_it, ",\"line\":{},\"function\":", meta.source_location.line());
+    appendJsonString(out, meta.source_location.function_name());
+    out += ",\"message\":";
+    appendJsonString(out, msg);
+    if (meta.suppressed != 0)
+        std::format_to(out_it, ",\"suppressed\":{}", meta.suppressed);
+    if (!meta.fields.empty()) {
+        out += ",\"fields\":";
+        appendFieldsJson(out, meta.fields);
+    }
+    out += '}';
+}
+
+// Writes one JSON object per entry and line (JSON Lines), see formatJsonLine().
+class JsonLinesSink : public Sink
+{
+public:
+    JsonLinesSink(std::filesystem::path filename)
+        : Sink()
+        , m()
+        , of(filename, std::ios_base::out | std::ios_base::ate | std::ios_base::binary)
+    {
+        this->of.exceptions(std::ios_base::failbit | std::ios_base::badbit);
+    }
+    virtual void log(EntryMetadata const& meta, std::string_view msg) override
+    {
+        thread_local std::string line;
+        line.clear();
+        formatJsonLine(line, meta, msg);
+        line += '\n';
+        auto const g = this->lockTimed(this->m);
+        this->of.write(line.data(), static_cast<std::streamsize>(line.size()));
+        this->countBytesWritten(line.size());
+    }
+private:
+    std::mutex m;
+    std::ofstream of;
+};
+inline
+std::unique_ptr<Sink> makeJsonLinesSink(std::filesystem::path filename)
+{
+    std::filesystem::create_directories(filename.parent_path());
+    return std::make_unique<JsonLinesSink>(filename);
+}
+
+}
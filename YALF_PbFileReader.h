@@ -0,0 +1,422 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "YALF_PbFileSink.h"
+#include <google/protobuf/io/coded_stream.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace YALF {
+
+// An owning, decoded copy of an entry read back from a file written by ProtobufFileSink.
+struct PbLogEntry
+{
+    LogLevel level;
+    std::string domain;
+    std::optional<std::string> instance;
+    std::string filename;
+    std::uint32_t line;
+    std::uint32_t column;
+    std::string function;
+    LogEntryTimestamp timestamp;
+    std::string message;
+    std::uint64_t suppressed;
+    OwnedFields fields;
+};
+
+inline
+std::vector<PbIndexRecord> readPbIndex(std::filesystem::path index_filename)
+{
+    std::vector<PbIndexRecord> index;
+    std::ifstream in(index_filename, std::ios_base::in | std::ios_base::binary);
+    if (!in)
+        return index;
+    using google::protobuf::io::CodedInputStream;
+    std::array<std::uint8_t, PbIndexRecordSize> buf;
+    while (in.read(reinterpret_cast<char*>(buf.data()), buf.size())) {
+        std::uint64_t offset, min_ticks, max_ticks;
+        auto const* p = buf.data();
+        p = CodedInputStream::ReadLittleEndian64FromArray(p, &offset);
+        p = CodedInputStream::ReadLittleEndian64FromArray(p, &min_ticks);
+        p = CodedInputStream::ReadLittleEndian64FromArray(p, &max_ticks);
+        index.push_back(PbIndexRecord{
+            .offset = offset,
+            .min_ticks = static_cast<LogEntryTimestampClock::rep>(min_ticks),
+            .max_ticks = static_cast<LogEntryTimestampClock::rep>(max_ticks),
+        });
+    }
+    return index;
+}
+
+namespace detail {
+
+inline
+void decodeFields(google::protobuf::RepeatedPtrField<DTO::Field> const& fields, OwnedFields& out)
+{
+    thread_local std::vector<Field> views; // Refer into `fields` until they are copied by assign()
+    views.clear();
+    for (auto const& f : fields) {
+        switch (f.value_case()) {
+            case DTO::Field::kIntValue: views.push_back(Field{ f.key(), std::int64_t{ f.int_value() } }); break;
+            case DTO::Field::kUintValue: views.push_back(Field{ f.key(), std::uint64_t{ f.uint_value() } }); break;
+            case DTO::Field::kDoubleValue: views.push_back(Field{ f.key(), f.double_value() }); break;
+            case DTO::Field::kBoolValue: views.push_back(Field{ f.key(), f.bool_value() }); break;
+            case DTO::Field::kStringValue: views.push_back(Field{ f.key(), std::string_view{ f.string_value() } }); break;
+            case DTO::Field::VALUE_NOT_SET: views.push_back(Field{ f.key(), std::string_view{} }); break;
+        }
+    }
+    out.assign(views);
+}
+
+}
+
+// Decodes DTO messages into PbLogEntry, tracking the v2 per-block state.
+class PbEntryDecoder
+{
+public:
+    PbEntryDecoder() = default;
+
+    void restart()
+    {
+        this->prev_ticks = 0;
+        this->callsites.clear();
+    }
+
+    void decode(DTO::LogEntry const& entry, PbLogEntry& out) const
+    {
+        out.level = static_cast<LogLevel>(entry.level());
+        out.domain = entry.domain();
+        out.instance = entry.instance().empty() ? std::nullopt : std::optional<std::string>{ entry.instance() };
+        out.filename = entry.filename();
+        out.line = entry.line();
+        out.column = entry.column();
+        out.function = entry.function();
+        auto const since_epoch = std::chrono::seconds{ entry.timestamp().seconds() } + std::chrono::nanoseconds{ entry.timestamp().nanos() };
+        out.timestamp = LogEntryTimestamp{ std::chrono::duration_cast<LogEntryTimestampDuration>(since_epoch) };
+        out.message = entry.message();
+        out.suppressed = entry.suppressed();
+        detail::decodeFields(entry.fields(), out.fields);
+    }
+    // Returns false if the entry refers to a callsite that was not defined since the last restart.
+    bool decode(DTO::CompactEntry const& entry, PbLogEntry& out)
+    {
+        if (entry.has_callsite_def()) {
+            auto const& def = entry.callsite_def();
+            this->callsites[def.id()] = CallsiteInfo{ def.filename(), def.line(), def.column(), def.function() };
+        }
+        auto const it = this->callsites.find(entry.callsite());
+        if (it == this->callsites.end())
+            return false;
+        this->prev_ticks += entry.timestamp_delta();
+
+        out.level = static_cast<LogLevel>(entry.level());
+        out.domain = entry.domain();
+        out.instance = entry.instance().empty() ? std::nullopt : std::optional<std::string>{ entry.instance() };
+        out.filename = it->second.filename;
+        out.line = it->second.line;
+        out.column = it->second.column;
+        out.function = it->second.function;
+        out.timestamp = LogEntryTimestamp{ LogEntryTimestampDuration{ this->prev_ticks } };
+        out.message = entry.message();
+        out.suppressed = entry.suppressed();
+        detail::decodeFields(entry.fields(), out.fields);
+        return true;
+    }
+
+private:
+    struct CallsiteInfo
+    {
+        std::string filename;
+        std::uint32_t line;
+        std::uint32_t column;
+        std::string function;
+    };
+
+    LogEntryTimestampClock::rep prev_ticks = 0;
+    std::unordered_map<std::uint32_t, CallsiteInfo> callsites;
+};
+
+class PbFileReader
+{
+public:
+    // Opens a v1 or v2 file and loads its sidecar index if there is one.
+    PbFileReader(std::filesystem::path filename)
+        : in(filename, std::ios_base::in | std::ios_base::binary)
+        , zis()
+        , schema(PbSchema::V1)
+        , framed(false)
+        , compression(PbCompression::None)
+        , data_offset(0)
+        , index(readPbIndex(pbIndexPath(filename)))
+        , later_min_ticks(laterMinTicks(this->index))
+        , decoder()
+        , codec(PbCompression::None)
+    {
+        if (!this->in)
+            throw std::runtime_error(std::format("Failed to open {}", filename.string()));
+        std::array<char, PbFileMagic.size()> magic{};
+        this->in.read(magic.data(), magic.size());
+        if (this->in && std::string_view{ magic.data(), magic.size() } == PbFileMagic) {
+            this->schema = PbSchema::V2;
+            this->data_offset = magic.size();
+            this->seekOffset(this->data_offset);
+            DTO::Record record;
+            if (this->readRecord(record) != ReadStatus::Ok || !record.has_header())
+                throw std::runtime_error(std::format("{} is missing its stream header", filename.string()));
+            if (record.header().schema_version() != PbSchemaVersion)
+                throw std::runtime_error(std::format("{} has unsupported schema version {}", filename.string(), record.header().schema_version()));
+            if (record.header().tick_num() != LogEntryTimestampResolution::num || record.header().tick_den() != LogEntryTimestampResolution::den)
+                throw std::runtime_error(std::format("{} was written with a different YALF_TIMESTAMP_RESOLUTION", filename.string()));
+            if (!DTO::Compression_IsValid(record.header().compression()))
+                throw std::runtime_error(std::format("{} has unsupported compression {}", filename.string(), record.header().compression()));
+            this->framed = record.header().framed();
+            this->compression = static_cast<PbCompression>(record.header().compression());
+            this->codec = PbBlockCodec(this->compression);
+        }
+        else {
+            this->seekOffset(0);
+        }
+    }
+
+    PbSchema getSchema() const { return this->schema; }
+    bool isFramed() const { return this->framed; }
+    PbCompression getCompression() const { return this->compression; }
+    bool hasIndex() const { return !this->index.empty(); }
+    // The number of corrupt regions skipped by resynchronizing on the next PbSyncMarker.
+    std::size_t getCorruptRegionCount() const { return this->corrupt_regions; }
+
+    // Positions the reader at the start of the earliest block that can contain entries at or after `from`.
+    // Without an index this rewinds to the start of the file.
+    void seek(LogEntryTimestamp from)
+    {
+        auto const ticks = from.time_since_epoch().count();
+        auto it = std::ranges::lower_bound(this->index, ticks, std::less{}, &PbIndexRecord::max_ticks);
+        if (it == this->index.end() && !this->index.empty())
+            --it; // Only the last indexed block and the unindexed tail can contain it
+        this->seekOffset(it != this->index.end() ? it->offset : this->data_offset);
+    }
+
+    // Reads the next entry.  Returns false at the end of the file.
+    // In framed files a corrupt or truncated region is skipped up to the next block, otherwise it throws.
+    bool next(PbLogEntry& out)
+    {
+        if (this->schema == PbSchema::V1) {
+            DTO::LogEntry entry;
+            if (this->readRecord(entry) != ReadStatus::Ok)
+                return false;
+            this->decoder.decode(entry, out);
+            return true;
+        }
+        DTO::Record record;
+        while (true) {
+            auto const record_offset = this->streamOffset();
+            auto status = this->readRecord(record);
+            if (status == ReadStatus::Ok && record.has_entry() && !this->decoder.decode(record.entry(), out)) {
+                if (!this->framed)
+                    throw std::runtime_error(std::format("Undefined callsite {} in protobuf log file", record.entry().callsite()));
+                status = ReadStatus::Corrupt;
+            }
+            switch (status) {
+                case ReadStatus::End: return false;
+                case ReadStatus::Corrupt:
+                    // A bad record inside a compressed block is only found after the whole block has been read, so rescan from the block itself
+                    this->corrupt_regions++;
+                    if (!this->resync((this->compression != PbCompression::None ? this->current_block_offset : record_offset) + 1))
+                        return false;
+                    break;
+                case ReadStatus::Ok:
+                    if (record.has_restart()) {
+                        this->decoder.restart();
+                    }
+                    else if (record.has_entry()) {
+                        return true;
+                    }
+                    break;
+            }
+        }
+    }
+
+    // Calls `f` with every entry whose timestamp is in [from, to].
+    template <class Func>
+    void forEachInRange(LogEntryTimestamp from, LogEntryTimestamp to, Func&& f)
+    {
+        this->seek(from);
+        auto const to_ticks = to.time_since_epoch().count();
+        auto next_block = std::ranges::upper_bound(this->index, this->current_block_offset, std::less{}, &PbIndexRecord::offset);
+        PbLogEntry entry;
+        while (this->next(entry)) {
+            while (next_block != this->index.end() && this->streamOffset() > next_block->offset) {
+                // Once no later indexed block has an entry in the range, skip to the last one, which is followed by the unindexed tail
+                auto const i = static_cast<std::size_t>(next_block - this->index.begin());
+                if (this->later_min_ticks[i] > to_ticks && next_block + 1 != this->index.end()) {
+                    this->seekOffset(this->index.back().offset);
+                    next_block = this->index.end();
+                    break;
+                }
+                ++next_block;
+            }
+            if (entry.timestamp >= from && entry.timestamp <= to)
+                f(entry);
+        }
+    }
+
+private:
+    // For each indexed block, the earliest timestamp in it or any later indexed block, as entries may be slightly out of order
+    static std::vector<LogEntryTimestampClock::rep> laterMinTicks(std::vector<PbIndexRecord> const& index)
+    {
+        std::vector<LogEntryTimestampClock::rep> later(index.size());
+        auto min_ticks = std::numeric_limits<LogEntryTimestampClock::rep>::max();
+        for (std::size_t i = index.size(); i-- > 0; ) {
+            min_ticks = std::min(min_ticks, index[i].min_ticks);
+            later[i] = min_ticks;
+        }
+        return later;
+    }
+
+    void seekOffset(std::uint64_t offset)
+    {
+        this->zis.reset();
+        this->in.clear();
+        this->in.seekg(static_cast<std::streamoff>(offset));
+        this->zis.emplace(&this->in);
+        this->stream_base = offset;
+        this->current_block_offset = offset;
+        this->decoder.restart();
+        this->block_data.clear();
+        this->block_pos = 0;
+    }
+    std::uint64_t streamOffset() const
+    {
+        return this->stream_base + static_cast<std::uint64_t>(this->zis->ByteCount());
+    }
+
+    enum class ReadStatus { Ok, End, Corrupt };
+
+    // A fresh CodedInputStream per message avoids its 2GB total byte limit; its destructor returns unread bytes to `zis`.
+    ReadStatus readRecord(google::protobuf::MessageLite& message)
+    {
+        if (this->compression != PbCompression::None)
+            return this->readBlockRecord(message);
+        google::protobuf::io::CodedInputStream cis(&*this->zis);
+        std::uint64_t size;
+        if (!cis.ReadVarint64(&size))
+            return ReadStatus::End;
+        if (!this->framed) {
+            auto const limit = cis.PushLimit(static_cast<int>(size));
+            if (!message.ParseFromCodedStream(&cis) || !cis.ConsumedEntireMessage())
+                throw std::runtime_error("Corrupt record in protobuf log file");
+            cis.PopLimit(limit);
+            return ReadStatus::Ok;
+        }
+        std::uint32_t crc;
+        if (size > PbMaxRecordSize
+            || !cis.ReadString(&this->scratch, static_cast<int>(size))
+            || !cis.ReadLittleEndian32(&crc)
+            || crc != crc32c(this->scratch)
+            || !message.ParseFromString(this->scratch))
+            return ReadStatus::Corrupt;
+        return ReadStatus::Ok;
+    }
+
+    // Compressed files: records are read out of the current decompressed block, loading the next block when it is exhausted.
+    ReadStatus readBlockRecord(google::protobuf::MessageLite& message)
+    {
+        while (this->block_pos >= this->block_data.size()) {
+            auto const status = this->readBlock();
+            if (status != ReadStatus::Ok)
+                return status;
+        }
+        std::uint64_t size;
+        auto const n = detail::readVarint(this->block_data, this->block_pos, size);
+        if (n == 0 || this->block_pos + n + size > this->block_data.size()
+            || !message.ParseFromArray(this->block_data.data() + this->block_pos + n, static_cast<int>(size))) {
+            this->block_pos = this->block_data.size();
+            if (!this->framed)
+                throw std::runtime_error("Corrupt record in protobuf log file");
+            return ReadStatus::Corrupt;
+        }
+        this->block_pos += n + static_cast<std::size_t>(size);
+        return ReadStatus::Ok;
+    }
+    ReadStatus readBlock()
+    {
+        this->current_block_offset = this->streamOffset();
+        google::protobuf::io::CodedInputStream cis(&*this->zis);
+        void const* data;
+        int available;
+        if (!cis.GetDirectBufferPointer(&data, &available))
+            return ReadStatus::End;
+        std::uint64_t raw_size, compressed_size;
+        std::uint32_t crc;
+        bool const ok = (!this->framed || (cis.ReadString(&this->scratch, static_cast<int>(PbSyncMarker.size())) && this->scratch == PbSyncMarker))
+            && cis.ReadVarint64(&raw_size) && raw_size <= PbMaxBlockSize
+            && cis.ReadVarint64(&compressed_size) && compressed_size <= PbMaxBlockSize
+            && cis.ReadString(&this->scratch, static_cast<int>(compressed_size))
+            && (!this->framed || (cis.ReadLittleEndian32(&crc) && crc == crc32c(this->scratch)))
+            && this->codec.decompress(this->scratch, static_cast<std::size_t>(raw_size), this->block_data);
+        this->block_pos = 0;
+        if (!ok) {
+            this->block_data.clear();
+            if (!this->framed)
+                throw std::runtime_error("Corrupt block in protobuf log file");
+            return ReadStatus::Corrupt;
+        }
+        return ReadStatus::Ok;
+    }
+
+    // Scans forward from `offset` for the next PbSyncMarker and continues with the block that it starts.
+    // In uncompressed files the marker only counts when it is preceded by the rest of a Restart record, so marker bytes inside a message are skipped.
+    bool resync(std::uint64_t offset)
+    {
+        this->zis.reset();
+        this->in.clear();
+        this->in.seekg(static_cast<std::streamoff>(offset));
+        static std::string const no_prefix;
+        auto const& prefix = this->compression != PbCompression::None ? no_prefix : detail::framedRestartPrefix();
+        std::boyer_moore_horspool_searcher const searcher(PbSyncMarker.begin(), PbSyncMarker.end());
+        std::vector<char> buf(64 * 1024);
+        std::size_t kept = 0;
+        std::uint64_t buf_offset = offset;
+        while (true) {
+            this->in.read(buf.data() + kept, static_cast<std::streamsize>(buf.size() - kept));
+            auto const len = kept + static_cast<std::size_t>(this->in.gcount());
+            if (len == kept)
+                break;
+            for (auto it = buf.begin() + static_cast<std::ptrdiff_t>(std::min(prefix.size(), len)); ; ++it) {
+                it = std::search(it, buf.begin() + len, searcher);
+                if (it == buf.begin() + len)
+                    break;
+                // Compressed blocks start with the marker, otherwise the block starts with the Restart record, which is read (and checked) again
+                if (std::equal(prefix.begin(), prefix.end(), it - static_cast<std::ptrdiff_t>(prefix.size()))) {
+                    this->seekOffset(buf_offset + static_cast<std::uint64_t>(it - buf.begin()) - prefix.size());
+                    return true;
+                }
+            }
+            kept = std::min(len, prefix.size() + PbSyncMarker.size() - 1);
+            std::copy(buf.begin() + (len - kept), buf.begin() + len, buf.begin());
+            buf_offset += len - kept;
+        }
+        this->seekOffset(buf_offset + kept);
+        return false;
+    }
+
+    std::ifstream in;
+    std::optional<google::protobuf::io::IstreamInputStream> zis;
+    PbSchema schema;
+    bool framed;
+    PbCompression compression;
+    std::uint64_t data_offset;
+    std::uint64_t stream_base = 0;
+    std::uint64_t current_block_offset = 0;
+    std::vector<PbIndexRecord> index;
+    std::vector<LogEntryTimestampClock::rep> later_min_ticks; // Parallel to `index`
+    PbEntryDecoder decoder;
+    PbBlockCodec codec;
+    std::string scratch;
+    std::string block_data;
+    std::size_t block_pos = 0;
+    std::size_t corrupt_regions = 0;
+};
+
+}
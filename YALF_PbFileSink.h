@@ -4,61 +4,622 @@
 #include "YALF.h"
 #include "Logger.pb.h"
 #include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <cstring>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define YALF_CRC32C_SSE42
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define YALF_CRC32C_ARM
+#endif
+#ifdef YALF_PB_ZSTD
+#include <zstd.h>
+#endif
 
 namespace YALF {
 
+enum class PbSchema
+{
+    V1, // Stream of length-delimited DTO::LogEntry
+    V2, // PbFileMagic, then a stream of length-delimited DTO::Record, starting with a DTO::StreamHeader
+};
+
+inline constexpr std::string_view PbFileMagic{ "\x89YALF\r\n\x1a", 8 };
+inline constexpr std::uint32_t PbSchemaVersion = 2;
+
+// 16 arbitrary bytes written at the start of every block of a framed file.
+inline constexpr std::string_view PbSyncMarker{ "\xd3\x1f\x7a\x0b\x96\x5c\x4e\x21\xe8\x33\xb4\x07\x6d\xaf\x59\xc2", 16 };
+inline constexpr std::size_t PbMaxRecordSize = 64 << 20;
+inline constexpr std::size_t PbMaxBlockSize = 1 << 30;
+
+enum class PbCompression
+{
+    None,
+    Zstd, // Requires YALF_PB_ZSTD to be defined and linking with libzstd
+};
+
+struct PbFileOptions
+{
+    PbSchema schema = PbSchema::V1;
+    bool framed = false; // V2 only: CRC32C after every record and PbSyncMarker at the start of every block
+    PbCompression compression = PbCompression::None; // V2 only: each block is compressed independently
+    int compression_level = 3;
+    bool write_index = false; // Maintain the sidecar time index at pbIndexPath(filename)
+    std::size_t block_entries = 4096; // A new block is started after this many entries...
+    std::size_t block_bytes = 1 << 20; // ...or this many bytes, whichever comes first
+};
+
+// The sidecar index is a sequence of fixed-size little-endian records, one per completed block.
+// max_ticks is the running maximum over this and all previous blocks, so it is sorted even when entries are slightly out of order.
+struct PbIndexRecord
+{
+    std::uint64_t offset; // Byte offset of the start of the block
+    LogEntryTimestampClock::rep min_ticks; // Earliest timestamp in the block
+    LogEntryTimestampClock::rep max_ticks; // Latest timestamp in this or any earlier block
+};
+inline constexpr std::size_t PbIndexRecordSize = 24;
+
 inline
-DTO::LogEntry encodeDto(EntryMetadata const& meta, std::string_view msg)
+std::filesystem::path pbIndexPath(std::filesystem::path filename)
+{
+    return filename += ".idx";
+}
+
+namespace detail {
+constexpr std::array<std::uint32_t, 256> makeCrc32cTable()
+{
+    std::array<std::uint32_t, 256> table{};
+    for (std::uint32_t i = 0; i < 256; i++) {
+        std::uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : (c >> 1);
+        table[i] = c;
+    }
+    return table;
+}
+inline constexpr auto crc32c_table = makeCrc32cTable();
+
+inline
+std::uint32_t crc32cSoftware(std::uint32_t crc, unsigned char const* p, std::size_t n)
+{
+    while (n--)
+        crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(YALF_CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+inline
+std::uint32_t crc32cHardware(std::uint32_t crc, unsigned char const* p, std::size_t n)
+{
+    std::uint64_t crc64 = crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        std::uint64_t v;
+        std::memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = static_cast<std::uint32_t>(crc64);
+    for (; n > 0; n--, p++)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+#elif defined(YALF_CRC32C_ARM)
+inline
+std::uint32_t crc32cHardware(std::uint32_t crc, unsigned char const* p, std::size_t n)
+{
+    for (; n >= 8; n -= 8, p += 8) {
+        std::uint64_t v;
+        std::memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+    }
+    for (; n > 0; n--, p++)
+        crc = __crc32cb(crc, *p);
+    return crc;
+}
+#endif
+
+inline
+void appendVarint(std::string& out, std::uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Returns the number of bytes consumed, or 0 if the varint is truncated or malformed.
+inline
+std::size_t readVarint(std::string_view data, std::size_t pos, std::uint64_t& value)
+{
+    value = 0;
+    for (std::size_t i = 0; i < 10 && pos + i < data.size(); i++) {
+        auto const b = static_cast<std::uint8_t>(data[pos + i]);
+        value |= std::uint64_t{ b & 0x7Fu } << (7 * i);
+        if ((b & 0x80) == 0)
+            return i + 1;
+    }
+    return 0;
+}
+
+// The bytes of a framed Restart record that precede its PbSyncMarker.
+inline
+std::string const& framedRestartPrefix()
+{
+    static std::string const prefix = [] {
+        DTO::Record record;
+        record.mutable_restart()->set_sync(PbSyncMarker.data(), PbSyncMarker.size());
+        std::string const payload = record.SerializeAsString();
+        std::string framed;
+        appendVarint(framed, payload.size());
+        framed += payload;
+        return framed.substr(0, framed.find(PbSyncMarker));
+    }();
+    return prefix;
+}
+}
+
+// Compresses and decompresses the blocks of a compressed v2 file, reusing the codec's context between blocks.
+class PbBlockCodec
+{
+public:
+    PbBlockCodec(PbCompression compression_, int level_ = 3)
+        : compression(compression_)
+        , level(level_)
+    {
+        #ifndef YALF_PB_ZSTD
+        if (this->compression == PbCompression::Zstd)
+            throw std::invalid_argument("Zstd compression requires YALF_PB_ZSTD to be defined");
+        #endif
+    }
+
+    void compress(std::string_view in, std::string& out)
+    {
+        #ifdef YALF_PB_ZSTD
+        if (this->compression == PbCompression::Zstd) {
+            if (!this->cctx)
+                this->cctx.reset(ZSTD_createCCtx());
+            out.resize(ZSTD_compressBound(in.size()));
+            auto const n = ZSTD_compressCCtx(this->cctx.get(), out.data(), out.size(), in.data(), in.size(), this->level);
+            if (ZSTD_isError(n))
+                throw std::runtime_error("Failed to compress protobuf log block");
+            out.resize(n);
+            return;
+        }
+        #endif
+        out.assign(in);
+    }
+    bool decompress(std::string_view in, std::size_t raw_size, std::string& out)
+    {
+        #ifdef YALF_PB_ZSTD
+        if (this->compression == PbCompression::Zstd) {
+            if (!this->dctx)
+                this->dctx.reset(ZSTD_createDCtx());
+            out.resize(raw_size);
+            auto const n = ZSTD_decompressDCtx(this->dctx.get(), out.data(), out.size(), in.data(), in.size());
+            return !ZSTD_isError(n) && n == raw_size;
+        }
+        #endif
+        out.assign(in);
+        return out.size() == raw_size;
+    }
+
+private:
+    PbCompression compression;
+    int level;
+    #ifdef YALF_PB_ZSTD
+    struct CCtxDeleter { void operator()(ZSTD_CCtx* c) const { ZSTD_freeCCtx(c); } };
+    struct DCtxDeleter { void operator()(ZSTD_DCtx* c) const { ZSTD_freeDCtx(c); } };
+    std::unique_ptr<ZSTD_CCtx, CCtxDeleter> cctx;
+    std::unique_ptr<ZSTD_DCtx, DCtxDeleter> dctx;
+    #endif
+};
+
+// CRC-32C (Castagnoli), using the SSE4.2 or ARMv8 CRC instructions when available.
+inline
+std::uint32_t crc32c(std::string_view data)
+{
+    auto const* p = reinterpret_cast<unsigned char const*>(data.data());
+    #if defined(YALF_CRC32C_SSE42)
+    static bool const has_sse42 = __builtin_cpu_supports("sse4.2");
+    if (has_sse42)
+        return ~detail::crc32cHardware(~0u, p, data.size());
+    #elif defined(YALF_CRC32C_ARM)
+    return ~detail::crc32cHardware(~0u, p, data.size());
+    #endif
+    return ~detail::crc32cSoftware(~0u, p, data.size());
+}
+
+inline
+void encodeFields(google::protobuf::RepeatedPtrField<DTO::Field>& out, std::span<Field const> fields)
+{
+    for (auto const& f : fields) {
+        auto& field = *out.Add();
+        field.set_key(f.key.data(), f.key.size());
+        std::visit([&](auto const& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, std::int64_t>) field.set_int_value(v);
+            else if constexpr (std::is_same_v<T, std::uint64_t>) field.set_uint_value(v);
+            else if constexpr (std::is_same_v<T, double>) field.set_double_value(v);
+            else if constexpr (std::is_same_v<T, bool>) field.set_bool_value(v);
+            else field.set_string_value(v.data(), v.size());
+        }, f.value);
+    }
+}
+
+// Entries that did not come from a log call (eg. ones read back from a file) can be encoded from a FormattableEntry.
+inline
+DTO::LogEntry encodeDto(FormattableEntry const& meta, std::string_view msg)
 {
     DTO::LogEntry entry;
     entry.set_level(static_cast<YALF::DTO::LogLevel>(meta.level));
-    entry.set_domain(meta.domain.data());
+    entry.set_domain(meta.domain.data(), meta.domain.size());
     if (meta.instance)
-        entry.set_instance(meta.instance.value().data());
-    entry.set_filename(meta.source_location.file_name());
-    entry.set_line(meta.source_location.line());
-    entry.set_column(meta.source_location.column());
-    entry.set_function(meta.source_location.function_name());
+        entry.set_instance(meta.instance.value().data(), meta.instance.value().size());
+    entry.set_filename(meta.file_name.data(), meta.file_name.size());
+    entry.set_line(meta.line);
+    entry.set_column(meta.column);
+    entry.set_function(meta.function_name.data(), meta.function_name.size());
 
     auto const tp_sec = std::chrono::time_point_cast<std::chrono::seconds>(meta.timestamp);
     std::chrono::nanoseconds const ns = meta.timestamp - tp_sec;
     entry.mutable_timestamp()->set_seconds(tp_sec.time_since_epoch().count());
     entry.mutable_timestamp()->set_nanos(ns.count());
+    entry.set_message(msg.data(), msg.size());
+    entry.set_suppressed(meta.suppressed);
+    encodeFields(*entry.mutable_fields(), meta.fields);
 
     return entry;
 }
+inline
+DTO::LogEntry encodeDto(EntryMetadata const& meta, std::string_view msg)
+{
+    return encodeDto(makeFormattableEntry(meta), msg);
+}
+
+// Per-file state for the v2 schema: the previous entry's timestamp and the callsites already defined in the file.
+class CompactDtoEncoder
+{
+public:
+    CompactDtoEncoder() = default;
+
+    DTO::Record header() const
+    {
+        DTO::Record record;
+        auto& hdr = *record.mutable_header();
+        hdr.set_schema_version(PbSchemaVersion);
+        if constexpr (std::is_same_v<LogEntryTimestampClock, std::chrono::system_clock>)
+            hdr.set_clock(DTO::ClockSystem);
+        else if constexpr (std::is_same_v<LogEntryTimestampClock, std::chrono::steady_clock>)
+            hdr.set_clock(DTO::ClockSteady);
+        else
+            hdr.set_clock(DTO::ClockUnknown);
+        hdr.set_tick_num(LogEntryTimestampResolution::num);
+        hdr.set_tick_den(LogEntryTimestampResolution::den);
+        return record;
+    }
+
+    DTO::Record encode(EntryMetadata const& meta, std::string_view msg)
+    {
+        DTO::Record record;
+        auto& entry = *record.mutable_entry();
+        entry.set_level(static_cast<YALF::DTO::LogLevel>(meta.level));
+
+        auto const ticks = meta.timestamp.time_since_epoch().count();
+        entry.set_timestamp_delta(ticks - this->prev_ticks);
+        this->prev_ticks = ticks;
+
+        auto const key = CallsiteKey{ meta.source_location.file_name(), meta.source_location.function_name(), meta.source_location.line(), meta.source_location.column() };
+        auto const [it, inserted] = this->callsites.try_emplace(key, static_cast<std::uint32_t>(this->callsites.size() + 1));
+        entry.set_callsite(it->second);
+        if (inserted) {
+            auto& def = *entry.mutable_callsite_def();
+            def.set_id(it->second);
+            def.set_filename(meta.source_location.file_name());
+            def.set_line(meta.source_location.line());
+            def.set_column(meta.source_location.column());
+            def.set_function(meta.source_location.function_name());
+        }
+
+        entry.set_domain(meta.domain.data(), meta.domain.size());
+        if (meta.instance)
+            entry.set_instance(meta.instance.value().data(), meta.instance.value().size());
+        entry.set_message(msg.data(), msg.size());
+        entry.set_suppressed(meta.suppressed);
+        encodeFields(*entry.mutable_fields(), meta.fields);
+        return record;
+    }
+
+    // Forget all per-file state so that the following entries can be decoded without anything before them.
+    DTO::Record restart()
+    {
+        this->prev_ticks = 0;
+        this->callsites.clear();
+        DTO::Record record;
+        record.mutable_restart();
+        return record;
+    }
+
+private:
+    // The function is part of the key as every instantiation of a template logs from the same file, line and column
+    struct CallsiteKey
+    {
+        char const* file_name;
+        char const* function_name;
+        std::uint_least32_t line;
+        std::uint_least32_t column;
+        bool operator==(CallsiteKey const&) const = default;
+    };
+    struct CallsiteKeyHash
+    {
+        std::size_t operator()(CallsiteKey const& key) const
+        {
+            return std::hash<char const*>{}(key.file_name) ^ (std::hash<char const*>{}(key.function_name) * 31) ^ (std::size_t{ key.line } << 16) ^ key.column;
+        }
+    };
+
+    LogEntryTimestampClock::rep prev_ticks = 0;
+    std::unordered_map<CallsiteKey, std::uint32_t, CallsiteKeyHash> callsites;
+};
+
+inline
+DTO::Record encodeDto(CompactDtoEncoder& encoder, EntryMetadata const& meta, std::string_view msg)
+{
+    return encoder.encode(meta, msg);
+}
 
 class ProtobufFileSink : public Sink
 {
 public:
-    ProtobufFileSink(std::filesystem::path filename)
+    ProtobufFileSink(std::filesystem::path filename, PbFileOptions options_ = {})
         : Sink()
+        , options(options_)
+        , encoder()
         , of(filename, std::ios_base::out | std::ios_base::ate | std::ios_base::binary)
+        , idx()
+        , base_offset(0)
         , oos(&this->of)
         , cos(&this->oos, true)
+        , block{}
+        , scratch()
+        , block_buffer()
+        , codec(options_.compression, options_.compression_level)
+        , blocks_m()
+        , blocks_cv()
+        , pending_blocks()
+        , spare_buffers()
+        , stop_requested(false)
+        , compressor()
     {
+        if (this->options.framed && this->options.schema != PbSchema::V2)
+            throw std::invalid_argument("Framed protobuf log files require PbSchema::V2");
+        if (this->options.compression != PbCompression::None && this->options.schema != PbSchema::V2)
+            throw std::invalid_argument("Compressed protobuf log files require PbSchema::V2");
         this->of.exceptions(std::ios_base::failbit | std::ios_base::badbit);
+        this->base_offset = static_cast<std::uint64_t>(this->of.tellp());
+        if (this->options.write_index) {
+            this->idx.open(pbIndexPath(filename), std::ios_base::out | std::ios_base::ate | std::ios_base::binary);
+            this->idx.exceptions(std::ios_base::failbit | std::ios_base::badbit);
+        }
+        if (this->options.schema == PbSchema::V2) {
+            auto header = this->encoder.header();
+            header.mutable_header()->set_framed(this->options.framed);
+            header.mutable_header()->set_compression(static_cast<DTO::Compression>(this->options.compression));
+            this->cos.WriteRaw(PbFileMagic.data(), static_cast<int>(PbFileMagic.size()));
+            this->cos.WriteVarint64(header.ByteSizeLong());
+            header.SerializeWithCachedSizes(&this->cos);
+        }
+        this->beginBlock();
+        if (this->isCompressed())
+            this->compressor = std::thread{ &ProtobufFileSink::doCompressionWork, this };
+    }
+    ProtobufFileSink(std::filesystem::path filename, PbSchema schema)
+        : ProtobufFileSink(filename, PbFileOptions{ .schema = schema })
+    {}
+    ~ProtobufFileSink()
+    {
+        if (this->block.entries != 0)
+            this->endBlock();
+        if (this->compressor.joinable()) {
+            {
+                std::lock_guard lg{ this->blocks_m };
+                this->stop_requested = true;
+            }
+            this->blocks_cv.notify_all();
+            this->compressor.join();
+        }
     }
     virtual void log(EntryMetadata const& meta, std::string_view msg) override
     {
-        auto const entry = encodeDto(meta, msg);
-        auto const msg_byte_count = entry.ByteSizeLong();
-
-        std::lock_guard g{ this->m };
-        cos.WriteVarint64(msg_byte_count);
-        entry.SerializeToCodedStream(&this->cos);
+        if (this->isCompressed()) {
+            // The output stream belongs to the compression thread, which counts the bytes it writes
+            auto const g = this->lockTimed(this->m);
+            this->writeDelimited(encodeDto(this->encoder, meta, msg));
+            this->endEntry(meta.timestamp);
+        }
+        else if (this->options.schema == PbSchema::V2) {
+            auto const g = this->lockTimed(this->m);
+            auto const before = this->currentOffset();
+            this->writeDelimited(encodeDto(this->encoder, meta, msg));
+            this->endEntry(meta.timestamp);
+            this->countBytesWritten(static_cast<std::size_t>(this->currentOffset() - before));
+        }
+        else {
+            auto const entry = encodeDto(meta, msg);
+            auto const g = this->lockTimed(this->m);
+            auto const before = this->currentOffset();
+            this->writeDelimited(entry);
+            this->endEntry(meta.timestamp);
+            this->countBytesWritten(static_cast<std::size_t>(this->currentOffset() - before));
+        }
     }
 private:
+    struct BlockState
+    {
+        std::uint64_t offset;
+        std::size_t entries;
+        LogEntryTimestampClock::rep min_ticks;
+        LogEntryTimestampClock::rep max_ticks;
+    };
+    // A completed block of a compressed file, waiting for the compression thread.
+    struct PendingBlock
+    {
+        std::string raw;
+        BlockState state;
+    };
+    static constexpr std::size_t max_pending_blocks = 4; // The thread completing a block waits beyond this, bounding the memory held by a lagging compressor
+
+    std::uint64_t currentOffset() const
+    {
+        return this->base_offset + static_cast<std::uint64_t>(this->cos.ByteCount());
+    }
+    bool isCompressed() const
+    {
+        return this->options.compression != PbCompression::None;
+    }
+    // Records of compressed files are collected in `block_buffer` and are unframed, the block as a whole is framed instead.
+    void writeDelimited(google::protobuf::MessageLite const& message)
+    {
+        if (this->isCompressed()) {
+            auto const size = message.ByteSizeLong();
+            detail::appendVarint(this->block_buffer, size);
+            auto const offset = this->block_buffer.size();
+            this->block_buffer.resize(offset + size);
+            message.SerializeWithCachedSizesToArray(reinterpret_cast<std::uint8_t*>(this->block_buffer.data() + offset));
+            return;
+        }
+        if (!this->options.framed) {
+            this->cos.WriteVarint64(message.ByteSizeLong());
+            message.SerializeWithCachedSizes(&this->cos);
+            return;
+        }
+        message.SerializeToString(&this->scratch);
+        this->cos.WriteVarint64(this->scratch.size());
+        this->cos.WriteString(this->scratch);
+        this->cos.WriteLittleEndian32(crc32c(this->scratch));
+    }
+    void beginBlock()
+    {
+        // The offset of a compressed block is only known once the compression thread writes it
+        this->block.offset = this->isCompressed() ? 0 : this->currentOffset();
+        this->block.entries = 0;
+        this->block.min_ticks = std::numeric_limits<LogEntryTimestampClock::rep>::max();
+        if (this->options.schema == PbSchema::V2) {
+            auto restart = this->encoder.restart();
+            if (this->options.framed && !this->isCompressed())
+                restart.mutable_restart()->set_sync(PbSyncMarker.data(), PbSyncMarker.size());
+            this->writeDelimited(restart);
+        }
+    }
+    void endEntry(LogEntryTimestamp timestamp)
+    {
+        auto const ticks = timestamp.time_since_epoch().count();
+        this->block.entries++;
+        this->block.min_ticks = std::min(this->block.min_ticks, ticks);
+        this->block.max_ticks = std::max(this->block.max_ticks, ticks);
+        auto const block_bytes = this->isCompressed() ? this->block_buffer.size() : this->currentOffset() - this->block.offset;
+        if (this->block.entries >= this->options.block_entries || block_bytes >= this->options.block_bytes) {
+            this->endBlock();
+            this->beginBlock();
+        }
+    }
+    void endBlock()
+    {
+        if (!this->isCompressed()) {
+            this->writeIndexRecord(this->block);
+            return;
+        }
+        // Hand the raw block to the compression thread and continue with a recycled buffer
+        {
+            std::unique_lock lk{ this->blocks_m };
+            this->blocks_cv.wait(lk, [&] { return this->pending_blocks.size() < max_pending_blocks; });
+            std::string next;
+            if (!this->spare_buffers.empty()) {
+                next = std::move(this->spare_buffers.back());
+                this->spare_buffers.pop_back();
+            }
+            this->pending_blocks.push_back(PendingBlock{ std::exchange(this->block_buffer, std::move(next)), this->block });
+        }
+        this->blocks_cv.notify_all();
+    }
+    // Compressed files: runs on `compressor`, the only thread that writes to the output stream and the index after construction.
+    void doCompressionWork()
+    {
+        std::string compressed;
+        std::unique_lock lk{ this->blocks_m };
+        while (true) {
+            this->blocks_cv.wait(lk, [&] { return this->stop_requested || !this->pending_blocks.empty(); });
+            if (this->pending_blocks.empty())
+                break; // Stopping, and drained
+            auto pending = std::move(this->pending_blocks.front());
+            this->pending_blocks.pop_front();
+            lk.unlock();
+            this->blocks_cv.notify_all();
+            try {
+                this->codec.compress(pending.raw, compressed);
+                pending.state.offset = this->currentOffset();
+                if (this->options.framed)
+                    this->cos.WriteRaw(PbSyncMarker.data(), static_cast<int>(PbSyncMarker.size()));
+                this->cos.WriteVarint64(pending.raw.size());
+                this->cos.WriteVarint64(compressed.size());
+                this->cos.WriteString(compressed);
+                if (this->options.framed)
+                    this->cos.WriteLittleEndian32(crc32c(compressed));
+                this->countBytesWritten(static_cast<std::size_t>(this->currentOffset() - pending.state.offset));
+                this->writeIndexRecord(pending.state);
+            }
+            catch (std::exception const&) {
+                // There is no caller to report this to; the block's entries are lost
+                for (std::size_t i = 0; i < pending.state.entries; i++)
+                    this->countDropped();
+            }
+            pending.raw.clear();
+            lk.lock();
+            this->spare_buffers.push_back(std::move(pending.raw));
+        }
+    }
+    void writeIndexRecord(BlockState const& state)
+    {
+        if (!this->options.write_index)
+            return;
+        using google::protobuf::io::CodedOutputStream;
+        std::array<std::uint8_t, PbIndexRecordSize> buf;
+        auto* p = buf.data();
+        p = CodedOutputStream::WriteLittleEndian64ToArray(state.offset, p);
+        p = CodedOutputStream::WriteLittleEndian64ToArray(static_cast<std::uint64_t>(state.min_ticks), p);
+        p = CodedOutputStream::WriteLittleEndian64ToArray(static_cast<std::uint64_t>(state.max_ticks), p);
+        this->idx.write(reinterpret_cast<char const*>(buf.data()), buf.size());
+    }
+
+    PbFileOptions const options;
     std::mutex m;
+    CompactDtoEncoder encoder;
     std::ofstream of;
+    std::ofstream idx;
+    std::uint64_t base_offset;
     google::protobuf::io::OstreamOutputStream oos;
     google::protobuf::io::CodedOutputStream cos;
+    BlockState block;
+    std::string scratch;
+    std::string block_buffer;
+    PbBlockCodec codec; // compressor
+    std::mutex blocks_m; // blocks_cv, pending_blocks, spare_buffers, stop_requested
+    std::condition_variable blocks_cv;
+    std::deque<PendingBlock> pending_blocks;
+    std::vector<std::string> spare_buffers;
+    bool stop_requested;
+    std::thread compressor; // Only started for compressed files
 };
 
 inline
-std::unique_ptr<Sink> makePbFileSink(std::filesystem::path filename)
+std::unique_ptr<Sink> makePbFileSink(std::filesystem::path filename, PbFileOptions options = {})
+{
+    return std::make_unique<ProtobufFileSink>(filename, options);
+}
+inline
+std::unique_ptr<Sink> makePbFileSink(std::filesystem::path filename, PbSchema schema)
 {
-    return std::make_unique<ProtobufFileSink>(filename);
+    return makePbFileSink(filename, PbFileOptions{ .schema = schema });
 }
 
 }
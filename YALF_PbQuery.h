@@ -0,0 +1,437 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "YALF_PbFileReader.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <ostream>
+#include <thread>
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace YALF {
+
+struct PbQuery
+{
+    LogLevel level = LogLevel::Noise; // Entries of this level or more severe
+    std::optional<std::string> domain;
+    std::optional<LogEntryTimestamp> from;
+    std::optional<LogEntryTimestamp> to;
+    std::optional<std::string> contains; // Substring of the message
+
+    bool matches(PbLogEntry const& entry) const
+    {
+        if (entry.level > this->level)
+            return false;
+        if (this->domain && entry.domain != *this->domain)
+            return false;
+        if (this->from && entry.timestamp < *this->from)
+            return false;
+        if (this->to && entry.timestamp > *this->to)
+            return false;
+        if (this->contains && entry.message.find(*this->contains) == std::string::npos)
+            return false;
+        return true;
+    }
+};
+
+inline
+FormattableEntry makeFormattableEntry(PbLogEntry const& entry)
+{
+    return FormattableEntry{
+        .level = entry.level,
+        .domain = entry.domain,
+        .instance = entry.instance,
+        .file_name = entry.filename,
+        .function_name = entry.function,
+        .line = entry.line,
+        .column = entry.column,
+        .timestamp = entry.timestamp,
+        .suppressed = entry.suppressed,
+        .fields = entry.fields.get(),
+    };
+}
+
+// A read-only view of a whole file: mmap where available, otherwise read into memory.
+class MappedFile
+{
+public:
+    MappedFile(std::filesystem::path filename)
+    {
+        #ifdef _WIN32
+        std::ifstream in(filename, std::ios_base::in | std::ios_base::binary);
+        if (!in)
+            throw std::runtime_error(std::format("Failed to open {}", filename.string()));
+        this->buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        this->view = this->buffer;
+        #else
+        int const fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error(std::format("Failed to open {}", filename.string()));
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error(std::format("Failed to stat {}", filename.string()));
+        }
+        auto const size = static_cast<std::size_t>(st.st_size);
+        if (size != 0) {
+            void* const p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error(std::format("Failed to map {}", filename.string()));
+            }
+            ::madvise(p, size, MADV_SEQUENTIAL);
+            this->view = std::string_view{ static_cast<char const*>(p), size };
+        }
+        ::close(fd);
+        #endif
+    }
+    ~MappedFile()
+    {
+        #ifndef _WIN32
+        if (!this->view.empty())
+            ::munmap(const_cast<char*>(this->view.data()), this->view.size());
+        #endif
+    }
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    std::string_view data() const { return this->view; }
+
+private:
+    std::string_view view;
+    #ifdef _WIN32
+    std::string buffer;
+    #endif
+};
+
+namespace detail {
+// Finds the start of the next block of a framed file at or after `pos`.
+// Compressed blocks start with the PbSyncMarker, uncompressed blocks with a Restart record containing it.
+inline
+std::size_t findFramedBlock(std::string_view data, std::size_t pos, bool compressed)
+{
+    static std::string const no_prefix;
+    auto const& prefix = compressed ? no_prefix : framedRestartPrefix();
+    std::boyer_moore_horspool_searcher const searcher(PbSyncMarker.begin(), PbSyncMarker.end());
+    pos += prefix.size();
+    while (pos < data.size()) {
+        auto const it = std::search(data.begin() + pos, data.end(), searcher);
+        if (it == data.end())
+            break;
+        auto const marker = static_cast<std::size_t>(it - data.begin());
+        if (data.substr(marker - prefix.size(), prefix.size()) == prefix)
+            return marker - prefix.size();
+        pos = marker + 1;
+    }
+    return data.size();
+}
+}
+
+// Where the records of a file start, as determined from its magic and header.
+struct PbFileLayout
+{
+    PbSchema schema = PbSchema::V1;
+    bool framed = false;
+    PbCompression compression = PbCompression::None;
+    std::size_t data_offset = 0;
+};
+
+inline
+PbFileLayout readPbFileLayout(std::string_view data)
+{
+    PbFileLayout layout;
+    if (!data.starts_with(PbFileMagic))
+        return layout;
+    std::uint64_t size;
+    auto const n = detail::readVarint(data, PbFileMagic.size(), size);
+    DTO::Record record;
+    if (n == 0 || PbFileMagic.size() + n + size > data.size()
+        || !record.ParseFromArray(data.data() + PbFileMagic.size() + n, static_cast<int>(size))
+        || !record.has_header())
+        throw std::runtime_error("Protobuf log file is missing its stream header");
+    if (record.header().schema_version() != PbSchemaVersion)
+        throw std::runtime_error(std::format("Unsupported schema version {}", record.header().schema_version()));
+    if (record.header().tick_num() != LogEntryTimestampResolution::num || record.header().tick_den() != LogEntryTimestampResolution::den)
+        throw std::runtime_error("Protobuf log file was written with a different YALF_TIMESTAMP_RESOLUTION");
+    if (!DTO::Compression_IsValid(record.header().compression()))
+        throw std::runtime_error(std::format("Unsupported compression {}", record.header().compression()));
+    layout.schema = PbSchema::V2;
+    layout.framed = record.header().framed();
+    layout.compression = static_cast<PbCompression>(record.header().compression());
+    PbBlockCodec{ layout.compression }; // Throws here, rather than on the decoding threads, if the compression is not supported by this build
+    layout.data_offset = PbFileMagic.size() + n + static_cast<std::size_t>(size);
+    return layout;
+}
+
+// Splits the records of a file into [begin, end) byte ranges of roughly `target_size` that can be decoded independently.
+// Framed files are split on sync markers, indexed files on their index blocks, and anything else by walking the record (or
+// compressed block) lengths, splitting uncompressed v2 files only on Restart records.
+inline
+std::vector<std::pair<std::size_t, std::size_t>> splitPbFile(std::string_view data, PbFileLayout const& layout, std::vector<PbIndexRecord> const& index, std::size_t target_size)
+{
+    std::vector<std::size_t> starts{ layout.data_offset };
+    if (layout.framed) {
+        for (auto pos = layout.data_offset + target_size; pos < data.size(); ) {
+            auto const next = detail::findFramedBlock(data, pos, layout.compression != PbCompression::None);
+            if (next >= data.size())
+                break;
+            if (next > starts.back())
+                starts.push_back(next);
+            pos = next + target_size;
+        }
+    }
+    else if (!index.empty()) {
+        for (auto const& block : index) {
+            if (block.offset >= starts.back() + target_size && block.offset < data.size())
+                starts.push_back(block.offset);
+        }
+    }
+    else if (layout.compression != PbCompression::None) {
+        std::size_t pos = layout.data_offset;
+        while (pos < data.size()) {
+            std::uint64_t raw_size, compressed_size;
+            auto const n1 = detail::readVarint(data, pos, raw_size);
+            auto const n2 = n1 ? detail::readVarint(data, pos + n1, compressed_size) : 0;
+            if (n2 == 0)
+                break;
+            if (pos >= starts.back() + target_size)
+                starts.push_back(pos);
+            pos += n1 + n2 + compressed_size;
+        }
+    }
+    else {
+        constexpr char restart_tag = (DTO::Record::kRestartFieldNumber << 3) | 2;
+        std::size_t pos = layout.data_offset;
+        while (pos < data.size()) {
+            std::uint64_t size;
+            auto const n = detail::readVarint(data, pos, size);
+            if (n == 0)
+                break;
+            if (pos >= starts.back() + target_size && pos + n < data.size()
+                && (layout.schema == PbSchema::V1 || data[pos + n] == restart_tag))
+                starts.push_back(pos);
+            pos += n + size;
+        }
+    }
+    std::vector<std::pair<std::size_t, std::size_t>> chunks;
+    for (std::size_t i = 0; i < starts.size(); i++)
+        chunks.emplace_back(starts[i], i + 1 < starts.size() ? starts[i + 1] : data.size());
+    return chunks;
+}
+
+// Decodes the records in `chunk`, calling `f` with every entry.  Returns the number of corrupt regions encountered.
+// Framed chunks resynchronize after corruption, otherwise decoding of the chunk stops.
+namespace detail {
+template <class Func>
+std::size_t decodePbRecords(std::string_view chunk, PbFileLayout const& layout, PbEntryDecoder& decoder, PbLogEntry& entry, Func& f)
+{
+    DTO::LogEntry v1;
+    DTO::Record record;
+    std::size_t corrupt = 0;
+    std::size_t pos = 0;
+    while (pos < chunk.size()) {
+        std::uint64_t size;
+        auto const n = detail::readVarint(chunk, pos, size);
+        auto const trailer = layout.framed ? sizeof(std::uint32_t) : 0;
+        bool ok = n != 0 && size <= PbMaxRecordSize && pos + n + size + trailer <= chunk.size();
+        auto const payload = ok ? chunk.substr(pos + n, static_cast<std::size_t>(size)) : std::string_view{};
+        if (ok && layout.framed) {
+            std::uint32_t crc;
+            google::protobuf::io::CodedInputStream::ReadLittleEndian32FromArray(reinterpret_cast<std::uint8_t const*>(payload.data() + payload.size()), &crc);
+            ok = crc == crc32c(payload);
+        }
+        if (ok && layout.schema == PbSchema::V1) {
+            ok = v1.ParseFromArray(payload.data(), static_cast<int>(payload.size()));
+            if (ok) {
+                decoder.decode(v1, entry);
+                f(entry);
+            }
+        }
+        else if (ok) {
+            ok = record.ParseFromArray(payload.data(), static_cast<int>(payload.size()));
+            if (ok && record.has_restart())
+                decoder.restart();
+            else if (ok && record.has_entry()) {
+                ok = decoder.decode(record.entry(), entry);
+                if (ok)
+                    f(entry);
+            }
+        }
+        if (ok) {
+            pos += n + payload.size() + trailer;
+            continue;
+        }
+        corrupt++;
+        if (!layout.framed)
+            break;
+        pos = findFramedBlock(chunk, pos + 1, false);
+    }
+    return corrupt;
+}
+}
+
+template <class Func>
+std::size_t decodePbChunk(std::string_view chunk, PbFileLayout const& layout, Func&& f)
+{
+    PbEntryDecoder decoder;
+    PbLogEntry entry;
+    if (layout.compression == PbCompression::None)
+        return detail::decodePbRecords(chunk, layout, decoder, entry, f);
+
+    // The records inside of a compressed block are neither framed nor compressed
+    auto const block_layout = PbFileLayout{ .schema = layout.schema };
+    PbBlockCodec codec(layout.compression);
+    std::string block;
+    std::size_t corrupt = 0;
+    std::size_t pos = 0;
+    while (pos < chunk.size()) {
+        auto p = pos;
+        bool ok = !layout.framed || chunk.substr(p, PbSyncMarker.size()) == PbSyncMarker;
+        p += layout.framed ? PbSyncMarker.size() : 0;
+        std::uint64_t raw_size = 0, compressed_size = 0;
+        std::size_t n = ok ? detail::readVarint(chunk, p, raw_size) : 0;
+        p += n;
+        n = n ? detail::readVarint(chunk, p, compressed_size) : 0;
+        p += n;
+        auto const trailer = layout.framed ? sizeof(std::uint32_t) : 0;
+        ok = n != 0 && raw_size <= PbMaxBlockSize && p + compressed_size + trailer <= chunk.size();
+        auto const compressed = ok ? chunk.substr(p, static_cast<std::size_t>(compressed_size)) : std::string_view{};
+        if (ok && layout.framed) {
+            std::uint32_t crc;
+            google::protobuf::io::CodedInputStream::ReadLittleEndian32FromArray(reinterpret_cast<std::uint8_t const*>(compressed.data() + compressed.size()), &crc);
+            ok = crc == crc32c(compressed);
+        }
+        ok = ok && codec.decompress(compressed, static_cast<std::size_t>(raw_size), block);
+        if (ok) {
+            corrupt += detail::decodePbRecords(block, block_layout, decoder, entry, f);
+            pos = p + compressed.size() + trailer;
+            continue;
+        }
+        corrupt++;
+        if (!layout.framed)
+            break;
+        pos = detail::findFramedBlock(chunk, pos + 1, true);
+    }
+    return corrupt;
+}
+
+struct PbQueryStats
+{
+    std::size_t entries = 0;
+    std::size_t matches = 0;
+    std::size_t corrupt_regions = 0;
+};
+
+// Decodes `filename` on `threads` threads (0 = all cores) and writes every entry matching `query`, rendered with the format string `fmt`, to `out` in file order.
+inline
+PbQueryStats queryPbFile(std::filesystem::path filename, PbQuery const& query, std::string_view fmt, std::ostream& out, unsigned threads = 0)
+{
+    MappedFile const file(filename);
+    auto const data = file.data();
+    auto const layout = readPbFileLayout(data);
+    auto const index = readPbIndex(pbIndexPath(filename));
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    auto const target_size = std::clamp<std::size_t>(data.size() / (threads * 8), 1 << 20, 64 << 20);
+    auto chunks = splitPbFile(data, layout, index, target_size);
+
+    // Drop chunks that the index proves are entirely outside of the time range
+    if (!index.empty() && !layout.framed && (query.from || query.to)) {
+        auto const from_ticks = query.from ? query.from->time_since_epoch().count() : std::numeric_limits<LogEntryTimestampClock::rep>::min();
+        auto const to_ticks = query.to ? query.to->time_since_epoch().count() : std::numeric_limits<LogEntryTimestampClock::rep>::max();
+        std::erase_if(chunks, [&](auto const& chunk) {
+            auto const first = std::ranges::lower_bound(index, chunk.first, std::less{}, &PbIndexRecord::offset);
+            auto const last = std::ranges::lower_bound(index, chunk.second, std::less{}, &PbIndexRecord::offset);
+            if (first == last || last == index.end())
+                return false; // Not entirely covered by completed blocks
+            auto const min_ticks = std::ranges::min(std::ranges::subrange(first, last), std::less{}, &PbIndexRecord::min_ticks).min_ticks;
+            return std::prev(last)->max_ticks < from_ticks || min_ticks > to_ticks;
+        });
+    }
+
+    struct ChunkResult
+    {
+        bool done = false;
+        std::string text;
+        PbQueryStats stats;
+        std::exception_ptr error; // Rethrown on the calling thread
+    };
+    std::vector<ChunkResult> results(chunks.size());
+    std::mutex m; // results, next_chunk, written
+    std::condition_variable cv;
+    std::size_t next_chunk = 0;
+    std::size_t written = 0;
+    std::size_t const window = threads * 4; // Bounds the memory held by decoded chunks waiting to be written
+
+    auto worker = [&] {
+        while (true) {
+            std::size_t i;
+            {
+                std::unique_lock lk{ m };
+                cv.wait(lk, [&] { return next_chunk >= chunks.size() || next_chunk < written + window; });
+                if (next_chunk >= chunks.size())
+                    return;
+                i = next_chunk++;
+            }
+            ChunkResult r;
+            auto const chunk = data.substr(chunks[i].first, chunks[i].second - chunks[i].first);
+            try {
+                r.stats.corrupt_regions = decodePbChunk(chunk, layout, [&](PbLogEntry const& entry) {
+                    r.stats.entries++;
+                    if (query.matches(entry)) {
+                        r.stats.matches++;
+                        formatEntryTo(r.text, fmt, makeFormattableEntry(entry), entry.message);
+                    }
+                });
+            }
+            catch (...) {
+                r.error = std::current_exception();
+            }
+            r.done = true;
+            {
+                std::lock_guard lk{ m };
+                results[i] = std::move(r);
+            }
+            cv.notify_all();
+        }
+    };
+    std::vector<std::jthread> pool;
+    for (unsigned t = 0; t < std::min<std::size_t>(threads, chunks.size()); t++)
+        pool.emplace_back(worker);
+
+    PbQueryStats stats;
+    for (std::size_t i = 0; i < results.size(); i++) {
+        ChunkResult r;
+        {
+            std::unique_lock lk{ m };
+            cv.wait(lk, [&] { return results[i].done; });
+            r = std::move(results[i]);
+            if (r.error)
+                next_chunk = chunks.size(); // Stops the workers once they finish their current chunks
+        }
+        if (r.error) {
+            cv.notify_all();
+            std::rethrow_exception(r.error);
+        }
+        out.write(r.text.data(), static_cast<std::streamsize>(r.text.size()));
+        stats.entries += r.stats.entries;
+        stats.matches += r.stats.matches;
+        stats.corrupt_regions += r.stats.corrupt_regions;
+        {
+            std::lock_guard lk{ m };
+            written = i + 1;
+        }
+        cv.notify_all();
+    }
+    return stats;
+}
+
+}
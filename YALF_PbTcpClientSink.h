@@ -0,0 +1,34 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "YALF_PbFileSink.h"
+#include "YALF_TcpClientSink.h"
+
+namespace YALF {
+
+// A TcpClientSink that sends length-delimited LogEntry messages, the same stream as a PbSchema::V1 file, instead of formatted strings.
+class ProtobufTcpClientSink : public TcpClientSink
+{
+public:
+    ProtobufTcpClientSink(TcpClientOptions options_)
+        : TcpClientSink(std::move(options_))
+    {}
+
+protected:
+    virtual void encodeEntry(std::string& out, EntryMetadata const& meta, std::string_view msg) override
+    {
+        auto const entry = encodeDto(meta, msg);
+        auto const size = entry.ByteSizeLong();
+        detail::appendVarint(out, size);
+        auto const offset = out.size();
+        out.resize(offset + size);
+        entry.SerializeWithCachedSizesToArray(reinterpret_cast<std::uint8_t*>(out.data() + offset));
+    }
+};
+inline
+std::unique_ptr<TcpClientSink> makePbTcpClientSink(TcpClientOptions options)
+{
+    return std::make_unique<ProtobufTcpClientSink>(std::move(options));
+}
+
+}
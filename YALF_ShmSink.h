@@ -0,0 +1,542 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "YALF.h"
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace YALF {
+
+inline constexpr std::uint64_t ShmRingMagic = 0x31474E4952464C59; // "YLFRING1"
+inline constexpr std::uint32_t ShmRingVersion = 3;
+// Capacities are below 4 GiB, so that the size of every record (at most a quarter of the ring) fits in its slot word, see detail::ShmSlot
+inline constexpr std::uint64_t ShmMaxCapacity = std::uint64_t{ 1 } << 31;
+
+namespace detail {
+
+// The start of the shared memory object; the ring's data follows it.
+// Positions only ever grow, the offset in the data is the position modulo the capacity.
+struct ShmRingHeader
+{
+    std::uint64_t magic; // Stored last by the creator
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t capacity; // A power of 2
+    std::int64_t tick_num; // LogEntryTimestampResolution of the creator
+    std::int64_t tick_den;
+    alignas(64) std::atomic<std::uint64_t> write_pos; // Reserved by producers
+    alignas(64) std::atomic<std::uint64_t> read_pos; // Released by the consumer, which frees what it has read
+    std::atomic<std::int64_t> heartbeat; // The consumer's last sign of life, in LogEntryTimestamp ticks
+    std::atomic<std::int32_t> consumer_pid;
+};
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "The ring is shared between processes, so its atomics must be lock-free");
+
+// Each record is 8-byte aligned and starts with a slot word, which a producer claims with a single compare-and-swap, so that the record's size and owner are known as soon as it exists:
+//   bits 0-25   the record's size in units of 8 bytes
+//   bit 26      pending: the producer has not finished writing the rest of the record
+//   bit 27      padding: the record is the unused end of the data before wrapping around
+//   bits 28-49  the producer's pid
+//   bits 50-63  the lap (the position divided by the capacity) that the record belongs to, modulo 2^14
+// Every word of free space holds free(lap) for the lap in which it can next be claimed, so a producer that loaded a write position which has since been passed cannot claim it.
+// Freshly created rings are zeroed, which is free(0).
+struct ShmSlot
+{
+    static constexpr std::uint64_t SizeMask = (std::uint64_t{ 1 } << 26) - 1;
+    static constexpr std::uint64_t Pending = std::uint64_t{ 1 } << 26;
+    static constexpr std::uint64_t Padding = std::uint64_t{ 1 } << 27;
+    static constexpr int PidShift = 28;
+    static constexpr std::uint64_t MaxPid = (std::uint64_t{ 1 } << 22) - 1;
+    static constexpr int LapShift = 50;
+    static constexpr std::uint64_t LapMask = (std::uint64_t{ 1 } << 14) - 1;
+
+    static std::uint64_t free(std::uint64_t lap) { return (lap & LapMask) << LapShift; }
+    static std::uint64_t claim(std::uint64_t lap, pid_t pid, std::size_t size, std::uint64_t flags) { return free(lap) | static_cast<std::uint64_t>(pid) << PidShift | flags | size / 8; }
+    // Whether `word` is a record claimed in `lap`, rather than free space
+    static bool isClaim(std::uint64_t word, std::uint64_t lap) { return (word >> LapShift) == (lap & LapMask) && word != free(lap); }
+    static std::size_t size(std::uint64_t word) { return static_cast<std::size_t>(word & SizeMask) * 8; }
+    static pid_t pid(std::uint64_t word) { return static_cast<pid_t>(word >> PidShift & MaxPid); }
+};
+struct ShmEntryHeader
+{
+    std::uint64_t slot;
+    std::uint8_t level;
+    std::uint8_t has_instance;
+    std::uint16_t field_count;
+    std::uint32_t line;
+    std::int64_t ticks;
+    std::uint64_t suppressed;
+    std::uint32_t column;
+    std::uint32_t domain_size;
+    std::uint32_t instance_size;
+    std::uint32_t file_size;
+    std::uint32_t function_size;
+    std::uint32_t message_size;
+};
+// Followed by field_count ShmFields, then the domain, instance, file, function and message, then each field's key and string value.
+struct ShmField
+{
+    std::uint8_t type; // The index in Field::value
+    std::uint8_t unused[3];
+    std::uint32_t key_size;
+    std::uint64_t value; // The string's size for strings, the value's bits otherwise
+};
+
+inline
+std::atomic_ref<std::uint64_t> shmSlot(char* record)
+{
+    return std::atomic_ref<std::uint64_t>{ *reinterpret_cast<std::uint64_t*>(record) };
+}
+
+// getpid() is a system call; this is updated in the child after a fork()
+inline
+pid_t shmProducerPid()
+{
+    static pid_t pid = [] {
+        ::pthread_atfork(nullptr, nullptr, [] { pid = ::getpid(); });
+        return ::getpid();
+    }();
+    return pid;
+}
+
+}
+
+// A multi-producer, single-consumer ring of entries in POSIX shared memory, see ShmSink and yalfd.
+class ShmRing
+{
+public:
+    // Opens the ring created by yalfd, throwing if it does not exist or is not compatible.
+    explicit ShmRing(std::string const& name)
+        : ShmRing(name, 0, 0)
+    {}
+
+    // Creates the ring, or reuses an existing compatible one so that what is left in it is not lost.
+    // A new shared memory object gets exactly `mode`, whatever the umask; every process that logs to the ring needs read and write access to it.
+    static std::unique_ptr<ShmRing> create(std::string const& name, std::uint64_t capacity, mode_t mode = 0600)
+    {
+        if (capacity < 4096 || capacity > ShmMaxCapacity || !std::has_single_bit(capacity))
+            throw std::invalid_argument("The ring's capacity must be a power of 2 from 4096 to 2 GiB");
+        return std::unique_ptr<ShmRing>(new ShmRing(name, capacity, mode));
+    }
+
+    ~ShmRing()
+    {
+        ::munmap(this->base, this->mapped_size);
+    }
+    ShmRing(ShmRing const&) = delete;
+    ShmRing& operator=(ShmRing const&) = delete;
+
+    detail::ShmRingHeader& header() const { return *reinterpret_cast<detail::ShmRingHeader*>(this->base); }
+    std::uint64_t capacity() const { return this->header().capacity; }
+    // Identifies the shared memory object, which yalfd replaces if it is restarted with a different capacity
+    ino_t identity() const { return this->inode; }
+
+    bool consumerAlive(LogEntryTimestamp now, LogEntryTimestampDuration timeout) const
+    {
+        return now.time_since_epoch().count() - this->header().heartbeat.load(std::memory_order_relaxed) <= timeout.count();
+    }
+
+    // Copies the entry into the ring; returns the size of the record, or 0 if there is no room.
+    std::size_t write(EntryMetadata const& meta, std::string_view msg)
+    {
+        std::string_view const file = meta.source_location.file_name();
+        std::string_view const function = meta.source_location.function_name();
+        std::string_view const instance = meta.instance.value_or(std::string_view{});
+        std::size_t size = sizeof(detail::ShmEntryHeader) + meta.fields.size() * sizeof(detail::ShmField) + meta.domain.size() + instance.size() + file.size() + function.size() + msg.size();
+        for (auto const& f : meta.fields)
+            size += f.key.size() + (std::holds_alternative<std::string_view>(f.value) ? std::get<std::string_view>(f.value).size() : 0);
+        size = (size + 7) & ~std::size_t{ 7 };
+        if (size > this->capacity() / 4 || meta.fields.size() > std::numeric_limits<std::uint16_t>::max())
+            return 0;
+
+        char* const record = this->reserve(size);
+        if (!record)
+            return 0;
+        detail::ShmEntryHeader const h{
+            .slot = 0,
+            .level = static_cast<std::uint8_t>(meta.level),
+            .has_instance = meta.instance.has_value(),
+            .field_count = static_cast<std::uint16_t>(meta.fields.size()),
+            .line = meta.source_location.line(),
+            .ticks = meta.timestamp.time_since_epoch().count(),
+            .suppressed = meta.suppressed,
+            .column = meta.source_location.column(),
+            .domain_size = static_cast<std::uint32_t>(meta.domain.size()),
+            .instance_size = static_cast<std::uint32_t>(instance.size()),
+            .file_size = static_cast<std::uint32_t>(file.size()),
+            .function_size = static_cast<std::uint32_t>(function.size()),
+            .message_size = static_cast<std::uint32_t>(msg.size()),
+        };
+        // The slot word was claimed by reserve(), and is only published once the rest has been written
+        constexpr std::size_t slot_bytes = sizeof(h.slot);
+        std::memcpy(record + slot_bytes, reinterpret_cast<char const*>(&h) + slot_bytes, sizeof(h) - slot_bytes);
+        char* p = record + sizeof(h);
+        for (auto const& f : meta.fields) {
+            detail::ShmField field{ .type = static_cast<std::uint8_t>(f.value.index()), .unused = {}, .key_size = static_cast<std::uint32_t>(f.key.size()), .value = 0 };
+            std::visit([&](auto const& v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, std::string_view>)
+                    field.value = v.size();
+                else if constexpr (std::is_same_v<T, bool>)
+                    field.value = v;
+                else
+                    std::memcpy(&field.value, &v, sizeof(v));
+            }, f.value);
+            std::memcpy(p, &field, sizeof(field));
+            p += sizeof(field);
+        }
+        auto const put = [&](std::string_view s) {
+            if (!s.empty())
+                std::memcpy(p, s.data(), s.size());
+            p += s.size();
+        };
+        put(meta.domain);
+        put(instance);
+        put(file);
+        put(function);
+        put(msg);
+        for (auto const& f : meta.fields) {
+            put(f.key);
+            if (auto const* s = std::get_if<std::string_view>(&f.value))
+                put(*s);
+        }
+        detail::shmSlot(record).fetch_and(~detail::ShmSlot::Pending, std::memory_order_release);
+        return size;
+    }
+
+    // Passes the oldest entry to `f(EntryMetadata const&, std::string_view msg)` and removes it from the ring.
+    // The entry's source location strings stay valid for as long as the ShmRing exists, so it can be passed to any Sink that the ShmRing outlives.
+    // Returns false if there is none, or the producer that claimed it has not finished writing it yet.
+    // Once a record has been pending for `publish_timeout`, read() checks whether its producer still exists, and skips the record (see skippedRecords()) if it does not; a producer that is alive, however slow, keeps its record.
+    // Producers must be in the same pid namespace as the consumer.
+    // Only one thread, in one process, may read.
+    template <class Func>
+    bool read(Func&& f, std::chrono::milliseconds publish_timeout = std::chrono::seconds{ 1 })
+    {
+        auto& h = this->header();
+        auto const pos = h.read_pos.load(std::memory_order_relaxed);
+        auto const lap = pos >> this->capacity_shift;
+        char* const record = this->data + (pos & (this->capacity() - 1));
+        auto const word = detail::shmSlot(record).load(std::memory_order_acquire);
+        if (!detail::ShmSlot::isClaim(word, lap))
+            return false;
+        auto const size = detail::ShmSlot::size(word);
+        // The producer advances write_pos past its record right after claiming it, unless it was killed in between
+        auto expected = pos;
+        h.write_pos.compare_exchange_strong(expected, pos + size, std::memory_order_acq_rel, std::memory_order_relaxed);
+        if (word & detail::ShmSlot::Pending) {
+            if (!this->stalledFor(pos, publish_timeout) || producerAlive(detail::ShmSlot::pid(word)))
+                return false;
+            this->skipped++;
+        }
+        else if (!(word & detail::ShmSlot::Padding)) {
+            this->decode(record, size, f);
+        }
+        // The space can next be claimed in the following lap
+        auto* const words = reinterpret_cast<std::uint64_t*>(record);
+        std::fill(words + 1, words + size / 8, detail::ShmSlot::free(lap + 1));
+        detail::shmSlot(record).store(detail::ShmSlot::free(lap + 1), std::memory_order_relaxed);
+        h.read_pos.store(pos + size, std::memory_order_release);
+        return true;
+    }
+
+    // Records that read() skipped because their producer died before finishing them
+    std::uint64_t skippedRecords() const { return this->skipped; }
+
+private:
+    ShmRing(std::string const& name, std::uint64_t create_capacity, mode_t mode)
+        : base(nullptr)
+        , mapped_size(0)
+        , data(nullptr)
+        , inode(0)
+        , fields()
+        , strings()
+        , stalled_pos(std::numeric_limits<std::uint64_t>::max())
+        , stalled_since()
+        , skipped(0)
+        , capacity_shift(0)
+    {
+        bool const creating = create_capacity != 0;
+        int fd = ::shm_open(name.c_str(), O_RDWR | (creating ? O_CREAT : 0) | O_CLOEXEC, mode);
+        if (fd < 0)
+            throw std::runtime_error(std::format("Failed to open shared memory {}: {}", name, std::strerror(errno)));
+        struct stat st;
+        ::fstat(fd, &st);
+        auto const existing = static_cast<std::size_t>(st.st_size);
+        auto const header_size = sizeof(detail::ShmRingHeader);
+        if (creating) {
+            if (!this->map(fd, existing, header_size) || this->header().capacity != create_capacity) {
+                if (this->base)
+                    ::munmap(this->base, this->mapped_size);
+                this->base = nullptr;
+                if (existing != 0) {
+                    // Not a compatible ring; replace the object rather than resizing it, as producers may still have it mapped
+                    ::close(fd);
+                    ::shm_unlink(name.c_str());
+                    fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+                    if (fd < 0)
+                        throw std::runtime_error(std::format("Failed to create shared memory {}: {}", name, std::strerror(errno)));
+                    ::fstat(fd, &st);
+                }
+                // The object is new (it is empty until it is sized), so it is ours; shm_open() applied the umask to its mode
+                if (::fchmod(fd, mode) != 0 || ::ftruncate(fd, static_cast<off_t>(header_size + create_capacity)) != 0 || !this->mapRaw(fd, header_size + create_capacity)) {
+                    ::close(fd);
+                    throw std::runtime_error(std::format("Failed to size shared memory {}: {}", name, std::strerror(errno)));
+                }
+                auto* const h = new (this->base) detail::ShmRingHeader{};
+                h->version = ShmRingVersion;
+                h->capacity = create_capacity;
+                h->tick_num = LogEntryTimestampResolution::num;
+                h->tick_den = LogEntryTimestampResolution::den;
+                std::atomic_ref<std::uint64_t>{ h->magic }.store(ShmRingMagic, std::memory_order_release);
+            }
+        }
+        else if (!this->map(fd, existing, header_size)) {
+            ::close(fd);
+            throw std::runtime_error(std::format("Shared memory {} is not a compatible YALF ring", name));
+        }
+        ::close(fd);
+        this->data = static_cast<char*>(this->base) + header_size;
+        this->capacity_shift = std::countr_zero(this->capacity());
+        this->inode = st.st_ino;
+    }
+
+    // Maps an existing ring, checking that it is complete and compatible.
+    bool map(int fd, std::size_t size, std::size_t header_size)
+    {
+        if (size < header_size || !this->mapRaw(fd, size))
+            return false;
+        auto& h = this->header();
+        bool const ok = std::atomic_ref<std::uint64_t>{ h.magic }.load(std::memory_order_acquire) == ShmRingMagic
+            && h.version == ShmRingVersion
+            && std::has_single_bit(h.capacity)
+            && h.capacity <= ShmMaxCapacity
+            && size == header_size + h.capacity
+            && h.tick_num == LogEntryTimestampResolution::num
+            && h.tick_den == LogEntryTimestampResolution::den;
+        if (!ok) {
+            ::munmap(this->base, this->mapped_size);
+            this->base = nullptr;
+        }
+        return ok;
+    }
+    bool mapRaw(int fd, std::size_t size)
+    {
+        void* const p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+            return false;
+        this->base = p;
+        this->mapped_size = size;
+        return true;
+    }
+
+    // Claims `size` contiguous bytes, first padding out the end of the data if the record would wrap around.
+    // Returns the record, whose slot word is claimed and pending, or nullptr if there is no room.
+    char* reserve(std::size_t size)
+    {
+        auto const pid = detail::shmProducerPid();
+        if (static_cast<std::uint64_t>(pid) > detail::ShmSlot::MaxPid)
+            return nullptr;
+        auto& h = this->header();
+        auto const capacity = this->capacity();
+        while (true) {
+            auto const pos = h.write_pos.load(std::memory_order_acquire);
+            auto const lap = pos >> this->capacity_shift;
+            auto const to_end = capacity - (pos & (capacity - 1));
+            auto const claimed = size <= to_end ? size : to_end;
+            if (pos + claimed - h.read_pos.load(std::memory_order_acquire) > capacity) {
+                if (h.write_pos.load(std::memory_order_acquire) != pos)
+                    continue; // Another producer claimed `pos` meanwhile, and the consumer already read it
+                return nullptr;
+            }
+            char* const record = this->data + (pos & (capacity - 1));
+            auto word = detail::shmSlot(record).load(std::memory_order_acquire);
+            if (word != detail::ShmSlot::free(lap)) {
+                // Another producer claimed it but has not advanced write_pos yet; any thread can, as the size is in the slot word
+                if (detail::ShmSlot::isClaim(word, lap)) {
+                    auto expected = pos;
+                    h.write_pos.compare_exchange_strong(expected, pos + detail::ShmSlot::size(word), std::memory_order_acq_rel, std::memory_order_relaxed);
+                }
+                continue;
+            }
+            auto const desired = size <= to_end ? detail::ShmSlot::claim(lap, pid, size, detail::ShmSlot::Pending) : detail::ShmSlot::claim(lap, pid, to_end, detail::ShmSlot::Padding);
+            if (!detail::shmSlot(record).compare_exchange_strong(word, desired, std::memory_order_acq_rel, std::memory_order_relaxed))
+                continue;
+            auto expected = pos;
+            h.write_pos.compare_exchange_strong(expected, pos + claimed, std::memory_order_acq_rel, std::memory_order_relaxed);
+            if (size <= to_end)
+                return record;
+        }
+    }
+
+    static bool producerAlive(pid_t pid)
+    {
+        return ::kill(pid, 0) == 0 || errno != ESRCH;
+    }
+
+    // Whether the record at `pos` has been waited for for at least `timeout`
+    bool stalledFor(std::uint64_t pos, std::chrono::milliseconds timeout)
+    {
+        auto const now = std::chrono::steady_clock::now();
+        if (pos != this->stalled_pos) {
+            this->stalled_pos = pos;
+            this->stalled_since = now;
+        }
+        return now - this->stalled_since >= timeout;
+    }
+
+    template <class Func>
+    void decode(char const* record, std::size_t size, Func& f)
+    {
+        detail::ShmEntryHeader h;
+        std::memcpy(&h, record, sizeof(h));
+        auto const fields_size = std::size_t{ h.field_count } * sizeof(detail::ShmField);
+        std::size_t const strings_size = std::size_t{ h.domain_size } + h.instance_size + h.file_size + h.function_size + h.message_size;
+        if (sizeof(h) + fields_size + strings_size > size || h.level > static_cast<std::uint8_t>(LogLevel::Noise))
+            return;
+        char const* p = record + sizeof(h) + fields_size;
+        char const* const end = record + size;
+        auto const take = [&](std::size_t n) {
+            std::string_view const s{ p, std::min<std::size_t>(n, static_cast<std::size_t>(end - p)) };
+            p += s.size();
+            return s;
+        };
+        auto const domain = take(h.domain_size);
+        auto const instance = take(h.instance_size);
+        auto const file = take(h.file_size);
+        auto const function = take(h.function_size);
+        auto const msg = take(h.message_size);
+        this->fields.clear();
+        for (std::size_t i = 0; i < h.field_count; i++) {
+            detail::ShmField sf;
+            std::memcpy(&sf, record + sizeof(h) + i * sizeof(sf), sizeof(sf));
+            auto& field = this->fields.emplace_back(Field{ take(sf.key_size), false });
+            switch (sf.type) {
+                case 0: field.value = std::bit_cast<std::int64_t>(sf.value); break;
+                case 1: field.value = sf.value; break;
+                case 2: field.value = std::bit_cast<double>(sf.value); break;
+                case 3: field.value = sf.value != 0; break;
+                default: field.value = take(static_cast<std::size_t>(sf.value)); break;
+            }
+        }
+        f(EntryMetadata{
+            .level = static_cast<LogLevel>(h.level),
+            .domain = domain,
+            .domain_id = InvalidDomainId,
+            .static_domain = false,
+            .instance = h.has_instance ? std::optional<std::string_view>{ instance } : std::nullopt,
+            .source_location = SourceLocation{ this->strings.intern(file), this->strings.intern(function), h.line, h.column },
+            .timestamp = LogEntryTimestamp{ LogEntryTimestampDuration{ h.ticks } },
+            .suppressed = h.suppressed,
+            .fields = this->fields,
+        }, msg);
+    }
+
+    void* base;
+    std::size_t mapped_size;
+    char* data;
+    ino_t inode;
+    // Only used by the consumer
+    std::vector<Field> fields; // Of the entry being read
+    StringTable strings; // Source file and function names, which sinks may keep referring to
+    std::uint64_t stalled_pos; // The unpublished record read() last waited for
+    std::chrono::steady_clock::time_point stalled_since;
+    std::uint64_t skipped;
+    int capacity_shift; // log2 of the capacity, to find a position's lap
+};
+
+struct ShmSinkOptions
+{
+    // The name of the shared memory object, as passed to yalfd --name
+    std::string name = "/yalf";
+    // yalfd is considered gone once its heartbeat is older than this
+    std::chrono::milliseconds heartbeat_timeout = std::chrono::seconds{ 2 };
+    // How often to try to attach to the ring while it does not exist
+    std::chrono::milliseconds retry_interval = std::chrono::seconds{ 1 };
+};
+
+// Hands entries to the yalfd daemon through a shared-memory ring, so that formatting and writing happen in another process.
+// A log call copies the entry into the ring and returns; it never waits for yalfd.
+// If the ring does not exist, yalfd's heartbeat stops, or the ring is full, entries go to the fallback sink instead (or are dropped if there is none).
+class ShmSink : public Sink
+{
+public:
+    ShmSink(ShmSinkOptions options_ = {}, std::unique_ptr<Sink> fallback_ = nullptr)
+        : Sink()
+        , options(std::move(options_))
+        , fallback(std::move(fallback_))
+        , ring(nullptr)
+        , rings()
+        , attach_mutex()
+        , next_attach(0)
+    {
+        this->tryAttach(std::chrono::time_point_cast<LogEntryTimestampDuration>(LogEntryTimestampClock::now()));
+    }
+
+    virtual void log(EntryMetadata const& meta, std::string_view msg) override
+    {
+        auto const timeout = std::chrono::duration_cast<LogEntryTimestampDuration>(this->options.heartbeat_timeout);
+        auto* ring_ = this->ring.load(std::memory_order_acquire);
+        if (!ring_ || !ring_->consumerAlive(meta.timestamp, timeout))
+            ring_ = this->tryAttach(meta.timestamp);
+        if (ring_ && ring_->consumerAlive(meta.timestamp, timeout)) {
+            if (auto const size = ring_->write(meta, msg)) {
+                this->countBytesWritten(size);
+                return;
+            }
+        }
+        // The fallback's own filter is not consulted, as with DeferredSink
+        if (this->fallback)
+            this->fallback->log(meta, msg);
+        else
+            this->countDropped();
+    }
+    virtual void flush() override
+    {
+        if (this->fallback)
+            this->fallback->flush();
+    }
+
+private:
+    ShmRing* tryAttach(LogEntryTimestamp now)
+    {
+        auto const ticks = now.time_since_epoch().count();
+        auto next = this->next_attach.load(std::memory_order_relaxed);
+        if (ticks < next || !this->next_attach.compare_exchange_strong(next, ticks + std::chrono::duration_cast<LogEntryTimestampDuration>(this->options.retry_interval).count()))
+            return nullptr;
+        std::lock_guard lg{ this->attach_mutex };
+        try {
+            auto ring_ = std::make_unique<ShmRing>(this->options.name);
+            if (this->rings.empty() || this->rings.back()->identity() != ring_->identity()) {
+                // Rings that were replaced stay mapped, as other threads may still be writing to them
+                this->rings.push_back(std::move(ring_));
+                this->ring.store(this->rings.back().get(), std::memory_order_release);
+            }
+        }
+        catch (std::exception const&) {
+            // yalfd has not created it yet
+        }
+        return this->rings.empty() ? nullptr : this->rings.back().get();
+    }
+
+private:
+    ShmSinkOptions const options;
+    std::unique_ptr<Sink> fallback;
+    std::atomic<ShmRing*> ring; // The newest of rings, once attached
+    std::vector<std::unique_ptr<ShmRing>> rings; // attach_mutex
+    std::mutex attach_mutex;
+    std::atomic<LogEntryTimestampClock::rep> next_attach;
+};
+inline
+std::unique_ptr<Sink> makeShmSink(ShmSinkOptions options = {}, std::unique_ptr<Sink> fallback = nullptr)
+{
+    return std::make_unique<ShmSink>(std::move(options), std::move(fallback));
+}
+
+}
@@ -0,0 +1,247 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "YALF.h"
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace YALF {
+
+struct SyslogOptions
+{
+    // Sends to this host over UDP if set, otherwise to the local syslog daemon's socket
+    std::string host = {};
+    std::uint16_t port = 514;
+    std::filesystem::path socket_path = "/dev/log";
+
+    int facility = 1; // LOG_USER
+    std::string app_name = {}; // The program's name if empty
+    std::string hostname = {}; // gethostname() if empty
+    // Messages are truncated to this many bytes
+    std::size_t max_message_size = 8192;
+    // Entries are sent in batches of this many with sendmmsg(); batches are also sent by flush().
+    // Only use more than 1 behind a DeferredSink, which flushes each time it has drained its queue.
+    std::size_t batch_size = 1;
+};
+
+// Sends RFC 5424 messages to a syslog daemon over a Unix datagram socket or UDP, without going through syslog(3):
+// <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID DOMAIN [yalf@32473 instance="..." file="..." line="..." suppressed="..." KEY="..."] MESSAGE
+// The domain is the MSGID, and the structured data has the source location and structured fields.
+class SyslogSink : public Sink
+{
+public:
+    SyslogSink(SyslogOptions options_ = {})
+        : Sink()
+        , options(std::move(options_))
+        , address{}
+        , address_size(0)
+        , fd(-1)
+        , level_headers{}
+        , common_header()
+        , mtx()
+        , batch()
+        , batch_used(0)
+    {
+        if (this->options.batch_size == 0)
+            throw std::invalid_argument("SyslogOptions::batch_size must be at least 1");
+        this->openSocket();
+        this->buildHeaders();
+        this->batch.resize(this->options.batch_size);
+    }
+    ~SyslogSink()
+    {
+        this->flush();
+        ::close(this->fd);
+    }
+    SyslogSink(SyslogSink const&) = delete;
+    SyslogSink& operator=(SyslogSink const&) = delete;
+
+    virtual void log(EntryMetadata const& meta, std::string_view msg) override
+    {
+        if (this->options.batch_size == 1) {
+            // Datagrams are sent atomically, so there is nothing to lock
+            thread_local std::string datagram;
+            datagram.clear();
+            this->formatMessage(datagram, meta, msg);
+            this->send(std::span<std::string const>{ &datagram, 1 });
+            return;
+        }
+        auto const lg = this->lockTimed(this->mtx);
+        auto& datagram = this->batch[this->batch_used++];
+        datagram.clear();
+        this->formatMessage(datagram, meta, msg);
+        if (this->batch_used == this->batch.size())
+            this->sendBatch();
+    }
+
+    virtual void flush() override
+    {
+        std::lock_guard lg{ this->mtx };
+        this->sendBatch();
+    }
+
+private:
+    void openSocket()
+    {
+        if (this->options.host.empty()) {
+            auto const path = this->options.socket_path.native();
+            if (path.size() >= sizeof(sockaddr_un::sun_path))
+                throw std::invalid_argument(std::format("Syslog socket path {} is too long", path));
+            sockaddr_un un{};
+            un.sun_family = AF_UNIX;
+            std::memcpy(un.sun_path, path.c_str(), path.size() + 1);
+            std::memcpy(&this->address, &un, sizeof(un));
+            this->address_size = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+            this->fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        }
+        else {
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_DGRAM;
+            addrinfo* result = nullptr;
+            auto const port = std::to_string(this->options.port);
+            if (int const rc = ::getaddrinfo(this->options.host.c_str(), port.c_str(), &hints, &result); rc != 0)
+                throw std::runtime_error(std::format("Failed to resolve syslog host {}: {}", this->options.host, ::gai_strerror(rc)));
+            std::memcpy(&this->address, result->ai_addr, result->ai_addrlen);
+            this->address_size = result->ai_addrlen;
+            this->fd = ::socket(result->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            ::freeaddrinfo(result);
+        }
+        if (this->fd < 0)
+            throw std::runtime_error(std::format("Failed to create syslog socket: {}", std::strerror(errno)));
+    }
+
+    // Everything up to the timestamp depends only on the level, and everything between the timestamp and the MSGID is the same for every entry.
+    void buildHeaders()
+    {
+        if (this->options.hostname.empty()) {
+            std::array<char, 256> name{};
+            if (::gethostname(name.data(), name.size() - 1) == 0)
+                this->options.hostname = name.data();
+        }
+        if (this->options.app_name.empty()) {
+            #ifdef __GLIBC__
+            this->options.app_name = program_invocation_short_name;
+            #endif
+        }
+        for (auto const level : getLogLevelList())
+            this->level_headers[static_cast<std::size_t>(level)] = std::format("<{}>1 ", this->options.facility * 8 + getSyslogSeverity(level));
+        this->common_header = " ";
+        appendHeaderField(this->common_header, this->options.hostname, 255);
+        this->common_header += ' ';
+        appendHeaderField(this->common_header, this->options.app_name, 48);
+        std::format_to(std::back_inserter(this->common_header), " {} ", ::getpid());
+    }
+
+    // Header fields are printable US-ASCII without spaces, limited in length, and "-" if empty.
+    static void appendHeaderField(std::string& out, std::string_view s, std::size_t max_size)
+    {
+        if (s.empty())
+            out += '-';
+        for (char c : s.substr(0, max_size))
+            out += (c <= ' ' || c > '~') ? '_' : c;
+    }
+
+    void formatMessage(std::string& out, EntryMetadata const& meta, std::string_view msg) const
+    {
+        auto out_it = std::back_inserter(out);
+        out += this->level_headers[static_cast<std::size_t>(meta.level)];
+        std::format_to(out_it, "{:%FT%T}Z", std::chrono::time_point_cast<std::chrono::microseconds>(toSystemTime(meta.timestamp)));
+        out += this->common_header;
+        appendHeaderField(out, meta.domain, 32);
+        out += " [yalf@32473";
+        if (meta.instance)
+            appendParam(out, "instance", *meta.instance);
+        appendParam(out, "file", meta.source_location.file_name());
+        std::format_to(out_it, " line=\"{}\"", meta.source_location.line());
+        if (meta.suppressed != 0)
+            std::format_to(out_it, " suppressed=\"{}\"", meta.suppressed);
+        for (auto const& f : meta.fields) {
+            std::visit([&](auto const& v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, std::string_view>)
+                    appendParam(out, f.key, v);
+                else
+                    appendParam(out, f.key, std::format("{}", v));
+            }, f.value);
+        }
+        out += "] ";
+        out += msg;
+        if (out.size() > this->options.max_message_size)
+            out.resize(this->options.max_message_size);
+    }
+
+    // PARAM-NAMEs are 1 to 32 printable characters other than '=', ' ', ']' and '"' (an empty name becomes "_"); values escape '"', '\' and ']'.
+    static void appendParam(std::string& out, std::string_view name, std::string_view value)
+    {
+        out += ' ';
+        if (name.empty())
+            name = "_";
+        for (char c : name.substr(0, 32))
+            out += (c <= ' ' || c > '~' || c == '=' || c == ']' || c == '"') ? '_' : c;
+        out += "=\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\' || c == ']')
+                out += '\\';
+            out += c;
+        }
+        out += '"';
+    }
+
+    void sendBatch()
+    {
+        this->send(std::span{ this->batch }.first(this->batch_used));
+        this->batch_used = 0;
+    }
+
+    void send(std::span<std::string const> datagrams)
+    {
+        constexpr std::size_t MaxPerCall = 64;
+        std::array<iovec, MaxPerCall> iov;
+        std::array<mmsghdr, MaxPerCall> msgs;
+        while (!datagrams.empty()) {
+            auto const n = std::min(datagrams.size(), MaxPerCall);
+            for (std::size_t i = 0; i < n; i++) {
+                iov[i] = iovec{ const_cast<char*>(datagrams[i].data()), datagrams[i].size() };
+                msgs[i] = mmsghdr{};
+                msgs[i].msg_hdr.msg_name = &this->address;
+                msgs[i].msg_hdr.msg_namelen = this->address_size;
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int const sent = ::sendmmsg(this->fd, msgs.data(), static_cast<unsigned>(n), MSG_NOSIGNAL);
+            // On an error, drop the datagram that failed and carry on with the rest
+            auto const done = sent > 0 ? static_cast<std::size_t>(sent) : 1;
+            for (std::size_t i = 0; i < done; i++) {
+                if (sent > 0)
+                    this->countBytesWritten(datagrams[i].size());
+                else
+                    this->countDropped();
+            }
+            datagrams = datagrams.subspan(done);
+        }
+    }
+
+private:
+    SyslogOptions options;
+    sockaddr_storage address;
+    socklen_t address_size;
+    int fd;
+    std::array<std::string, 8> level_headers; // "<PRI>1 ", by level
+    std::string common_header; // " HOSTNAME APP-NAME PROCID "
+    std::mutex mtx; // batch, batch_used
+    std::vector<std::string> batch;
+    std::size_t batch_used;
+};
+inline
+std::unique_ptr<Sink> makeSyslogSink(SyslogOptions options = {})
+{
+    return std::make_unique<SyslogSink>(std::move(options));
+}
+
+}
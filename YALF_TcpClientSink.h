@@ -0,0 +1,518 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "YALF.h"
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace YALF {
+
+struct TcpClientOptions
+{
+    std::string host = "127.0.0.1";
+    std::uint16_t port = 0;
+    // Entries waiting to be sent are held in memory up to this many bytes; beyond that they are spilled (if enabled) or dropped.
+    std::size_t max_buffer_bytes = 8 << 20;
+    // If set, while the peer is unreachable entries are appended to this file once half of max_buffer_bytes is used, and replayed once it is back.
+    // A spill file left by a previous run is replayed too, up to the last complete entry.
+    std::filesystem::path spill_path = {};
+    std::uint64_t max_spill_bytes = std::uint64_t{ 256 } << 20;
+    // Reconnect attempts back off exponentially between these
+    std::chrono::milliseconds min_backoff = std::chrono::milliseconds{ 100 };
+    std::chrono::milliseconds max_backoff = std::chrono::seconds{ 30 };
+    std::chrono::milliseconds connect_timeout = std::chrono::seconds{ 5 };
+    // How long the sink tries to send what is left when it is destroyed
+    std::chrono::milliseconds linger = std::chrono::seconds{ 1 };
+};
+
+namespace detail {
+
+// Entries laid out back to back, with the offset at which each one ends.
+struct TcpEntryBuffer
+{
+    std::string bytes;
+    std::vector<std::size_t> ends;
+
+    bool empty() const { return this->bytes.empty(); }
+    void clear()
+    {
+        this->bytes.clear();
+        this->ends.clear();
+    }
+    void append(std::string_view entry)
+    {
+        this->bytes += entry;
+        this->ends.push_back(this->bytes.size());
+    }
+    void append(TcpEntryBuffer const& other)
+    {
+        auto const base = this->bytes.size();
+        this->bytes += other.bytes;
+        for (auto const end : other.ends)
+            this->ends.push_back(base + end);
+    }
+    // Removes the entries that lie entirely within the first `n` bytes, returning how many bytes were removed.
+    std::size_t consume(std::size_t n)
+    {
+        auto const complete = std::ranges::upper_bound(this->ends, n) - this->ends.begin();
+        if (complete == 0)
+            return 0;
+        auto const removed = this->ends[static_cast<std::size_t>(complete - 1)];
+        this->bytes.erase(0, removed);
+        this->ends.erase(this->ends.begin(), this->ends.begin() + complete);
+        for (auto& end : this->ends)
+            end -= removed;
+        return removed;
+    }
+};
+
+// The spill file is a sequence of records, each an entry framed by its size before and after it (32 bits, in native byte order).
+// A record whose sizes disagree or that runs past the end of the file was torn by a crash; it and everything after it are discarded.
+inline constexpr std::size_t SpillRecordOverhead = 2 * sizeof(std::uint32_t);
+
+inline
+void appendSpillRecord(std::string& out, std::string_view entry)
+{
+    auto const size = static_cast<std::uint32_t>(entry.size());
+    out.append(reinterpret_cast<char const*>(&size), sizeof(size));
+    out += entry;
+    out.append(reinterpret_cast<char const*>(&size), sizeof(size));
+}
+
+inline
+std::uint32_t loadSpillSize(char const* p)
+{
+    std::uint32_t size;
+    std::memcpy(&size, p, sizeof(size));
+    return size;
+}
+
+// The size of the record at the start of `data`, or 0 if `data` does not start with a complete record.
+inline
+std::size_t spillRecordSize(std::string_view data)
+{
+    if (data.size() < SpillRecordOverhead)
+        return 0;
+    std::size_t const size = loadSpillSize(data.data());
+    if (data.size() - SpillRecordOverhead < size || loadSpillSize(data.data() + sizeof(std::uint32_t) + size) != size)
+        return 0;
+    return size + SpillRecordOverhead;
+}
+
+}
+
+// Streams entries to a remote collector over TCP.
+// Log calls only append the encoded entry to a buffer; a background thread connects, reconnects with exponential backoff, and sends whatever has accumulated with one gathering write.
+// While the peer is unreachable or slow, entries are held in a bounded buffer and optionally spilled to disk; entries that fit nowhere are dropped, so a dead collector never blocks the application.
+// An entry that was partly sent when a connection failed is sent again in full on the next one, but entries the kernel had already accepted for a failed connection are lost, as there are no acknowledgements.
+class TcpClientSink : public FormattedStringSink
+{
+public:
+    TcpClientSink(TcpClientOptions options_)
+        : FormattedStringSink()
+        , options(std::move(options_))
+        , mtx()
+        , cv()
+        , pending()
+        , buffered_bytes(0)
+        , stop_requested(false)
+        , backlog()
+        , backlog_sent(0)
+        , fd(-1)
+        , wake{ -1, -1 }
+        , backoff(this->options.min_backoff)
+        , next_attempt()
+        , spill_fd(-1)
+        , spill_size(0)
+        , spill_sent(0)
+        , spill_entry_sent(0)
+        , spill_chunk()
+        , spill_records()
+        , worker()
+    {
+        if (::pipe2(this->wake, O_CLOEXEC | O_NONBLOCK) != 0)
+            throw std::runtime_error(std::format("Failed to create pipe: {}", std::strerror(errno)));
+        if (!this->options.spill_path.empty()) {
+            this->spill_fd = ::open(this->options.spill_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (this->spill_fd < 0)
+                throw std::runtime_error(std::format("Failed to open {}: {}", this->options.spill_path.string(), std::strerror(errno)));
+            auto const file_size = ::lseek(this->spill_fd, 0, SEEK_END);
+            if (file_size < 0)
+                throw std::runtime_error(std::format("Failed to read {}: {}", this->options.spill_path.string(), std::strerror(errno)));
+            // A previous run may have been killed part way through spilling
+            this->spill_size = this->completeSpillRecords(static_cast<std::uint64_t>(file_size));
+            if (this->spill_size != static_cast<std::uint64_t>(file_size))
+                [[maybe_unused]] auto const rc = ::ftruncate(this->spill_fd, static_cast<off_t>(this->spill_size));
+        }
+        this->worker = std::thread(&TcpClientSink::doBackgroundWork, this);
+    }
+    ~TcpClientSink()
+    {
+        {
+            std::lock_guard lg{ this->mtx };
+            this->stop_requested = true;
+        }
+        this->cv.notify_one();
+        char const c = 0;
+        [[maybe_unused]] auto const rc = ::write(this->wake[1], &c, 1);
+        this->worker.join();
+        this->disconnect();
+        if (this->spill_fd >= 0)
+            ::close(this->spill_fd);
+        ::close(this->wake[0]);
+        ::close(this->wake[1]);
+    }
+    TcpClientSink(TcpClientSink const&) = delete;
+    TcpClientSink& operator=(TcpClientSink const&) = delete;
+
+    virtual void log(EntryMetadata const& meta, std::string_view msg) override
+    {
+        thread_local std::string entry;
+        entry.clear();
+        this->encodeEntry(entry, meta, msg);
+        {
+            auto const lg = this->lockTimed(this->mtx);
+            if (this->buffered_bytes + entry.size() > this->options.max_buffer_bytes) {
+                this->countDropped();
+                return;
+            }
+            this->pending.append(entry);
+            this->buffered_bytes += entry.size();
+        }
+        this->cv.notify_one();
+    }
+
+protected:
+    // Appends the entry as it is sent to the collector: the formatted string by default.
+    virtual void encodeEntry(std::string& out, EntryMetadata const& meta, std::string_view msg)
+    {
+        out += this->formatEntry(meta, msg);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void doBackgroundWork()
+    {
+        detail::TcpEntryBuffer incoming;
+        bool stopping = false;
+        while (!stopping) {
+            {
+                std::unique_lock lg{ this->mtx };
+                // Retry a slow peer soon, otherwise wait for entries or the next connection attempt
+                auto const deadline = this->fd < 0 ? this->next_attempt : Clock::now() + (this->backlog.empty() && this->spill_size == 0 ? std::chrono::milliseconds{ 1000 } : std::chrono::milliseconds{ 10 });
+                this->cv.wait_until(lg, deadline, [&] { return this->stop_requested || !this->pending.empty(); });
+                stopping = this->stop_requested;
+                std::swap(incoming, this->pending);
+            }
+            if (this->fd < 0 && (stopping || Clock::now() >= this->next_attempt))
+                this->connect(stopping);
+            std::size_t released = 0;
+            if (this->fd >= 0 && this->replaySpill(stopping))
+                released += this->sendBacklog(incoming, stopping);
+            if (!incoming.empty()) {
+                if (this->backlog.empty())
+                    std::swap(this->backlog, incoming);
+                else
+                    this->backlog.append(incoming);
+                incoming.clear();
+            }
+            if (this->spill_fd >= 0 && (stopping || (this->fd < 0 && this->bufferedBytes() > this->options.max_buffer_bytes / 2)))
+                released += this->spillBacklog();
+            if (stopping) {
+                for (std::size_t i = 0; i < this->backlog.ends.size(); i++)
+                    this->countDropped();
+            }
+            if (released != 0) {
+                std::lock_guard lg{ this->mtx };
+                this->buffered_bytes -= released;
+            }
+        }
+    }
+
+    std::size_t bufferedBytes()
+    {
+        std::lock_guard lg{ this->mtx };
+        return this->buffered_bytes;
+    }
+
+    void connect(bool stopping)
+    {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* result = nullptr;
+        auto const port = std::to_string(this->options.port);
+        if (::getaddrinfo(this->options.host.c_str(), port.c_str(), &hints, &result) == 0) {
+            for (auto const* ai = result; ai && this->fd < 0; ai = ai->ai_next) {
+                this->fd = ::socket(ai->ai_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+                if (this->fd < 0)
+                    continue;
+                bool connected = ::connect(this->fd, ai->ai_addr, ai->ai_addrlen) == 0;
+                if (!connected && errno == EINPROGRESS && this->waitWritable(stopping ? this->options.linger : this->options.connect_timeout, stopping)) {
+                    int error = 0;
+                    socklen_t len = sizeof(error);
+                    connected = ::getsockopt(this->fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0;
+                }
+                if (!connected)
+                    this->disconnect();
+            }
+            ::freeaddrinfo(result);
+        }
+        if (this->fd >= 0) {
+            // Entries are already batched
+            int const one = 1;
+            ::setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            this->backoff = this->options.min_backoff;
+        }
+        else {
+            this->next_attempt = Clock::now() + this->backoff;
+            this->backoff = std::min(this->backoff * 2, this->options.max_backoff);
+        }
+    }
+
+    void disconnect()
+    {
+        if (this->fd >= 0)
+            ::close(this->fd);
+        this->fd = -1;
+        this->next_attempt = Clock::now() + this->backoff;
+        // Whatever entry was partly sent is sent again in full on the next connection
+        this->backlog_sent = 0;
+        this->spill_entry_sent = 0;
+    }
+
+    // Waits for the socket to become writable, or until the sink is destroyed (unless it is already stopping).
+    bool waitWritable(std::chrono::milliseconds timeout, bool stopping)
+    {
+        std::array<pollfd, 2> fds{ pollfd{ this->fd, POLLOUT, 0 }, pollfd{ this->wake[0], POLLIN, 0 } };
+        int const rc = ::poll(fds.data(), stopping ? 1 : 2, static_cast<int>(timeout.count()));
+        return rc > 0 && (fds[0].revents & POLLOUT) && !(fds[0].revents & (POLLERR | POLLHUP));
+    }
+
+    // Writes as much as it can; returns the number of bytes written, 0 if the socket is not writable within the timeout, or -1 and disconnects on an error.
+    ssize_t write(std::span<iovec const> iov, bool stopping)
+    {
+        while (true) {
+            msghdr mh{};
+            mh.msg_iov = const_cast<iovec*>(iov.data());
+            mh.msg_iovlen = iov.size();
+            auto const n = ::sendmsg(this->fd, &mh, MSG_NOSIGNAL);
+            if (n >= 0) {
+                this->countBytesWritten(static_cast<std::size_t>(n));
+                return n;
+            }
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (this->waitWritable(stopping ? this->options.linger : std::chrono::milliseconds{ 100 }, stopping))
+                    continue;
+                return 0;
+            }
+            this->disconnect();
+            return -1;
+        }
+    }
+
+    // Sends the backlog and then `incoming` with one gathering write per round; whatever could not be sent is left in the backlog.
+    // Returns the number of bytes of complete entries sent.
+    std::size_t sendBacklog(detail::TcpEntryBuffer& incoming, bool stopping)
+    {
+        std::size_t released = 0;
+        while (this->fd >= 0 && (this->backlog_sent < this->backlog.bytes.size() || !incoming.empty())) {
+            std::array<iovec, 2> const iov{
+                iovec{ this->backlog.bytes.data() + this->backlog_sent, this->backlog.bytes.size() - this->backlog_sent },
+                iovec{ incoming.bytes.data(), incoming.bytes.size() },
+            };
+            auto n = this->write(iov, stopping);
+            if (n <= 0)
+                break;
+            auto const from_backlog = std::min(static_cast<std::size_t>(n), iov[0].iov_len);
+            this->backlog_sent += from_backlog;
+            if (this->backlog_sent == this->backlog.bytes.size()) {
+                released += this->backlog.bytes.size();
+                this->backlog.clear();
+                std::swap(this->backlog, incoming);
+                this->backlog_sent = static_cast<std::size_t>(n) - from_backlog;
+            }
+            auto const removed = this->backlog.consume(this->backlog_sent);
+            this->backlog_sent -= removed;
+            released += removed;
+        }
+        return released;
+    }
+
+    // Sends the spill file before anything newer, resuming after the last record sent in full; returns whether it is empty now.
+    bool replaySpill(bool stopping)
+    {
+        constexpr std::size_t MaxRecordsPerWrite = 64;
+        std::array<iovec, MaxRecordsPerWrite> iov;
+        std::array<std::size_t, MaxRecordsPerWrite> record_sizes;
+        while (this->fd >= 0 && this->spill_sent < this->spill_size) {
+            // Read whole records; one larger than the chunk is read on its own
+            std::uint32_t first_size = 0;
+            std::size_t count = 0;
+            if (this->readSpill(&first_size, sizeof(first_size), this->spill_sent)) {
+                auto const want = static_cast<std::size_t>(std::min<std::uint64_t>(this->spill_size - this->spill_sent, std::max<std::uint64_t>(64 * 1024, first_size + detail::SpillRecordOverhead)));
+                this->spill_chunk.resize(want);
+                if (!this->readSpill(this->spill_chunk.data(), want, this->spill_sent))
+                    this->spill_chunk.clear();
+                for (std::size_t offset = 0; count < MaxRecordsPerWrite; ) {
+                    auto const size = detail::spillRecordSize(std::string_view{ this->spill_chunk }.substr(offset));
+                    if (size == 0)
+                        break;
+                    auto const skip = count == 0 ? this->spill_entry_sent : 0;
+                    iov[count] = iovec{ this->spill_chunk.data() + offset + sizeof(std::uint32_t) + skip, size - detail::SpillRecordOverhead - skip };
+                    record_sizes[count++] = size;
+                    offset += size;
+                }
+            }
+            if (count == 0) {
+                // Unreadable, or changed behind the sink's back; the rest of it is lost
+                this->spill_size = this->spill_sent;
+                break;
+            }
+            std::size_t total = 0;
+            for (std::size_t i = 0; i < count; i++)
+                total += iov[i].iov_len;
+            auto const n = total == 0 ? 0 : this->write({ iov.data(), count }, stopping);
+            if (n < 0 || (n == 0 && total != 0))
+                return false;
+            // Records sent in full are done; a partly sent one is resumed, or sent again in full after a reconnection
+            auto left = static_cast<std::size_t>(n);
+            for (std::size_t i = 0; i < count; i++) {
+                if (left < iov[i].iov_len) {
+                    this->spill_entry_sent += left;
+                    break;
+                }
+                left -= iov[i].iov_len;
+                this->spill_sent += record_sizes[i];
+                this->spill_entry_sent = 0;
+            }
+        }
+        if (this->fd < 0 || this->spill_sent < this->spill_size)
+            return false;
+        if (this->spill_size != 0) {
+            [[maybe_unused]] auto const rc = ::ftruncate(this->spill_fd, 0);
+            this->spill_size = 0;
+            this->spill_sent = 0;
+            this->spill_entry_sent = 0;
+        }
+        return true;
+    }
+
+    // Moves the backlog to the end of the spill file, dropping the entries that do not fit.
+    // Returns the number of bytes moved or dropped.
+    std::size_t spillBacklog()
+    {
+        if (this->backlog.empty())
+            return 0;
+        auto room = this->options.max_spill_bytes - std::min(this->spill_size, this->options.max_spill_bytes);
+        this->spill_records.clear();
+        std::size_t start = 0;
+        for (auto const end : this->backlog.ends) {
+            auto const entry = std::string_view{ this->backlog.bytes }.substr(start, end - start);
+            if (entry.size() > std::numeric_limits<std::uint32_t>::max() || entry.size() + detail::SpillRecordOverhead > room)
+                break;
+            detail::appendSpillRecord(this->spill_records, entry);
+            room -= entry.size() + detail::SpillRecordOverhead;
+            start = end;
+        }
+        std::size_t written = 0;
+        while (written < this->spill_records.size()) {
+            auto const n = ::pwrite(this->spill_fd, this->spill_records.data() + written, this->spill_records.size() - written, static_cast<off_t>(this->spill_size + written));
+            if (n <= 0)
+                break;
+            written += static_cast<std::size_t>(n);
+        }
+        // Keep only whole records
+        std::size_t kept = 0;
+        std::size_t kept_size = 0;
+        while (auto const size = detail::spillRecordSize(std::string_view{ this->spill_records.data() + kept_size, written - kept_size })) {
+            kept_size += size;
+            kept++;
+        }
+        this->spill_size += kept_size;
+        for (std::size_t i = kept; i < this->backlog.ends.size(); i++)
+            this->countDropped();
+        auto const released = this->backlog.bytes.size();
+        this->backlog.clear();
+        this->backlog_sent = 0;
+        return released;
+    }
+
+    bool readSpill(void* data, std::size_t size, std::uint64_t offset)
+    {
+        for (std::size_t done = 0; done < size; ) {
+            auto const n = ::pread(this->spill_fd, static_cast<char*>(data) + done, size - done, static_cast<off_t>(offset + done));
+            if (n <= 0)
+                return false;
+            done += static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    // The size of the longest prefix of the spill file that consists of complete records.
+    std::uint64_t completeSpillRecords(std::uint64_t file_size)
+    {
+        std::uint64_t complete = 0;
+        while (complete < file_size) {
+            // Many records per read; one larger than the chunk is read on its own
+            std::uint32_t first_size = 0;
+            if (!this->readSpill(&first_size, sizeof(first_size), complete))
+                break;
+            auto const want = static_cast<std::size_t>(std::min<std::uint64_t>(file_size - complete, std::max<std::uint64_t>(1 << 20, first_size + detail::SpillRecordOverhead)));
+            this->spill_chunk.resize(want);
+            if (!this->readSpill(this->spill_chunk.data(), want, complete))
+                break;
+            std::size_t offset = 0;
+            while (auto const size = detail::spillRecordSize(std::string_view{ this->spill_chunk }.substr(offset)))
+                offset += size;
+            if (offset == 0)
+                break;
+            complete += offset;
+        }
+        return complete;
+    }
+
+private:
+    TcpClientOptions const options;
+    std::mutex mtx; // cv, pending, buffered_bytes, stop_requested
+    std::condition_variable cv;
+    detail::TcpEntryBuffer pending;
+    std::size_t buffered_bytes; // pending and everything the worker has not sent or spilled yet
+    bool stop_requested;
+
+    // Only used by the worker
+    detail::TcpEntryBuffer backlog;
+    std::size_t backlog_sent; // Bytes of the first entry of the backlog that have been sent
+    int fd;
+    int wake[2]; // Written to when stopping, to interrupt poll()
+    std::chrono::milliseconds backoff;
+    Clock::time_point next_attempt;
+    int spill_fd;
+    std::uint64_t spill_size;
+    std::uint64_t spill_sent; // Offset of the first record not sent in full
+    std::size_t spill_entry_sent; // Bytes of that record's entry that have been sent
+    std::string spill_chunk; // Records read from the spill file
+    std::string spill_records; // Records being written to the spill file
+    std::thread worker;
+};
+inline
+std::unique_ptr<TcpClientSink> makeTcpClientSink(TcpClientOptions options)
+{
+    return std::make_unique<TcpClientSink>(std::move(options));
+}
+
+}
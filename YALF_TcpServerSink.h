@@ -0,0 +1,417 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "YALF.h"
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef __linux__
+#error "YALF_TcpServerSink.h requires Linux"
+#endif
+
+namespace YALF {
+
+struct TcpServerOptions
+{
+    std::string bind_address = "127.0.0.1";
+    std::uint16_t port = 0; // 0 picks a free port, see TcpServerSink::getPort()
+    // Each client's buffer; entries that do not fit are dropped for that client
+    std::size_t client_buffer_bytes = 1 << 20;
+    std::size_t max_clients = 64;
+};
+
+// Serves a live tail of the formatted entries to any number of TCP clients (eg. `nc 127.0.0.1 <port>`).
+// Each client has its own bounded buffer, which a single epoll-driven thread writes out; a client that does not keep up loses entries (and is told how many) rather than slowing down the application.
+// A client can send lines of filter rules, eg. `Warning Net.*=Debug`: a bare level sets its default level and `domain=Level` sets a domain's level, as with Filter.
+// A client gets every entry until it sends rules, as the sink's own filter defaults to Noise; lowering the sink's own levels limits every client.
+// Entries that no client accepts are filtered out before their message is formatted.
+class TcpServerSink : public FormattedStringSink
+{
+public:
+    TcpServerSink(TcpServerOptions options_ = {})
+        : FormattedStringSink()
+        , options(std::move(options_))
+        , clients(new ClientList const{})
+        , readers()
+        , wake_pending(false)
+        , listen_fd(-1)
+        , epoll_fd(-1)
+        , wake_fd(-1)
+        , port(0)
+        , stop_requested(false)
+        , worker()
+    {
+        // Clients filter for themselves; the sink's own filter only caps what any of them can get
+        this->setDefaultLogLevel(LogLevel::Noise);
+        this->listen();
+        this->epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        this->wake_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (this->epoll_fd < 0 || this->wake_fd < 0) {
+            this->closeAll();
+            throw std::runtime_error(std::format("Failed to set up TcpServerSink: {}", std::strerror(errno)));
+        }
+        this->watch(this->listen_fd, EPOLLIN, EPOLL_CTL_ADD);
+        this->watch(this->wake_fd, EPOLLIN, EPOLL_CTL_ADD);
+        this->worker = std::thread(&TcpServerSink::doBackgroundWork, this);
+    }
+    ~TcpServerSink()
+    {
+        this->stop_requested = true;
+        this->wake();
+        this->worker.join();
+        std::unique_ptr<ClientList const> const current{ this->clients.load(std::memory_order_relaxed) };
+        for (auto const& client : *current)
+            ::close(client->fd);
+        this->closeAll();
+    }
+    TcpServerSink(TcpServerSink const&) = delete;
+    TcpServerSink& operator=(TcpServerSink const&) = delete;
+
+    std::uint16_t getPort() const { return this->port; }
+
+    // An entry must pass the sink's own filter and at least one client's rules, so that the message is not even produced while no client wants it
+    virtual bool checkFilter(EntryMetadata const& entry) const override
+    {
+        if (!Filter::checkFilter(entry))
+            return false;
+        auto const guard = this->readers.enter();
+        return std::ranges::any_of(*this->clients.load(std::memory_order_seq_cst), [&](auto const& client) { return client->filter.load(std::memory_order_seq_cst)->checkFilter(entry); });
+    }
+
+    virtual void log(EntryMetadata const& meta, std::string_view msg) override
+    {
+        auto const guard = this->readers.enter();
+        thread_local std::vector<Client*> accepting;
+        accepting.clear();
+        for (auto const& client : *this->clients.load(std::memory_order_seq_cst)) {
+            if (client->filter.load(std::memory_order_seq_cst)->checkFilter(meta))
+                accepting.push_back(client.get());
+        }
+        if (accepting.empty())
+            return;
+        std::string const str = this->formatEntry(meta, msg);
+        for (auto* const client : accepting) {
+            auto const lg = this->lockTimed(client->m);
+            if (!client->push(str))
+                this->countDropped();
+        }
+        this->wake();
+    }
+
+private:
+    struct ClientFilter : Filter
+    {
+        ClientFilter() { this->setDefaultLogLevel(LogLevel::Noise); }
+    };
+
+    struct Client
+    {
+        Client(int fd_, std::size_t capacity)
+            : fd(fd_)
+            , filter(new ClientFilter const{})
+            , m()
+            , ring(capacity)
+            , head(0)
+            , tail(0)
+            , dropped(0)
+            , writable(true)
+            , reading(true)
+            , spec()
+        {}
+        ~Client() { delete this->filter.load(std::memory_order_relaxed); }
+        Client(Client const&) = delete;
+        Client& operator=(Client const&) = delete;
+
+        // Appends a whole entry, or counts it as dropped if it does not fit.
+        // The first entry that fits after some were dropped is preceded by a note saying how many.
+        bool push(std::string_view entry)
+        {
+            if (this->dropped != 0) {
+                auto const note = std::format("-- {} entries dropped --\n", this->dropped);
+                if (note.size() + entry.size() > this->free()) {
+                    this->dropped++;
+                    return false;
+                }
+                this->append(note);
+                this->dropped = 0;
+            }
+            if (entry.size() > this->free()) {
+                this->dropped++;
+                return false;
+            }
+            this->append(entry);
+            return true;
+        }
+        std::size_t free() const { return this->ring.size() - (this->tail - this->head); }
+        void append(std::string_view s)
+        {
+            auto const pos = this->tail % this->ring.size();
+            auto const first = std::min(s.size(), this->ring.size() - pos);
+            std::memcpy(this->ring.data() + pos, s.data(), first);
+            std::memcpy(this->ring.data(), s.data() + first, s.size() - first);
+            this->tail += s.size();
+        }
+
+        int const fd;
+        std::atomic<ClientFilter const*> filter; // Owned; replaced when the client sends rules, like `clients`
+        std::mutex m; // ring, head, tail, dropped
+        std::vector<char> ring;
+        std::size_t head; // Total bytes written to the socket
+        std::size_t tail; // Total bytes appended
+        std::uint64_t dropped; // Since the last note
+        // Only used by the worker
+        bool writable; // False while waiting for EPOLLOUT
+        bool reading; // False once the client has shut down its side
+        std::string spec; // Incomplete line of rules
+    };
+    using ClientList = std::vector<std::shared_ptr<Client>>;
+
+    void listen()
+    {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo* result = nullptr;
+        auto const port_str = std::to_string(this->options.port);
+        if (int const rc = ::getaddrinfo(this->options.bind_address.c_str(), port_str.c_str(), &hints, &result); rc != 0)
+            throw std::runtime_error(std::format("Failed to resolve {}: {}", this->options.bind_address, ::gai_strerror(rc)));
+        this->listen_fd = ::socket(result->ai_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        int const one = 1;
+        bool const ok = this->listen_fd >= 0
+            && ::setsockopt(this->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0
+            && ::bind(this->listen_fd, result->ai_addr, result->ai_addrlen) == 0
+            && ::listen(this->listen_fd, 16) == 0;
+        ::freeaddrinfo(result);
+        if (!ok) {
+            auto const error = errno;
+            this->closeAll();
+            throw std::runtime_error(std::format("Failed to listen on {}:{}: {}", this->options.bind_address, this->options.port, std::strerror(error)));
+        }
+        sockaddr_storage address{};
+        socklen_t size = sizeof(address);
+        ::getsockname(this->listen_fd, reinterpret_cast<sockaddr*>(&address), &size);
+        this->port = ntohs(address.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6 const&>(address).sin6_port : reinterpret_cast<sockaddr_in const&>(address).sin_port);
+    }
+
+    void closeAll()
+    {
+        for (int const fd : { this->listen_fd, this->epoll_fd, this->wake_fd }) {
+            if (fd >= 0)
+                ::close(fd);
+        }
+    }
+
+    void watch(int fd, std::uint32_t events, int op)
+    {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        ::epoll_ctl(this->epoll_fd, op, fd, &ev);
+    }
+
+    void watch(Client const& client)
+    {
+        this->watch(client.fd, (client.reading ? std::uint32_t{ EPOLLIN } : 0u) | (client.writable ? 0u : std::uint32_t{ EPOLLOUT }), EPOLL_CTL_MOD);
+    }
+
+    // Wakes the worker, at most once until it has handled the previous wake-up.
+    void wake()
+    {
+        if (!this->wake_pending.exchange(true, std::memory_order_acq_rel)) {
+            std::uint64_t const one = 1;
+            [[maybe_unused]] auto const rc = ::write(this->wake_fd, &one, sizeof(one));
+        }
+    }
+
+    void doBackgroundWork()
+    {
+        std::array<epoll_event, 64> events;
+        while (!this->stop_requested) {
+            int const n = ::epoll_wait(this->epoll_fd, events.data(), static_cast<int>(events.size()), -1);
+            for (int i = 0; i < n; i++) {
+                int const fd = events[static_cast<std::size_t>(i)].data.fd;
+                auto const ev = events[static_cast<std::size_t>(i)].events;
+                if (fd == this->listen_fd) {
+                    this->accept();
+                }
+                else if (fd == this->wake_fd) {
+                    std::uint64_t count;
+                    [[maybe_unused]] auto const rc = ::read(this->wake_fd, &count, sizeof(count));
+                    this->wake_pending.store(false, std::memory_order_release);
+                    for (auto const& client : *this->clients.load(std::memory_order_relaxed)) {
+                        if (client->writable)
+                            this->send(*client);
+                    }
+                }
+                else if (auto const client = this->findClient(fd)) {
+                    bool ok = !(ev & (EPOLLERR | EPOLLHUP));
+                    if (ok && (ev & EPOLLIN))
+                        ok = this->receive(*client);
+                    if (ok && (ev & EPOLLOUT))
+                        ok = this->send(*client);
+                    if (!ok)
+                        this->removeClient(client);
+                }
+            }
+        }
+    }
+
+    void accept()
+    {
+        while (true) {
+            int const fd = ::accept4(this->listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd < 0)
+                return;
+            auto const& current = *this->clients.load(std::memory_order_relaxed);
+            if (current.size() >= this->options.max_clients) {
+                ::close(fd);
+                continue;
+            }
+            auto updated = std::make_unique<ClientList>(current);
+            updated->push_back(std::make_shared<Client>(fd, this->options.client_buffer_bytes));
+            this->publish(std::move(updated));
+            this->watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+    }
+
+    std::shared_ptr<Client> findClient(int fd) const
+    {
+        auto const& current = *this->clients.load(std::memory_order_relaxed);
+        auto const it = std::ranges::find(current, fd, &Client::fd);
+        return it != current.end() ? *it : nullptr;
+    }
+
+    // publish() waits for the log calls that may still append to the client's buffer, so the client is destroyed here.
+    void removeClient(std::shared_ptr<Client> const& client)
+    {
+        auto updated = std::make_unique<ClientList>(*this->clients.load(std::memory_order_relaxed));
+        std::erase(*updated, client);
+        this->publish(std::move(updated));
+        ::epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, client->fd, nullptr);
+        ::close(client->fd);
+    }
+
+    // Replaces the client list, and destroys the old one once no log call can still be using it.
+    void publish(std::unique_ptr<ClientList const> updated)
+    {
+        std::unique_ptr<ClientList const> const old{ this->clients.exchange(updated.release(), std::memory_order_seq_cst) };
+        this->readers.synchronize();
+    }
+
+    // Writes as much of the client's buffer as the socket takes; returns false if the client is gone.
+    bool send(Client& client)
+    {
+        std::lock_guard lg{ client.m };
+        while (client.tail != client.head) {
+            auto const size = client.ring.size();
+            auto const pos = client.head % size;
+            auto const used = client.tail - client.head;
+            auto const first = std::min(used, size - pos);
+            std::array<iovec, 2> const iov{
+                iovec{ client.ring.data() + pos, first },
+                iovec{ client.ring.data(), used - first },
+            };
+            msghdr mh{};
+            mh.msg_iov = const_cast<iovec*>(iov.data());
+            mh.msg_iovlen = iov[1].iov_len != 0 ? 2 : 1;
+            auto const n = ::sendmsg(client.fd, &mh, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (client.writable) {
+                    client.writable = false;
+                    this->watch(client);
+                }
+                return true;
+            }
+            if (n < 0)
+                return false;
+            client.head += static_cast<std::size_t>(n);
+            this->countBytesWritten(static_cast<std::size_t>(n));
+        }
+        if (!client.writable) {
+            client.writable = true;
+            this->watch(client);
+        }
+        return true;
+    }
+
+    // Reads filter rules; returns false if the client is gone.
+    bool receive(Client& client)
+    {
+        std::array<char, 1024> buf;
+        while (true) {
+            auto const n = ::recv(client.fd, buf.data(), buf.size(), 0);
+            if (n == 0) {
+                // The client is done sending, but may still be reading
+                client.reading = false;
+                this->watch(client);
+                return true;
+            }
+            if (n < 0)
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            client.spec.append(buf.data(), static_cast<std::size_t>(n));
+            for (auto nl = client.spec.find('\n'); nl != std::string::npos; nl = client.spec.find('\n')) {
+                if (auto filter = parseRules(std::string_view{ client.spec }.substr(0, nl))) {
+                    std::unique_ptr<ClientFilter const> const old{ client.filter.exchange(filter.release(), std::memory_order_seq_cst) };
+                    // Log calls only use a client's filter while they hold the client list
+                    this->readers.synchronize();
+                }
+                client.spec.erase(0, nl + 1);
+            }
+            if (client.spec.size() > 4096)
+                return false;
+        }
+    }
+
+    // `Level` sets the default level and `domain=Level` a domain's; returns nullptr if any rule is invalid.
+    static std::unique_ptr<ClientFilter const> parseRules(std::string_view line)
+    {
+        auto filter = std::make_unique<ClientFilter>();
+        for (auto const word : std::views::split(line, ' ')) {
+            std::string_view rule{ word.begin(), word.end() };
+            if (!rule.empty() && rule.back() == '\r')
+                rule.remove_suffix(1);
+            if (rule.empty())
+                continue;
+            auto const eq = rule.find('=');
+            auto const level = parseLogLevelString(eq == std::string_view::npos ? rule : rule.substr(eq + 1));
+            if (!level)
+                return nullptr;
+            if (eq == std::string_view::npos)
+                filter->setDefaultLogLevel(*level);
+            else
+                filter->setDomainLogLevel(rule.substr(0, eq), *level);
+        }
+        return filter;
+    }
+
+private:
+    TcpServerOptions const options;
+    std::atomic<ClientList const*> clients; // Owned; copy-on-write, only the worker replaces it
+    detail::ReaderEpochs readers; // Log calls that may be using `clients` or a client's filter
+    std::atomic_bool wake_pending;
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd;
+    std::uint16_t port;
+    std::atomic_bool stop_requested;
+    std::thread worker;
+};
+inline
+std::unique_ptr<TcpServerSink> makeTcpServerSink(TcpServerOptions options = {})
+{
+    return std::make_unique<TcpServerSink>(std::move(options));
+}
+
+}
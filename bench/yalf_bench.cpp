@@ -0,0 +1,205 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+//
+// yalf_bench: Measures the per-call latency and throughput of the LOG_* macros for each sink at several producer thread counts.
+//
+// Usage: yalf_bench [options]
+//   --iterations <N>     Calls per producer thread (default: 50000)
+//   --threads <N,N,...>  Producer thread counts (default: 1,2,4,8,32)
+//   --dir <Path>         Directory for the file-based sinks, ideally on tmpfs (default: /dev/shm)
+//   --only <Name>        Only run the named scenario (may be repeated)
+//
+// Console output is redirected to /dev/null while measuring.
+// Results are written to stdout as JSON Lines, one object per scenario and thread count:
+//   {"scenario":"file","threads":4,"calls":200000,"seconds":0.1,"calls_per_sec":2000000,"p50_ns":..,"p99_ns":..,"p999_ns":..,"max_ns":..}
+#define YALF_IMPLEMENTATION
+#include "YALF.h"
+#include "YALF_DeferredSink.h"
+#include "YALF_PbFileSink.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <functional>
+#include <latch>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#define dup _dup
+#define fileno _fileno
+#define fdopen _fdopen
+inline constexpr char const* null_device = "NUL";
+#else
+#include <unistd.h>
+inline constexpr char const* null_device = "/dev/null";
+#endif
+
+namespace {
+
+struct Scenario
+{
+    std::string name;
+    std::function<std::unique_ptr<YALF::Logger>(std::filesystem::path const& dir)> make_logger;
+    bool filtered = false; // Log at Debug, which none of the sinks accept
+};
+
+template <class SinkFactory>
+std::function<std::unique_ptr<YALF::Logger>(std::filesystem::path const&)> single(SinkFactory make_sink)
+{
+    return [=](std::filesystem::path const& dir) {
+        auto logger = std::make_unique<YALF::Logger>();
+        logger->addSink("Sink", make_sink(dir));
+        return logger;
+    };
+}
+
+std::vector<Scenario> makeScenarios()
+{
+    auto console = [](std::filesystem::path const&) -> std::unique_ptr<YALF::Sink> { return YALF::makeConsoleSink(); };
+    auto console_direct = [](std::filesystem::path const&) -> std::unique_ptr<YALF::Sink> { return YALF::makeConsoleSink(YALF::ConsoleOptions{}); };
+    auto file = [](std::filesystem::path const& dir) -> std::unique_ptr<YALF::Sink> { return YALF::makeFileSink(dir / "yalf_bench.log"); };
+    auto pb_v1 = [](std::filesystem::path const& dir) -> std::unique_ptr<YALF::Sink> { return YALF::makePbFileSink(dir / "yalf_bench_v1.pb"); };
+    auto pb_v2 = [](std::filesystem::path const& dir) -> std::unique_ptr<YALF::Sink> { return YALF::makePbFileSink(dir / "yalf_bench_v2.pb", YALF::PbSchema::V2); };
+    auto deferred = [](auto make_sink) {
+        return [=](std::filesystem::path const& dir) -> std::unique_ptr<YALF::Sink> { return std::make_unique<YALF::DeferredSink>(make_sink(dir)); };
+    };
+    return {
+        { "filtered", single(file), true },
+        { "console", single(console) },
+        { "console_direct", single(console_direct) },
+        { "file", single(file) },
+        { "pb_v1", single(pb_v1) },
+        { "pb_v2", single(pb_v2) },
+        { "deferred_console", single(deferred(console)) },
+        { "deferred_file", single(deferred(file)) },
+        { "deferred_pb_v1", single(deferred(pb_v1)) },
+        { "deferred_pb_v2", single(deferred(pb_v2)) },
+    };
+}
+
+struct Result
+{
+    std::size_t calls;
+    double seconds;
+    std::uint64_t p50_ns;
+    std::uint64_t p99_ns;
+    std::uint64_t p999_ns;
+    std::uint64_t max_ns;
+};
+
+Result run(Scenario const& scenario, std::filesystem::path const& dir, unsigned threads, std::size_t iterations)
+{
+    YALF::setGlobalLogger(scenario.make_logger(dir));
+    std::vector<std::vector<std::uint32_t>> latencies(threads);
+    std::vector<std::pair<std::chrono::steady_clock::time_point, std::chrono::steady_clock::time_point>> spans(threads);
+    std::latch start{ threads };
+    std::vector<std::jthread> producers;
+    for (unsigned t = 0; t < threads; t++) {
+        producers.emplace_back([&, t] {
+            auto& lat = latencies[t];
+            lat.reserve(iterations);
+            start.arrive_and_wait();
+            spans[t].first = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < iterations; i++) {
+                auto const before = std::chrono::steady_clock::now();
+                if (scenario.filtered)
+                    LOG_DEBUG("Bench", "iteration {} of thread {}", i, t);
+                else
+                    LOG_INFO("Bench", "iteration {} of thread {}", i, t);
+                auto const after = std::chrono::steady_clock::now();
+                lat.push_back(static_cast<std::uint32_t>(std::min<std::int64_t>(std::chrono::nanoseconds{ after - before }.count(), UINT32_MAX)));
+            }
+            spans[t].second = std::chrono::steady_clock::now();
+        });
+    }
+    producers.clear();
+    YALF::setGlobalLogger(nullptr);
+    auto const begin = std::ranges::min(spans | std::views::keys);
+    auto const end = std::ranges::max(spans | std::views::values);
+
+    std::vector<std::uint32_t> all;
+    all.reserve(std::size_t{ threads } * iterations);
+    for (auto const& lat : latencies)
+        all.insert(all.end(), lat.begin(), lat.end());
+    std::ranges::sort(all);
+    auto const percentile = [&](double p) -> std::uint64_t {
+        return all.empty() ? 0 : all[std::min(all.size() - 1, static_cast<std::size_t>(p * static_cast<double>(all.size())))];
+    };
+    return Result{
+        .calls = all.size(),
+        .seconds = std::chrono::duration<double>(end - begin).count(),
+        .p50_ns = percentile(0.50),
+        .p99_ns = percentile(0.99),
+        .p999_ns = percentile(0.999),
+        .max_ns = all.empty() ? 0 : all.back(),
+    };
+}
+
+int usage(char const* argv0)
+{
+    std::fprintf(stderr, "Usage: %s [--iterations N] [--threads N,N,...] [--dir PATH] [--only NAME]...\n", argv0);
+    return 2;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t iterations = 50000;
+    std::vector<unsigned> thread_counts{ 1, 2, 4, 8, 32 };
+    std::filesystem::path dir = "/dev/shm";
+    std::vector<std::string> only;
+    for (int i = 1; i < argc; i++) {
+        std::string_view const arg = argv[i];
+        if (i + 1 >= argc)
+            return usage(argv[0]);
+        std::string_view const value = argv[++i];
+        if (arg == "--iterations") {
+            if (std::from_chars(value.data(), value.data() + value.size(), iterations).ec != std::errc{})
+                return usage(argv[0]);
+        }
+        else if (arg == "--threads") {
+            thread_counts.clear();
+            for (auto const part : value | std::views::split(',')) {
+                unsigned n = 0;
+                std::string_view const s{ part.begin(), part.end() };
+                if (std::from_chars(s.data(), s.data() + s.size(), n).ec != std::errc{} || n == 0)
+                    return usage(argv[0]);
+                thread_counts.push_back(n);
+            }
+        }
+        else if (arg == "--dir") {
+            dir = value;
+        }
+        else if (arg == "--only") {
+            only.emplace_back(value);
+        }
+        else {
+            return usage(argv[0]);
+        }
+    }
+    std::filesystem::create_directories(dir);
+
+    // Keep the real stdout for the results and send everything that ConsoleSink writes to the null device
+    std::fflush(stdout);
+    FILE* const results = fdopen(dup(fileno(stdout)), "w");
+    if (!results || !std::freopen(null_device, "w", stdout))
+        return 1;
+
+    for (auto const& scenario : makeScenarios()) {
+        if (!only.empty() && std::ranges::find(only, scenario.name) == only.end())
+            continue;
+        for (auto const threads : thread_counts) {
+            auto const r = run(scenario, dir, threads, iterations);
+            std::fprintf(results,
+                "{\"scenario\":\"%s\",\"threads\":%u,\"calls\":%zu,\"seconds\":%.6f,\"calls_per_sec\":%.0f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+                scenario.name.c_str(), threads, r.calls, r.seconds, static_cast<double>(r.calls) / r.seconds,
+                static_cast<unsigned long long>(r.p50_ns), static_cast<unsigned long long>(r.p99_ns),
+                static_cast<unsigned long long>(r.p999_ns), static_cast<unsigned long long>(r.max_ns));
+            std::fflush(results);
+        }
+    }
+    for (auto const* name : { "yalf_bench.log", "yalf_bench_v1.pb", "yalf_bench_v2.pb" })
+        std::filesystem::remove(dir / name);
+    return 0;
+}
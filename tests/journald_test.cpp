@@ -0,0 +1,243 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+// Tests JournaldSink against a Unix datagram socket bound by the test, decoding journald's native protocol.
+#define YALF_IMPLEMENTATION
+#include "YALF.h"
+#include "YALF_JournaldSink.h"
+#include "tests/yalf_test.h"
+#include <poll.h>
+#include <sys/stat.h>
+
+namespace {
+
+using JournalFields = std::vector<std::pair<std::string, std::string>>;
+
+// Decodes `KEY=value\n` and `KEY\n<64-bit little-endian length>value\n` fields; throws if the entry is malformed
+JournalFields decode(std::string_view data)
+{
+    JournalFields fields;
+    while (!data.empty()) {
+        auto const nl = data.find('\n');
+        auto const eq = data.find('=');
+        if (nl == std::string_view::npos)
+            throw std::runtime_error("Unterminated field");
+        if (eq < nl) {
+            fields.emplace_back(data.substr(0, eq), data.substr(eq + 1, nl - eq - 1));
+            data.remove_prefix(nl + 1);
+            continue;
+        }
+        if (data.size() < nl + 1 + 8)
+            throw std::runtime_error("Truncated length prefix");
+        std::uint64_t size = 0;
+        for (std::size_t i = 0; i < 8; i++)
+            size |= std::uint64_t{ static_cast<unsigned char>(data[nl + 1 + i]) } << (8 * i);
+        if (data.size() < nl + 1 + 8 + size + 1 || data[nl + 1 + 8 + size] != '\n')
+            throw std::runtime_error("Truncated binary field");
+        fields.emplace_back(data.substr(0, nl), data.substr(nl + 1 + 8, size));
+        data.remove_prefix(nl + 1 + 8 + size + 1);
+    }
+    return fields;
+}
+
+std::optional<std::string> find(JournalFields const& fields, std::string_view key)
+{
+    for (auto const& [k, v] : fields) {
+        if (k == key)
+            return v;
+    }
+    return std::nullopt;
+}
+
+// One datagram as journald would see it: its payload, or the contents of the memfd passed with it
+struct Datagram
+{
+    std::string payload;
+    bool via_memfd = false;
+    int seals = 0;
+};
+
+struct JournalReceiver
+{
+    int fd = -1;
+    std::string path;
+
+    JournalReceiver()
+        : path((std::filesystem::temp_directory_path() / std::format("yalf_journald_test.{}.sock", ::getpid())).string())
+    {
+        ::unlink(this->path.c_str());
+        this->fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, this->path.c_str(), this->path.size() + 1);
+        if (this->fd < 0 || ::bind(this->fd, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) != 0)
+            throw std::runtime_error(std::format("Failed to bind {}: {}", this->path, std::strerror(errno)));
+    }
+    ~JournalReceiver()
+    {
+        ::close(this->fd);
+        ::unlink(this->path.c_str());
+    }
+
+    std::optional<Datagram> receive()
+    {
+        pollfd pfd{ this->fd, POLLIN, 0 };
+        if (::poll(&pfd, 1, 1000) <= 0)
+            return std::nullopt;
+        Datagram d;
+        d.payload.resize(1 << 20);
+        iovec iov{ d.payload.data(), d.payload.size() };
+        alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int))> control{};
+        msghdr mh{};
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = control.data();
+        mh.msg_controllen = control.size();
+        auto const n = ::recvmsg(this->fd, &mh, MSG_CMSG_CLOEXEC);
+        if (n < 0)
+            return std::nullopt;
+        d.payload.resize(static_cast<std::size_t>(n));
+        if (cmsghdr* const cmsg = CMSG_FIRSTHDR(&mh); cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int mfd = -1;
+            std::memcpy(&mfd, CMSG_DATA(cmsg), sizeof(int));
+            struct stat st{};
+            ::fstat(mfd, &st);
+            d.via_memfd = true;
+            d.seals = ::fcntl(mfd, F_GET_SEALS);
+            d.payload.resize(static_cast<std::size_t>(st.st_size));
+            std::size_t done = 0;
+            while (done < d.payload.size()) {
+                auto const r = ::pread(mfd, d.payload.data() + done, d.payload.size() - done, static_cast<off_t>(done));
+                if (r <= 0)
+                    break;
+                done += static_cast<std::size_t>(r);
+            }
+            d.payload.resize(done);
+            ::close(mfd);
+        }
+        return d;
+    }
+};
+
+YALF::EntryMetadata metadataAt(YALF::LogLevel level, std::string_view domain, std::source_location loc = std::source_location::current())
+{
+    return YALF::EntryMetadata{
+        .level = level,
+        .domain = domain,
+        .instance = std::nullopt,
+        .source_location = loc,
+        .timestamp = std::chrono::time_point_cast<YALF::LogEntryTimestampDuration>(YALF::LogEntryTimestampClock::now()),
+        .fields = {},
+    };
+}
+
+}
+
+YALF_TEST(fields_in_order)
+{
+    JournalReceiver receiver;
+    YALF::JournaldSink sink{ { .socket_path = receiver.path, .identifier = "yalf_test" } };
+    std::array const fields{ YALF::kv("peer", "1.2.3.4"), YALF::kv("rtt", 1.5), YALF::kv("ok", true), YALF::kv("2bad-key", -3) };
+    auto const loc = std::source_location::current();
+    auto meta = metadataAt(YALF::LogLevel::Warning, "Net.Tcp", loc);
+    meta.instance = "conn1";
+    meta.suppressed = 7;
+    meta.fields = fields;
+    sink.log(meta, "hello 42");
+
+    auto const d = receiver.receive();
+    CHECK(d.has_value());
+    if (!d)
+        return;
+    CHECK(!d->via_memfd);
+    // Values without a newline use the KEY=value form
+    CHECK(d->payload.starts_with("MESSAGE=hello 42\nPRIORITY=4\n"));
+    JournalFields const expected{
+        { "MESSAGE", "hello 42" },
+        { "PRIORITY", "4" },
+        { "CODE_FILE", loc.file_name() },
+        { "CODE_LINE", std::to_string(loc.line()) },
+        { "CODE_FUNC", loc.function_name() },
+        { "SYSLOG_IDENTIFIER", "yalf_test" },
+        { "YALF_DOMAIN", "Net.Tcp" },
+        { "YALF_INSTANCE", "conn1" },
+        { "YALF_SUPPRESSED", "7" },
+        { "PEER", "1.2.3.4" },
+        { "RTT", "1.5" },
+        { "OK", "true" },
+        { "F2BAD_KEY", "-3" },
+    };
+    CHECK(decode(d->payload) == expected);
+}
+
+YALF_TEST(multi_line_values_use_binary_length_prefix)
+{
+    JournalReceiver receiver;
+    YALF::JournaldSink sink{ { .socket_path = receiver.path, .identifier = "yalf_test" } };
+    std::array const fields{ YALF::kv("trace", "a=1\nb=2\n") };
+    auto meta = metadataAt(YALF::LogLevel::Error, "Net");
+    meta.fields = fields;
+    sink.log(meta, "first\nsecond");
+
+    auto const d = receiver.receive();
+    CHECK(d.has_value());
+    if (!d)
+        return;
+    using namespace std::string_literals;
+    CHECK(d->payload.starts_with("MESSAGE\n\x0c\0\0\0\0\0\0\0first\nsecond\n"s));
+    CHECK(d->payload.ends_with("TRACE\n\x08\0\0\0\0\0\0\0a=1\nb=2\n\n"s));
+    auto const decoded = decode(d->payload);
+    CHECK(find(decoded, "MESSAGE") == "first\nsecond");
+    CHECK(find(decoded, "TRACE") == "a=1\nb=2\n");
+    CHECK(find(decoded, "PRIORITY") == "3");
+}
+
+YALF_TEST(oversize_entries_go_through_sealed_memfd)
+{
+    JournalReceiver receiver;
+    YALF::JournaldSink sink{ { .socket_path = receiver.path, .identifier = "yalf_test" } };
+    // Larger than any datagram the socket accepts, so sendmsg() fails with EMSGSIZE
+    std::string const big = std::string(20'000'000, 'x') + "\nend";
+    sink.log(metadataAt(YALF::LogLevel::Notice, "Big"), big);
+
+    auto const d = receiver.receive();
+    CHECK(d.has_value());
+    if (!d)
+        return;
+    CHECK(d->via_memfd);
+    int const seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+    CHECK((d->seals & seals) == seals);
+    auto const decoded = decode(d->payload);
+    auto const message = find(decoded, "MESSAGE");
+    CHECK(message.has_value() && message->size() == big.size() && *message == big);
+    CHECK(find(decoded, "YALF_DOMAIN") == "Big");
+}
+
+YALF_TEST(entries_with_more_than_iov_max_pieces_go_through_memfd)
+{
+    JournalReceiver receiver;
+    YALF::JournaldSink sink{ { .socket_path = receiver.path, .identifier = "yalf_test" } };
+    std::vector<std::string> keys;
+    for (int i = 0; i < IOV_MAX; i++)
+        keys.push_back(std::format("k{}", i));
+    std::vector<YALF::Field> fields;
+    for (int i = 0; i < IOV_MAX; i++)
+        fields.push_back(YALF::kv(keys[static_cast<std::size_t>(i)], i));
+    auto meta = metadataAt(YALF::LogLevel::Info, "Many");
+    meta.fields = fields;
+    sink.log(meta, "many fields");
+
+    auto const d = receiver.receive();
+    CHECK(d.has_value());
+    if (!d)
+        return;
+    CHECK(d->via_memfd);
+    auto const decoded = decode(d->payload);
+    CHECK(find(decoded, "K0") == "0");
+    CHECK(find(decoded, std::format("K{}", IOV_MAX - 1)) == std::to_string(IOV_MAX - 1));
+    CHECK(find(decoded, "MESSAGE") == "many fields");
+}
+
+int main()
+{
+    return YALF::Test::testMain();
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+// Tests JSON string escaping, comparing the SSE2/AVX2 scanners with the scalar one, and the lines written by JsonLinesSink.
+#define YALF_IMPLEMENTATION
+#include "YALF.h"
+#include "YALF_JsonLinesSink.h"
+#include "tests/yalf_test.h"
+
+namespace {
+
+using Finder = char const* (*)(char const*, char const*);
+
+// Every finder available on this machine, with its name
+std::vector<std::pair<std::string_view, Finder>> simdFinders()
+{
+    std::vector<std::pair<std::string_view, Finder>> finders;
+    #if defined(YALF_JSON_SIMD)
+    finders.emplace_back("SSE2", &YALF::detail::findJsonEscapeSse2);
+    if (__builtin_cpu_supports("avx2"))
+        finders.emplace_back("AVX2", &YALF::detail::findJsonEscapeAvx2);
+    #endif
+    finders.emplace_back("dispatch", &YALF::detail::findJsonEscape);
+    return finders;
+}
+
+std::string jsonString(std::string_view str)
+{
+    std::string out;
+    YALF::appendJsonString(out, str);
+    return out;
+}
+
+}
+
+YALF_TEST(simd_escape_scan_matches_scalar_around_vector_boundaries)
+{
+    // Bytes that need escaping, and bytes next to them in value that don't
+    constexpr std::array<char, 5> escapes{ '"', '\\', '\x00', '\x1f', '\n' };
+    constexpr std::array<char, 6> fillers{ 'a', ' ', '\x7f', '\x80', '\xff', '!' };
+    std::array<char, 3 + 72> buffer{};
+    int mismatches = 0;
+    for (auto const& [name, find] : simdFinders()) {
+        for (std::size_t offset = 0; offset < 3; offset++) {
+            for (std::size_t length = 0; length <= 70; length++) {
+                for (auto const filler : fillers) {
+                    char* const begin = buffer.data() + offset;
+                    char* const end = begin + length;
+                    std::fill(buffer.begin(), buffer.end(), filler);
+                    // Nothing to escape, then the first escape at each position, with a second one after it
+                    if (find(begin, end) != end)
+                        mismatches++;
+                    for (std::size_t at = 0; at < length; at++) {
+                        for (auto const escape : escapes) {
+                            std::fill(buffer.begin(), buffer.end(), filler);
+                            begin[at] = escape;
+                            if (at + 17 < length)
+                                begin[at + 17] = '"';
+                            auto const* const expected = YALF::detail::findJsonEscapeScalar(begin, end);
+                            if (expected != begin + at || find(begin, end) != expected) {
+                                if (mismatches++ == 0)
+                                    std::fprintf(stderr, "%.*s: offset %zu length %zu escape at %zu\n", static_cast<int>(name.size()), name.data(), offset, length, at);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    CHECK_EQ(mismatches, 0);
+}
+
+YALF_TEST(strings_are_escaped)
+{
+    CHECK_EQ(jsonString(""), std::string{ "\"\"" });
+    CHECK_EQ(jsonString("say \"hi\"\\"), std::string{ "\"say \\\"hi\\\"\\\\\"" });
+    CHECK_EQ(jsonString("a\nb\rc\td"), std::string{ "\"a\\nb\\rc\\td\"" });
+    CHECK_EQ(jsonString(std::string_view{ "\x00\x01\x1f\x20\x7f", 5 }), std::string{ "\"\\u0000\\u0001\\u001f \x7f\"" });
+    // UTF-8 is copied as is
+    CHECK_EQ(jsonString("gr\xc3\xbc\xc3\x9f \xe2\x82\xac"), std::string{ "\"gr\xc3\xbc\xc3\x9f \xe2\x82\xac\"" });
+    // Escapes straddling and just past the 16 and 32 byte blocks
+    std::string const text = std::string(15, 'x') + "\"\"" + std::string(14, 'y') + "\\\t" + std::string(3, 'z');
+    std::string const expected = "\"" + std::string(15, 'x') + "\\\"\\\"" + std::string(14, 'y') + "\\\\\\t" + std::string(3, 'z') + "\"";
+    CHECK_EQ(jsonString(text), expected);
+}
+
+YALF_TEST(line_has_utc_timestamp_and_escaped_fields)
+{
+    using namespace std::chrono;
+    std::array const fields{ YALF::kv("path", "C:\\tmp"), YALF::kv("n", 3) };
+    YALF::EntryMetadata const meta{
+        .level = YALF::LogLevel::Warning,
+        .domain = "Net",
+        .instance = "conn\"1\"",
+        .source_location = std::source_location::current(),
+        .timestamp = time_point_cast<YALF::LogEntryTimestampDuration>(YALF::LogEntryTimestamp{ sys_days{ 2024y / March / 5 } + 6h + 7min + 8s }),
+        .fields = fields,
+    };
+    std::string line;
+    YALF::formatJsonLine(line, meta, "multi\nline");
+    CHECK(line.starts_with("{\"timestamp\":\"2024-03-05T06:07:08"));
+    CHECK(line.find("\",\"level\":\"Warning\",\"domain\":\"Net\",\"instance\":\"conn\\\"1\\\"\"") != std::string::npos);
+    CHECK(line.find(",\"message\":\"multi\\nline\"") != std::string::npos);
+    CHECK(line.find("\"path\":\"C:\\\\tmp\"") != std::string::npos);
+    CHECK(line.ends_with("}") && line.find('\n') == std::string::npos);
+}
+
+int main()
+{
+    return YALF::Test::testMain();
+}
@@ -0,0 +1,120 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+// Tests adding and removing a Logger's sinks while other threads are logging.
+#define YALF_IMPLEMENTATION
+#include "YALF.h"
+#include "tests/yalf_test.h"
+
+namespace {
+
+// Counts the log calls that are inside it, and records which thread destroyed it
+struct TrackingSink : YALF::Sink
+{
+    std::atomic<int> in_log{ 0 };
+    std::atomic<int>& entered; // Log calls that reached any TrackingSink
+    std::atomic<int>& destroyed_while_in_use;
+    std::thread::id* destroyed_by;
+    std::atomic<bool>* block; // While set, log() waits
+
+    TrackingSink(std::atomic<int>& entered_, std::atomic<int>& destroyed_while_in_use_, std::thread::id* destroyed_by_ = nullptr, std::atomic<bool>* block_ = nullptr)
+        : entered(entered_)
+        , destroyed_while_in_use(destroyed_while_in_use_)
+        , destroyed_by(destroyed_by_)
+        , block(block_)
+    {}
+    ~TrackingSink()
+    {
+        if (this->in_log.load() != 0)
+            this->destroyed_while_in_use++;
+        if (this->destroyed_by)
+            *this->destroyed_by = std::this_thread::get_id();
+    }
+    void log(YALF::EntryMetadata const&, std::string_view) override
+    {
+        this->in_log++;
+        this->entered++;
+        while (this->block && this->block->load())
+            std::this_thread::yield();
+        this->in_log--;
+    }
+};
+
+}
+
+YALF_TEST(removed_sink_outlives_in_flight_calls_and_dies_on_the_removing_thread)
+{
+    YALF::Logger logger;
+    std::atomic<int> entered{ 0 };
+    std::atomic<int> destroyed_while_in_use{ 0 };
+    std::thread::id destroyed_by;
+    std::atomic<bool> block{ true };
+    logger.addSink("Tracking", std::make_unique<TrackingSink>(entered, destroyed_while_in_use, &destroyed_by, &block));
+
+    std::thread logging{ [&] { logger.log(YALF::LogLevel::Info, "Test", std::source_location::current(), "blocked"); } };
+    while (entered.load() == 0)
+        std::this_thread::yield();
+    std::atomic<bool> removed{ false };
+    std::thread::id remover_id;
+    std::thread remover{ [&] {
+        remover_id = std::this_thread::get_id();
+        logger.removeSink("Tracking");
+        removed = true;
+    } };
+    std::this_thread::sleep_for(std::chrono::milliseconds{ 50 });
+    CHECK(!removed.load());
+    block = false;
+    logging.join();
+    remover.join();
+    CHECK(removed.load());
+    CHECK_EQ(destroyed_while_in_use.load(), 0);
+    CHECK(destroyed_by == remover_id);
+    CHECK(!logger.isEnabled(YALF::LogLevel::Info, "Test"));
+}
+
+YALF_TEST(sinks_added_and_removed_while_logging)
+{
+    YALF::Logger logger;
+    std::atomic<int> entered{ 0 };
+    std::atomic<int> destroyed_while_in_use{ 0 };
+    std::atomic<bool> stop{ false };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&] {
+            while (!stop.load())
+                logger.log(YALF::LogLevel::Info, "Test", std::source_location::current(), "entry {}", t);
+        });
+    }
+    for (int i = 0; i < 200; i++) {
+        logger.addSink(std::format("Sink{}", i % 3), std::make_unique<TrackingSink>(entered, destroyed_while_in_use));
+        if (i % 2 == 1)
+            logger.removeSink(std::format("Sink{}", (i + 1) % 3));
+    }
+    stop = true;
+    for (auto& t : threads)
+        t.join();
+    CHECK_EQ(destroyed_while_in_use.load(), 0);
+}
+
+YALF_TEST(get_sink_throws_for_an_unknown_name)
+{
+    YALF::Logger logger;
+    std::atomic<int> entered{ 0 };
+    std::atomic<int> destroyed_while_in_use{ 0 };
+    logger.addSink("Tracking", std::make_unique<TrackingSink>(entered, destroyed_while_in_use));
+    logger.getSink("Tracking").setDefaultLogLevel(YALF::LogLevel::Error);
+    CHECK(!logger.isEnabled(YALF::LogLevel::Info, "Test"));
+    CHECK(logger.isEnabled(YALF::LogLevel::Error, "Test"));
+    bool threw = false;
+    try {
+        logger.getSink("Missing");
+    }
+    catch (std::runtime_error const&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+int main()
+{
+    return YALF::Test::testMain();
+}
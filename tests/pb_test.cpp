@@ -0,0 +1,426 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+// Tests protobuf log files written by ProtobufFileSink and read back with PbFileReader and queryPbFile.
+#define YALF_IMPLEMENTATION
+#include "YALF.h"
+#include "YALF_PbQuery.h"
+#include "tests/yalf_test.h"
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// A file in the temporary directory that is removed, with its index, when the test is done
+struct TempPbFile
+{
+    std::filesystem::path path;
+
+    explicit TempPbFile(std::string_view name)
+        : path(std::filesystem::temp_directory_path() / std::format("yalf_pb_test.{}.{}.pb", ::getpid(), name))
+    {
+        this->remove();
+    }
+    ~TempPbFile() { this->remove(); }
+    void remove() const
+    {
+        std::filesystem::remove(this->path);
+        std::filesystem::remove(YALF::pbIndexPath(this->path));
+    }
+};
+
+YALF::LogEntryTimestamp ticks(YALF::LogEntryTimestampClock::rep t)
+{
+    return YALF::LogEntryTimestamp{ YALF::LogEntryTimestampDuration{ t } };
+}
+
+// Logs one entry per timestamp, with the timestamp as its message
+void writeEntries(std::filesystem::path const& path, YALF::PbFileOptions const& options, std::vector<YALF::LogEntryTimestampClock::rep> const& timestamps)
+{
+    YALF::ProtobufFileSink sink{ path, options };
+    for (auto const t : timestamps) {
+        YALF::EntryMetadata const meta{
+            .level = YALF::LogLevel::Info,
+            .domain = "Test",
+            .instance = std::nullopt,
+            .source_location = std::source_location::current(),
+            .timestamp = ticks(t),
+            .fields = {},
+        };
+        sink.log(meta, std::to_string(t));
+    }
+}
+
+std::vector<std::string> readRange(std::filesystem::path const& path, YALF::LogEntryTimestampClock::rep from, YALF::LogEntryTimestampClock::rep to)
+{
+    std::vector<std::string> messages;
+    YALF::PbFileReader reader{ path };
+    reader.forEachInRange(ticks(from), ticks(to), [&](YALF::PbLogEntry const& entry) { messages.push_back(entry.message); });
+    return messages;
+}
+
+// The messages of the matching entries, one per line
+std::string queryMessages(std::filesystem::path const& path, YALF::PbQuery const& query, unsigned threads = 1)
+{
+    std::ostringstream out;
+    YALF::queryPbFile(path, query, "%x%n", out, threads);
+    return out.str();
+}
+
+YALF::PbQuery timeRange(YALF::LogEntryTimestampClock::rep from, YALF::LogEntryTimestampClock::rep to)
+{
+    YALF::PbQuery query;
+    query.from = ticks(from);
+    query.to = ticks(to);
+    return query;
+}
+
+std::size_t lineCount(std::string_view text)
+{
+    return static_cast<std::size_t>(std::ranges::count(text, '\n'));
+}
+
+// Every way of writing a file, with small blocks so that each file has many of them
+std::vector<std::pair<std::string_view, YALF::PbFileOptions>> layouts()
+{
+    std::vector<std::pair<std::string_view, YALF::PbFileOptions>> all{
+        { "v1", { .schema = YALF::PbSchema::V1, .block_entries = 16 } },
+        { "v1 indexed", { .schema = YALF::PbSchema::V1, .write_index = true, .block_entries = 16 } },
+        { "v2", { .schema = YALF::PbSchema::V2, .block_entries = 16 } },
+        { "v2 indexed", { .schema = YALF::PbSchema::V2, .write_index = true, .block_entries = 16 } },
+        { "v2 framed", { .schema = YALF::PbSchema::V2, .framed = true, .block_entries = 16 } },
+        { "v2 framed indexed", { .schema = YALF::PbSchema::V2, .framed = true, .write_index = true, .block_entries = 16 } },
+    };
+    #ifdef YALF_PB_ZSTD
+    all.push_back({ "v2 zstd", { .schema = YALF::PbSchema::V2, .compression = YALF::PbCompression::Zstd, .block_entries = 16 } });
+    all.push_back({ "v2 framed zstd indexed", { .schema = YALF::PbSchema::V2, .framed = true, .compression = YALF::PbCompression::Zstd, .write_index = true, .block_entries = 16 } });
+    #endif
+    return all;
+}
+
+std::source_location callsite(int which)
+{
+    switch (which) {
+        case 0: return std::source_location::current();
+        case 1: return std::source_location::current();
+        default: return std::source_location::current();
+    }
+}
+
+template <int N>
+std::source_location instantiatedCallsite()
+{
+    return std::source_location::current();
+}
+
+// Entries that differ in every field, from a few callsites, logged as "entry <i>;"
+struct SampleEntries
+{
+    std::vector<std::string> messages;
+    std::vector<std::string> instances;
+    std::vector<std::vector<YALF::Field>> fields;
+    std::vector<YALF::EntryMetadata> metadata;
+
+    explicit SampleEntries(std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++) {
+            this->messages.push_back(std::format("entry {};", i));
+            this->instances.push_back(std::format("conn{}", i % 7));
+        }
+        for (std::size_t i = 0; i < count; i++) {
+            this->fields.push_back({ YALF::kv("i", static_cast<int>(i) - 5), YALF::kv("u", std::uint64_t{ i } << 40), YALF::kv("ratio", static_cast<double>(i) / 4),
+                YALF::kv("odd", i % 2 == 1), YALF::kv("name", std::string_view{ this->instances[i] }) });
+        }
+        for (std::size_t i = 0; i < count; i++) {
+            this->metadata.push_back(YALF::EntryMetadata{
+                .level = static_cast<YALF::LogLevel>(i % 8),
+                .domain = i % 3 == 0 ? "Net" : "Disk",
+                .instance = i % 2 == 0 ? std::optional<std::string_view>{ this->instances[i] } : std::nullopt,
+                .source_location = callsite(static_cast<int>(i % 3)),
+                .timestamp = ticks(1'700'000'000'000'000 + static_cast<YALF::LogEntryTimestampClock::rep>(i) * 1000 - (i % 5 == 4 ? 3500 : 0)),
+                .suppressed = i % 4,
+                .fields = i % 6 == 5 ? std::span<YALF::Field const>{} : std::span<YALF::Field const>{ this->fields[i] },
+            });
+        }
+    }
+
+    void write(std::filesystem::path const& path, YALF::PbFileOptions const& options) const
+    {
+        YALF::ProtobufFileSink sink{ path, options };
+        for (std::size_t i = 0; i < this->metadata.size(); i++)
+            sink.log(this->metadata[i], this->messages[i]);
+    }
+};
+
+std::string describeFields(std::span<YALF::Field const> fields)
+{
+    std::string out;
+    for (auto const& f : fields)
+        std::visit([&](auto const& v) { out += std::format(" {}={}", f.key, v); }, f.value);
+    return out;
+}
+
+// All of an entry as text, to compare what was written with what was read
+std::string describe(YALF::EntryMetadata const& meta, std::string_view msg)
+{
+    return std::format("{} {} {} {}:{}:{} {} {} {} {}{}", static_cast<int>(meta.level), meta.domain, meta.instance.value_or("-"),
+        meta.source_location.file_name(), meta.source_location.line(), meta.source_location.column(), meta.source_location.function_name(),
+        meta.timestamp.time_since_epoch().count(), msg, meta.suppressed, describeFields(meta.fields));
+}
+std::string describe(YALF::PbLogEntry const& entry)
+{
+    return std::format("{} {} {} {}:{}:{} {} {} {} {}{}", static_cast<int>(entry.level), entry.domain, entry.instance.value_or("-"),
+        entry.filename, entry.line, entry.column, entry.function,
+        entry.timestamp.time_since_epoch().count(), entry.message, entry.suppressed, describeFields(entry.fields.get()));
+}
+
+std::vector<std::string> readAll(YALF::PbFileReader& reader)
+{
+    std::vector<std::string> entries;
+    YALF::PbLogEntry entry;
+    while (reader.next(entry))
+        entries.push_back(describe(entry));
+    return entries;
+}
+
+std::string messagesOf(YALF::PbFileReader& reader)
+{
+    std::string messages;
+    YALF::PbLogEntry entry;
+    while (reader.next(entry))
+        messages += entry.message + "\n";
+    return messages;
+}
+
+// Overwrites the bytes at the first occurrence of `text` in the file
+void corrupt(std::filesystem::path const& path, std::string_view text, std::string_view replacement)
+{
+    std::string data;
+    {
+        std::ifstream in{ path, std::ios_base::binary };
+        data.assign(std::istreambuf_iterator<char>{ in }, std::istreambuf_iterator<char>{});
+    }
+    auto const pos = data.find(text);
+    if (pos == std::string::npos)
+        throw std::runtime_error(std::format("{} is not in the file", text));
+    data.replace(pos, replacement.size(), replacement);
+    std::ofstream out{ path, std::ios_base::binary | std::ios_base::trunc };
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+}
+
+YALF_TEST(range_includes_late_entries_in_later_blocks)
+{
+    // Block 5 (entries 250 to 299) holds a late entry from tick 190
+    std::vector<YALF::LogEntryTimestampClock::rep> timestamps;
+    for (YALF::LogEntryTimestampClock::rep t = 0; t < 1000; t++) {
+        timestamps.push_back(t);
+        if (t == 260)
+            timestamps.push_back(190);
+    }
+    for (auto const schema : { YALF::PbSchema::V1, YALF::PbSchema::V2 }) {
+        TempPbFile const file{ "late" };
+        writeEntries(file.path, { .schema = schema, .write_index = true, .block_entries = 50 }, timestamps);
+        auto const messages = readRange(file.path, 100, 199);
+        CHECK_EQ(messages.size(), std::size_t{ 101 });
+        CHECK_EQ(std::ranges::count(messages, std::string{ "190" }), 2);
+        CHECK_EQ(lineCount(queryMessages(file.path, timeRange(100, 199))), std::size_t{ 101 });
+        // Nothing later is in range, but the last block is still read
+        CHECK_EQ(readRange(file.path, 995, 2000).size(), std::size_t{ 5 });
+    }
+}
+
+YALF_TEST(entries_round_trip_in_every_layout)
+{
+    SampleEntries const sample{ 100 };
+    std::vector<std::string> expected;
+    for (std::size_t i = 0; i < sample.metadata.size(); i++)
+        expected.push_back(describe(sample.metadata[i], sample.messages[i]));
+    for (auto const& [name, options] : layouts()) {
+        TempPbFile const file{ "round_trip" };
+        sample.write(file.path, options);
+        YALF::PbFileReader reader{ file.path };
+        CHECK(reader.getSchema() == options.schema);
+        CHECK_EQ(reader.isFramed(), options.framed);
+        CHECK_EQ(reader.hasIndex(), options.write_index);
+        auto const entries = readAll(reader);
+        if (entries != expected)
+            std::fprintf(stderr, "%.*s: read back differently\n", static_cast<int>(name.size()), name.data());
+        CHECK(entries == expected);
+        CHECK_EQ(reader.getCorruptRegionCount(), std::size_t{ 0 });
+    }
+}
+
+YALF_TEST(template_instantiations_get_their_own_callsites)
+{
+    for (auto const& [name, options] : layouts()) {
+        TempPbFile const file{ "instantiations" };
+        {
+            YALF::ProtobufFileSink sink{ file.path, options };
+            for (auto const& location : { instantiatedCallsite<1>(), instantiatedCallsite<2>(), instantiatedCallsite<1>() }) {
+                YALF::EntryMetadata const meta{
+                    .level = YALF::LogLevel::Info,
+                    .domain = "Test",
+                    .instance = std::nullopt,
+                    .source_location = location,
+                    .timestamp = ticks(0),
+                    .fields = {},
+                };
+                sink.log(meta, "");
+            }
+        }
+        YALF::PbFileReader reader{ file.path };
+        std::vector<std::string> functions;
+        YALF::PbLogEntry entry;
+        while (reader.next(entry))
+            functions.push_back(entry.function);
+        CHECK_EQ(functions.size(), std::size_t{ 3 });
+        if (functions.size() == 3) {
+            CHECK_EQ(functions[0], std::string{ instantiatedCallsite<1>().function_name() });
+            CHECK_EQ(functions[1], std::string{ instantiatedCallsite<2>().function_name() });
+            CHECK_EQ(functions[2], functions[0]);
+        }
+    }
+}
+
+YALF_TEST(sink_can_be_constructed_with_just_a_schema)
+{
+    TempPbFile const file{ "schema" };
+    {
+        YALF::ProtobufFileSink sink{ file.path, YALF::PbSchema::V2 };
+        sink.log(SampleEntries{ 1 }.metadata[0], "only");
+    }
+    YALF::PbFileReader reader{ file.path };
+    CHECK(reader.getSchema() == YALF::PbSchema::V2);
+    CHECK_EQ(messagesOf(reader), std::string{ "only\n" });
+}
+
+YALF_TEST(reader_and_query_skip_the_same_corrupt_regions)
+{
+    SampleEntries const sample{ 300 };
+    for (auto const& [name, options] : layouts()) {
+        if (!options.framed || options.compression != YALF::PbCompression::None)
+            continue; // The messages must be in the file as is
+        TempPbFile const file{ "corrupt" };
+        sample.write(file.path, options);
+        // A bad CRC in the middle of one block, and a clobbered record header in another
+        corrupt(file.path, "entry 40;", "entry 4X;");
+        corrupt(file.path, "entry 203;", std::string(12, '\xff'));
+        YALF::PbFileReader reader{ file.path };
+        auto const read = messagesOf(reader);
+        std::ostringstream out;
+        auto const stats = YALF::queryPbFile(file.path, YALF::PbQuery{}, "%x%n", out, 1);
+        CHECK_EQ(out.str(), read);
+        CHECK_EQ(reader.getCorruptRegionCount(), std::size_t{ 2 });
+        CHECK_EQ(stats.corrupt_regions, std::size_t{ 2 });
+        // Only the rest of the two damaged blocks is lost
+        CHECK(read.find("entry 39;\n") != std::string::npos && read.find("entry 40;") == std::string::npos && read.find("entry 48;\n") != std::string::npos);
+        CHECK(read.find("entry 202;\n") != std::string::npos && read.find("entry 203;") == std::string::npos && read.find("entry 208;\n") != std::string::npos);
+        CHECK_EQ(lineCount(read), std::size_t{ 300 - 8 - 5 });
+    }
+}
+
+YALF_TEST(seek_starts_at_the_block_that_can_hold_the_time)
+{
+    std::vector<YALF::LogEntryTimestampClock::rep> timestamps;
+    for (YALF::LogEntryTimestampClock::rep t = 0; t < 1000; t++)
+        timestamps.push_back(t);
+    for (auto const& [name, layout] : layouts()) {
+        auto options = layout;
+        options.block_entries = 50;
+        TempPbFile const file{ "seek" };
+        writeEntries(file.path, options, timestamps);
+        YALF::PbFileReader reader{ file.path };
+        YALF::PbLogEntry entry;
+        auto const firstAfterSeek = [&](YALF::LogEntryTimestampClock::rep t) {
+            reader.seek(ticks(t));
+            return reader.next(entry) ? entry.message : std::string{ "none" };
+        };
+        if (options.write_index) {
+            CHECK_EQ(firstAfterSeek(520), std::string{ "500" });
+            CHECK_EQ(firstAfterSeek(549), std::string{ "500" });
+            CHECK_EQ(firstAfterSeek(550), std::string{ "550" });
+            CHECK_EQ(firstAfterSeek(0), std::string{ "0" });
+            // Beyond the end: the last block
+            CHECK_EQ(firstAfterSeek(5000), std::string{ "950" });
+            CHECK_EQ(firstAfterSeek(120), std::string{ "100" }); // Backwards
+        }
+        else {
+            CHECK_EQ(firstAfterSeek(520), std::string{ "0" });
+        }
+        CHECK_EQ(readRange(file.path, 520, 530).size(), std::size_t{ 11 });
+    }
+}
+
+YALF_TEST(split_chunks_decode_to_the_whole_file)
+{
+    SampleEntries const sample{ 400 };
+    for (auto const& [name, options] : layouts()) {
+        TempPbFile const file{ "split" };
+        sample.write(file.path, options);
+        YALF::PbFileReader reader{ file.path };
+        auto const expected = readAll(reader);
+
+        YALF::MappedFile const mapped{ file.path };
+        auto const data = mapped.data();
+        auto const layout = YALF::readPbFileLayout(data);
+        auto const chunks = YALF::splitPbFile(data, layout, YALF::readPbIndex(YALF::pbIndexPath(file.path)), 1024);
+        CHECK(chunks.size() > 4);
+        CHECK(!chunks.empty() && chunks.front().first == layout.data_offset && chunks.back().second == data.size());
+        std::vector<std::string> decoded;
+        std::size_t corrupt_regions = 0;
+        for (std::size_t i = 0; i < chunks.size(); i++) {
+            CHECK(chunks[i].first < chunks[i].second);
+            if (i != 0)
+                CHECK_EQ(chunks[i].first, chunks[i - 1].second);
+            auto const chunk = data.substr(chunks[i].first, chunks[i].second - chunks[i].first);
+            corrupt_regions += YALF::decodePbChunk(chunk, layout, [&](YALF::PbLogEntry const& entry) { decoded.push_back(describe(entry)); });
+        }
+        if (decoded != expected)
+            std::fprintf(stderr, "%.*s: chunks decoded differently\n", static_cast<int>(name.size()), name.data());
+        CHECK(decoded == expected);
+        CHECK_EQ(corrupt_regions, std::size_t{ 0 });
+    }
+}
+
+YALF_TEST(query_on_several_threads_matches_one_thread)
+{
+    // Large enough for several chunks of the 1 MiB minimum
+    constexpr std::size_t count = 12000;
+    std::vector<std::string> messages;
+    for (std::size_t i = 0; i < count; i++)
+        messages.push_back(std::format("{:0>200}", i));
+    for (auto const& [name, layout] : layouts()) {
+        auto options = layout;
+        options.block_entries = 1000;
+        TempPbFile const file{ "threads" };
+        {
+            YALF::ProtobufFileSink sink{ file.path, options };
+            for (std::size_t i = 0; i < count; i++) {
+                YALF::EntryMetadata const meta{
+                    .level = YALF::LogLevel::Info,
+                    .domain = "Test",
+                    .instance = std::nullopt,
+                    .source_location = callsite(0),
+                    .timestamp = ticks(static_cast<YALF::LogEntryTimestampClock::rep>(i)),
+                    .fields = {},
+                };
+                sink.log(meta, messages[i]);
+            }
+        }
+        CHECK(std::filesystem::file_size(file.path) > (2 << 20));
+        for (auto const& query : { YALF::PbQuery{}, timeRange(3000, 8999) }) {
+            std::ostringstream one, four;
+            auto const stats_one = YALF::queryPbFile(file.path, query, "%x%n", one, 1);
+            auto const stats_four = YALF::queryPbFile(file.path, query, "%x%n", four, 4);
+            CHECK(one.str() == four.str());
+            CHECK_EQ(stats_four.matches, stats_one.matches);
+            CHECK_EQ(lineCount(four.str()), query.from ? std::size_t{ 6000 } : count);
+        }
+    }
+}
+
+int main()
+{
+    return YALF::Test::testMain();
+}
@@ -0,0 +1,191 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+// Tests ShmRing with producer threads in this process, and with producer processes that stall or die while writing an entry.
+#define YALF_IMPLEMENTATION
+#include "YALF.h"
+#include "YALF_ShmSink.h"
+#include "tests/yalf_test.h"
+#include <csignal>
+#include <sys/wait.h>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// A ring under a name unique to this process, removed when the test is done
+struct TempRing
+{
+    std::string name;
+    std::unique_ptr<YALF::ShmRing> ring;
+
+    explicit TempRing(std::uint64_t capacity)
+        : name(std::format("/yalf_shm_test.{}", ::getpid()))
+    {
+        ::shm_unlink(this->name.c_str());
+        this->ring = YALF::ShmRing::create(this->name, capacity);
+    }
+    ~TempRing() { ::shm_unlink(this->name.c_str()); }
+};
+
+YALF::EntryMetadata metadata(std::span<YALF::Field const> fields = {})
+{
+    return YALF::EntryMetadata{
+        .level = YALF::LogLevel::Info,
+        .domain = "Test",
+        .instance = std::nullopt,
+        .source_location = std::source_location::current(),
+        .timestamp = std::chrono::time_point_cast<YALF::LogEntryTimestampDuration>(YALF::LogEntryTimestampClock::now()),
+        .fields = fields,
+    };
+}
+
+// Reads every entry that is ready, returning their messages
+std::vector<std::string> drain(YALF::ShmRing& ring, std::chrono::milliseconds publish_timeout = 1s)
+{
+    std::vector<std::string> messages;
+    while (ring.read([&](YALF::EntryMetadata const&, std::string_view msg) { messages.emplace_back(msg); }, publish_timeout))
+        ;
+    return messages;
+}
+
+int stalled_signal_fd = -1;
+
+// Forks a producer that claims a record and then stalls while copying its message, which is on an inaccessible page; returns its pid once it has stalled
+pid_t forkStalledProducer(std::string const& name)
+{
+    int fds[2];
+    if (::pipe(fds) != 0)
+        throw std::runtime_error("pipe failed");
+    pid_t const pid = ::fork();
+    if (pid == 0) {
+        ::close(fds[0]);
+        stalled_signal_fd = fds[1];
+        struct sigaction sa{};
+        sa.sa_handler = [](int) {
+            char const c = 's';
+            [[maybe_unused]] auto const rc = ::write(stalled_signal_fd, &c, 1);
+            while (true)
+                ::pause();
+        };
+        ::sigaction(SIGSEGV, &sa, nullptr);
+        auto const page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        auto* const mem = static_cast<char*>(::mmap(nullptr, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        ::mprotect(mem + page, page, PROT_NONE);
+        YALF::ShmRing ring{ name };
+        ring.write(metadata(), std::string_view{ mem + page, 100 });
+        ::_exit(1);
+    }
+    ::close(fds[1]);
+    char c;
+    bool const stalled = ::read(fds[0], &c, 1) == 1;
+    ::close(fds[0]);
+    if (!stalled)
+        throw std::runtime_error("The producer did not stall");
+    return pid;
+}
+
+}
+
+YALF_TEST(producer_threads_share_the_ring)
+{
+    TempRing r{ 1 << 16 };
+    constexpr int threads = 4;
+    constexpr int per_thread = 20000;
+    std::atomic<int> producing{ threads };
+    std::vector<std::vector<int>> received(threads);
+    std::thread consumer{ [&] {
+        auto const consume = [&](YALF::EntryMetadata const& meta, std::string_view msg) {
+            auto const thread = static_cast<std::size_t>(std::get<std::int64_t>(meta.fields[0].value));
+            received[thread].push_back(std::stoi(std::string{ msg }));
+        };
+        while (true) {
+            bool const done = producing.load() == 0;
+            if (!r.ring->read(consume) && done)
+                break;
+        }
+    } };
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; t++) {
+        producers.emplace_back([&, t] {
+            for (int i = 0; i < per_thread; i++) {
+                std::array const fields{ YALF::kv("thread", t) };
+                auto const msg = std::to_string(i);
+                while (r.ring->write(metadata(fields), msg) == 0)
+                    std::this_thread::yield();
+            }
+            producing--;
+        });
+    }
+    for (auto& p : producers)
+        p.join();
+    consumer.join();
+    for (int t = 0; t < threads; t++) {
+        auto const& got = received[static_cast<std::size_t>(t)];
+        CHECK_EQ(got.size(), std::size_t{ per_thread });
+        CHECK(std::ranges::is_sorted(got));
+    }
+    CHECK_EQ(r.ring->skippedRecords(), std::uint64_t{ 0 });
+}
+
+YALF_TEST(record_of_a_stalled_producer_is_kept_until_it_dies)
+{
+    TempRing r{ 1 << 16 };
+    auto const pid = forkStalledProducer(r.name);
+    // Entries claimed after the stalled one wait behind it
+    r.ring->write(metadata(), "after");
+    CHECK(drain(*r.ring, 0ms).empty());
+    std::this_thread::sleep_for(50ms);
+    CHECK(drain(*r.ring, 0ms).empty());
+    CHECK_EQ(r.ring->skippedRecords(), std::uint64_t{ 0 });
+
+    ::kill(pid, SIGKILL);
+    ::waitpid(pid, nullptr, 0);
+    auto const messages = drain(*r.ring, 0ms);
+    CHECK_EQ(messages.size(), std::size_t{ 1 });
+    CHECK(!messages.empty() && messages[0] == "after");
+    CHECK_EQ(r.ring->skippedRecords(), std::uint64_t{ 1 });
+}
+
+YALF_TEST(skipped_space_is_reused_after_wrapping_around)
+{
+    TempRing r{ 4096 };
+    auto const pid = forkStalledProducer(r.name);
+    ::kill(pid, SIGKILL);
+    ::waitpid(pid, nullptr, 0);
+    CHECK(drain(*r.ring, 0ms).empty());
+    CHECK_EQ(r.ring->skippedRecords(), std::uint64_t{ 1 });
+    // Many laps of records of varying sizes, each of which needs padding at a different point
+    std::size_t read = 0;
+    for (int i = 0; i < 2000; i++) {
+        auto const msg = std::string(static_cast<std::size_t>(i % 300), 'x') + std::to_string(i);
+        if (r.ring->write(metadata(), msg) == 0) {
+            CHECK(false);
+            break;
+        }
+        auto const messages = drain(*r.ring);
+        read += messages.size();
+        CHECK(messages.size() == 1 && messages[0] == msg);
+    }
+    CHECK_EQ(read, std::size_t{ 2000 });
+}
+
+YALF_TEST(ring_is_created_private_and_capacity_is_checked)
+{
+    TempRing r{ 4096 };
+    struct stat st{};
+    auto const path = "/dev/shm" + r.name;
+    CHECK(::stat(path.c_str(), &st) == 0 && (st.st_mode & 0777) == 0600);
+    bool threw = false;
+    try {
+        YALF::ShmRing::create(r.name + ".big", std::uint64_t{ 4 } << 30);
+    }
+    catch (std::invalid_argument const&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+int main()
+{
+    return YALF::Test::testMain();
+}
@@ -0,0 +1,178 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+// Tests SyslogSink against a Unix datagram socket and a UDP socket bound by the test.
+#define YALF_IMPLEMENTATION
+#include "YALF.h"
+#include "YALF_SyslogSink.h"
+#include "tests/yalf_test.h"
+#include <netinet/in.h>
+#include <poll.h>
+
+namespace {
+
+// A datagram socket bound to a temporary Unix socket path, or to an ephemeral UDP port on the loopback interface
+struct Receiver
+{
+    int fd = -1;
+    std::string path;
+    std::uint16_t port = 0;
+
+    static Receiver unixSocket()
+    {
+        Receiver r;
+        r.path = (std::filesystem::temp_directory_path() / std::format("yalf_syslog_test.{}.sock", ::getpid())).string();
+        ::unlink(r.path.c_str());
+        r.fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, r.path.c_str(), r.path.size() + 1);
+        if (r.fd < 0 || ::bind(r.fd, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) != 0)
+            throw std::runtime_error(std::format("Failed to bind {}: {}", r.path, std::strerror(errno)));
+        return r;
+    }
+    static Receiver udpSocket()
+    {
+        Receiver r;
+        r.fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t size = sizeof(addr);
+        if (r.fd < 0 || ::bind(r.fd, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) != 0
+            || ::getsockname(r.fd, reinterpret_cast<sockaddr*>(&addr), &size) != 0)
+            throw std::runtime_error(std::format("Failed to bind a UDP socket: {}", std::strerror(errno)));
+        r.port = ntohs(addr.sin_port);
+        return r;
+    }
+    Receiver() = default;
+    Receiver(Receiver&& other) noexcept : fd(std::exchange(other.fd, -1)), path(std::move(other.path)), port(other.port) {}
+    ~Receiver()
+    {
+        if (this->fd >= 0)
+            ::close(this->fd);
+        if (!this->path.empty())
+            ::unlink(this->path.c_str());
+    }
+
+    // Every datagram that arrives within `timeout`
+    std::vector<std::string> receive(std::chrono::milliseconds timeout = std::chrono::milliseconds{ 200 })
+    {
+        std::vector<std::string> datagrams;
+        std::string buffer(65536, '\0');
+        pollfd pfd{ this->fd, POLLIN, 0 };
+        while (::poll(&pfd, 1, static_cast<int>(timeout.count())) > 0) {
+            auto const n = ::recv(this->fd, buffer.data(), buffer.size(), 0);
+            if (n < 0)
+                break;
+            datagrams.emplace_back(buffer.data(), static_cast<std::size_t>(n));
+        }
+        return datagrams;
+    }
+};
+
+YALF::EntryMetadata metadataAt(YALF::LogLevel level, std::string_view domain, std::source_location loc = std::source_location::current())
+{
+    return YALF::EntryMetadata{
+        .level = level,
+        .domain = domain,
+        .instance = std::nullopt,
+        .source_location = loc,
+        .timestamp = std::chrono::time_point_cast<YALF::LogEntryTimestampDuration>(YALF::LogEntryTimestampClock::now()),
+        .fields = {},
+    };
+}
+
+}
+
+YALF_TEST(header_and_structured_data)
+{
+    auto receiver = Receiver::unixSocket();
+    YALF::SyslogSink sink{ { .socket_path = receiver.path, .facility = 1, .app_name = "yalf test", .hostname = "test\thost" } };
+
+    std::array const fields{ YALF::kv("peer", "a\\b"), YALF::kv("", 5), YALF::kv("k=v]", true) };
+    auto const loc = std::source_location::current();
+    auto meta = metadataAt(YALF::LogLevel::Error, "Net Tcp", loc);
+    meta.instance = "c\"1]";
+    meta.suppressed = 3;
+    meta.fields = fields;
+    if constexpr (std::is_same_v<YALF::LogEntryTimestampClock, std::chrono::system_clock>) {
+        using namespace std::chrono;
+        meta.timestamp = time_point_cast<YALF::LogEntryTimestampDuration>(sys_days{ 2024y / March / 5 } + 6h + 7min + 8s + 123456us);
+    }
+    auto const expected_timestamp = std::format("{:%FT%T}Z", std::chrono::time_point_cast<std::chrono::microseconds>(YALF::toSystemTime(meta.timestamp)));
+    if constexpr (std::is_same_v<YALF::LogEntryTimestampClock, std::chrono::system_clock>)
+        CHECK(expected_timestamp.starts_with("2024-03-05T06:07:08"));
+    sink.log(meta, "hello world");
+
+    auto const datagrams = receiver.receive();
+    CHECK_EQ(datagrams.size(), 1u);
+    if (datagrams.size() != 1)
+        return;
+    // LOG_USER (1) * 8 + err (3); the MSGID and header fields have no spaces; PARAM-NAMEs are sanitized, values escaped
+    auto const expected = std::format("<11>1 {} test_host yalf_test {} Net_Tcp [yalf@32473 instance=\"c\\\"1\\]\" file=\"{}\" line=\"{}\" suppressed=\"3\" peer=\"a\\\\b\" _=\"5\" k_v_=\"true\"] hello world",
+        expected_timestamp, ::getpid(), loc.file_name(), loc.line());
+    CHECK_EQ(datagrams[0], expected);
+}
+
+YALF_TEST(empty_header_fields_and_truncation)
+{
+    auto receiver = Receiver::unixSocket();
+    YALF::SyslogSink sink{ { .socket_path = receiver.path, .facility = 16, .app_name = "app", .hostname = "host", .max_message_size = 64 } };
+    auto const loc = std::source_location::current();
+    sink.log(metadataAt(YALF::LogLevel::Debug, "", loc), std::string(200, 'x'));
+
+    auto const datagrams = receiver.receive();
+    CHECK_EQ(datagrams.size(), 1u);
+    if (datagrams.size() != 1)
+        return;
+    // LOG_LOCAL0 (16) * 8 + debug (7); an empty MSGID is "-"
+    CHECK_EQ(datagrams[0].size(), 64u);
+    CHECK(datagrams[0].starts_with("<135>1 "));
+    CHECK(datagrams[0].find(std::format(" host app {} - [yalf@32473 file=", ::getpid())) != std::string::npos);
+}
+
+YALF_TEST(udp_batches_until_full_or_flushed)
+{
+    auto receiver = Receiver::udpSocket();
+    YALF::SyslogSink sink{ { .host = "127.0.0.1", .port = receiver.port, .batch_size = 4 } };
+    auto const send = [&](int i) { sink.log(metadataAt(YALF::LogLevel::Warning, "Bulk"), std::format("entry {}", i)); };
+
+    for (int i = 0; i < 3; i++)
+        send(i);
+    CHECK_EQ(receiver.receive(std::chrono::milliseconds{ 100 }).size(), 0u);
+    send(3);
+    auto datagrams = receiver.receive();
+    CHECK_EQ(datagrams.size(), 4u);
+    for (std::size_t i = 0; i < datagrams.size(); i++)
+        CHECK(datagrams[i].ends_with(std::format("] entry {}", i)));
+
+    send(4);
+    send(5);
+    CHECK_EQ(receiver.receive(std::chrono::milliseconds{ 100 }).size(), 0u);
+    sink.flush();
+    datagrams = receiver.receive();
+    CHECK_EQ(datagrams.size(), 2u);
+    if (datagrams.size() == 2)
+        CHECK(datagrams[1].ends_with("] entry 5"));
+
+    // An empty batch sends nothing
+    sink.flush();
+    CHECK_EQ(receiver.receive(std::chrono::milliseconds{ 100 }).size(), 0u);
+}
+
+YALF_TEST(rejects_empty_batches)
+{
+    bool threw = false;
+    try {
+        YALF::SyslogSink sink{ { .socket_path = "/nonexistent", .batch_size = 0 } };
+    }
+    catch (std::invalid_argument const&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+int main()
+{
+    return YALF::Test::testMain();
+}
@@ -0,0 +1,321 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+// Tests TcpClientSink against a loopback collector run by the test: a slow collector, one that disconnects, and spilling while it is down.
+#define YALF_IMPLEMENTATION
+#define YALF_ENABLE_STATS
+#include "YALF.h"
+#include "YALF_TcpClientSink.h"
+#include "tests/yalf_test.h"
+#include <arpa/inet.h>
+#include <fstream>
+#include <numeric>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+struct LoopbackServer
+{
+    int listen_fd = -1;
+    std::uint16_t port = 0;
+
+    // Listens on an ephemeral port, or on `port_` if it is set
+    explicit LoopbackServer(std::uint16_t port_ = 0, int receive_buffer = 0)
+    {
+        this->listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int const one = 1;
+        ::setsockopt(this->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        // Inherited by accepted sockets, so that a collector that does not read pushes back quickly
+        if (receive_buffer != 0)
+            ::setsockopt(this->listen_fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port_);
+        socklen_t size = sizeof(addr);
+        if (::bind(this->listen_fd, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) != 0 || ::listen(this->listen_fd, 4) != 0
+            || ::getsockname(this->listen_fd, reinterpret_cast<sockaddr*>(&addr), &size) != 0)
+            throw std::runtime_error(std::format("Failed to listen: {}", std::strerror(errno)));
+        this->port = ntohs(addr.sin_port);
+    }
+    ~LoopbackServer()
+    {
+        ::close(this->listen_fd);
+    }
+
+    // Accepts one connection and reads from it until it has `max_bytes`, the peer closes, or nothing arrives for `idle`; then closes it.
+    std::string serveOne(std::chrono::milliseconds idle, std::size_t max_bytes = SIZE_MAX, std::chrono::milliseconds delay = 0ms)
+    {
+        pollfd pfd{ this->listen_fd, POLLIN, 0 };
+        if (::poll(&pfd, 1, 5000) <= 0)
+            return {};
+        int const conn = ::accept4(this->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0)
+            return {};
+        std::this_thread::sleep_for(delay);
+        std::string data;
+        std::array<char, 4096> buf;
+        pollfd cfd{ conn, POLLIN, 0 };
+        while (data.size() < max_bytes && ::poll(&cfd, 1, static_cast<int>(idle.count())) > 0) {
+            auto const n = ::recv(conn, buf.data(), std::min(buf.size(), max_bytes - data.size()), 0);
+            if (n <= 0)
+                break;
+            data.append(buf.data(), static_cast<std::size_t>(n));
+        }
+        ::close(conn);
+        return data;
+    }
+};
+
+// Entries are "entry N" plus padding, one per line
+std::string entryText(int i)
+{
+    return std::format("entry {} {}", i, std::string(static_cast<std::size_t>(i % 50), '.'));
+}
+
+// Parses the complete lines of `data`; a line that is not an entry is reported as -1
+std::vector<int> parseEntries(std::string_view data)
+{
+    std::vector<int> entries;
+    while (true) {
+        auto const nl = data.find('\n');
+        if (nl == std::string_view::npos)
+            break;
+        auto const line = data.substr(0, nl);
+        data.remove_prefix(nl + 1);
+        int i = -1;
+        if (line.starts_with("entry ")) {
+            auto const rest = line.substr(6);
+            i = std::atoi(std::string{ rest.substr(0, rest.find(' ')) }.c_str());
+        }
+        entries.push_back(line == entryText(i) ? i : -1);
+    }
+    return entries;
+}
+
+std::unique_ptr<YALF::TcpClientSink> makeSink(YALF::TcpClientOptions options)
+{
+    auto sink = YALF::makeTcpClientSink(std::move(options));
+    sink->setFormat("%x\n");
+    return sink;
+}
+
+void logEntry(YALF::Sink& sink, int i)
+{
+    YALF::EntryMetadata const meta{
+        .level = YALF::LogLevel::Info,
+        .domain = "Test",
+        .instance = std::nullopt,
+        .source_location = std::source_location::current(),
+        .timestamp = std::chrono::time_point_cast<YALF::LogEntryTimestampDuration>(YALF::LogEntryTimestampClock::now()),
+        .fields = {},
+    };
+    sink.log(meta, entryText(i));
+}
+
+bool strictlyIncreasing(std::vector<int> const& entries)
+{
+    return std::ranges::adjacent_find(entries, std::greater_equal<>{}) == entries.end();
+}
+
+// A port with nothing listening on it
+std::uint16_t deadPort()
+{
+    LoopbackServer const server;
+    return server.port;
+}
+
+std::filesystem::path spillPath()
+{
+    auto path = std::filesystem::temp_directory_path() / std::format("yalf_tcp_client_test.{}.spill", ::getpid());
+    std::filesystem::remove(path);
+    return path;
+}
+
+std::string readFile(std::filesystem::path const& path)
+{
+    std::ifstream in{ path, std::ios::binary };
+    return std::string{ std::istreambuf_iterator<char>{ in }, {} };
+}
+
+}
+
+YALF_TEST(slow_server_neither_blocks_nor_loses_entries)
+{
+    constexpr int Count = 20000;
+    LoopbackServer server{ 0, 4096 };
+    std::string received;
+    // Accepts at once, but does not read for a while
+    std::thread collector{ [&] { received = server.serveOne(1000ms, SIZE_MAX, 500ms); } };
+    auto sink = makeSink({ .port = server.port, .max_buffer_bytes = 16 << 20, .min_backoff = 10ms });
+
+    auto const start = std::chrono::steady_clock::now();
+    for (int i = 0; i < Count; i++)
+        logEntry(*sink, i);
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    // Far more than the socket buffers hold, so most of it waited in the sink's buffer rather than in the log calls
+    CHECK(elapsed < 500ms);
+    collector.join();
+    sink.reset();
+
+    auto const entries = parseEntries(received);
+    CHECK_EQ(entries.size(), static_cast<std::size_t>(Count));
+    std::vector<int> expected(Count);
+    std::iota(expected.begin(), expected.end(), 0);
+    CHECK(entries == expected);
+}
+
+YALF_TEST(server_disconnect_reconnects_without_duplicates)
+{
+    LoopbackServer server{ 0, 4096 };
+    std::string first;
+    std::string second;
+    // Drops the first connection part way through an entry, with unread data, then serves a second one
+    std::thread collector{ [&] {
+        first = server.serveOne(1000ms, 1000);
+        second = server.serveOne(1000ms);
+    } };
+    auto sink = makeSink({ .port = server.port, .min_backoff = 10ms, .max_backoff = 50ms });
+    for (int i = 0; i < 200; i++) {
+        logEntry(*sink, i);
+        std::this_thread::sleep_for(1ms);
+    }
+    // Reconnected by now, so these are not lost with the first connection
+    std::this_thread::sleep_for(200ms);
+    for (int i = 200; i < 300; i++)
+        logEntry(*sink, i);
+    sink.reset();
+    collector.join();
+
+    auto const before = parseEntries(first);
+    auto const after = parseEntries(second);
+    CHECK(!before.empty());
+    CHECK(!after.empty());
+    // The entry that was cut off is sent again in full, so every line of the second connection is whole
+    CHECK(std::ranges::find(after, -1) == after.end());
+    CHECK(strictlyIncreasing(before));
+    CHECK(strictlyIncreasing(after));
+    if (!before.empty() && !after.empty())
+        CHECK(after.front() > before.back());
+    for (int i = 200; i < 300; i++)
+        CHECK(std::ranges::find(after, i) != after.end());
+}
+
+YALF_TEST(spill_then_replay)
+{
+    auto const path = spillPath();
+    auto const port = deadPort();
+    constexpr int Count = 2000;
+    std::uint64_t dropped = 0;
+    {
+        // Small enough that most entries go to the spill file while the collector is down
+        auto sink = makeSink({ .port = port, .max_buffer_bytes = 4096, .spill_path = path, .min_backoff = 10ms, .linger = 50ms });
+        for (int i = 0; i < Count; i++) {
+            logEntry(*sink, i);
+            if (i % 10 == 0)
+                std::this_thread::sleep_for(100us);
+        }
+        // Entries are only dropped by log calls that find the buffer full, as the spill file has room for all of them
+        dropped = sink->getStats().dropped;
+    }
+    auto const spilled = readFile(path);
+    CHECK(spilled.size() > 4096u);
+
+    LoopbackServer server{ port };
+    std::string received;
+    std::thread collector{ [&] { received = server.serveOne(500ms); } };
+    auto sink = makeSink({ .port = port, .spill_path = path, .min_backoff = 10ms });
+    logEntry(*sink, Count);
+    collector.join();
+    sink.reset();
+
+    // Everything spilled, in order, then what was logged after
+    auto const entries = parseEntries(received);
+    CHECK(std::ranges::find(entries, -1) == entries.end());
+    CHECK(strictlyIncreasing(entries));
+    CHECK_EQ(entries.size(), static_cast<std::size_t>(Count) - dropped + 1);
+    CHECK(!entries.empty() && entries.back() == Count);
+    CHECK_EQ(std::filesystem::file_size(path), 0u);
+    std::filesystem::remove(path);
+}
+
+YALF_TEST(torn_spill_tail_is_trimmed)
+{
+    auto const path = spillPath();
+    std::string records;
+    YALF::detail::appendSpillRecord(records, entryText(0) + "\n");
+    YALF::detail::appendSpillRecord(records, entryText(1) + "\n");
+    {
+        // A record cut off by a crash: its size says more than is there
+        std::string torn;
+        YALF::detail::appendSpillRecord(torn, entryText(2) + "\n");
+        std::ofstream{ path, std::ios::binary } << records << torn.substr(0, torn.size() - 3);
+    }
+    {
+        auto sink = makeSink({ .port = deadPort(), .spill_path = path, .linger = 10ms });
+    }
+    CHECK(readFile(path) == records);
+
+    // Sizes that disagree mean the rest cannot be trusted either
+    {
+        std::string mangled;
+        YALF::detail::appendSpillRecord(mangled, entryText(2) + "\n");
+        mangled[mangled.size() - 1] ^= 0x7F;
+        std::ofstream{ path, std::ios::binary | std::ios::app } << mangled << records;
+    }
+    {
+        auto sink = makeSink({ .port = deadPort(), .spill_path = path, .linger = 10ms });
+    }
+    CHECK(readFile(path) == records);
+
+    LoopbackServer server;
+    std::string received;
+    std::thread collector{ [&] { received = server.serveOne(300ms); } };
+    {
+        auto sink = makeSink({ .port = server.port, .spill_path = path });
+        collector.join();
+    }
+    CHECK_EQ(received, entryText(0) + "\n" + entryText(1) + "\n");
+    std::filesystem::remove(path);
+}
+
+YALF_TEST(replay_resumes_after_disconnect_without_duplicates)
+{
+    constexpr int Count = 20000;
+    auto const path = spillPath();
+    {
+        std::string records;
+        for (int i = 0; i < Count; i++)
+            YALF::detail::appendSpillRecord(records, entryText(i) + "\n");
+        std::ofstream{ path, std::ios::binary } << records;
+    }
+    LoopbackServer server{ 0, 4096 };
+    std::string first;
+    std::string second;
+    // Drops the connection part way through replaying the spill file
+    std::thread collector{ [&] {
+        first = server.serveOne(1000ms, 50000);
+        second = server.serveOne(1000ms);
+    } };
+    {
+        auto sink = makeSink({ .port = server.port, .spill_path = path, .min_backoff = 10ms, .max_backoff = 50ms });
+        collector.join();
+    }
+
+    auto const before = parseEntries(first);
+    auto const after = parseEntries(second);
+    CHECK(!before.empty());
+    CHECK(std::ranges::find(after, -1) == after.end());
+    CHECK(strictlyIncreasing(after));
+    // Entries the kernel had accepted for the dropped connection are lost, but none is sent twice
+    if (!before.empty() && !after.empty())
+        CHECK(after.front() > before.back());
+    CHECK(!after.empty() && after.back() == Count - 1);
+    CHECK_EQ(std::filesystem::file_size(path), 0u);
+    std::filesystem::remove(path);
+}
+
+int main()
+{
+    return YALF::Test::testMain();
+}
@@ -0,0 +1,212 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+// Tests TcpServerSink with loopback clients run by the test: filter rules sent by clients, and a client that does not read.
+#define YALF_IMPLEMENTATION
+#define YALF_ENABLE_STATS
+#include "YALF.h"
+#include "YALF_TcpServerSink.h"
+#include "tests/yalf_test.h"
+#include <arpa/inet.h>
+#include <poll.h>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+struct TestClient
+{
+    int fd = -1;
+    std::string received;
+
+    // Connects to the sink, with a small receive buffer if `receive_buffer` is set, so that a client that does not read pushes back quickly
+    explicit TestClient(std::uint16_t port, int receive_buffer = 0)
+    {
+        this->fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (receive_buffer != 0)
+            ::setsockopt(this->fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if (::connect(this->fd, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) != 0)
+            throw std::runtime_error(std::format("Failed to connect: {}", std::strerror(errno)));
+    }
+    ~TestClient()
+    {
+        ::close(this->fd);
+    }
+    TestClient(TestClient const&) = delete;
+    TestClient& operator=(TestClient const&) = delete;
+
+    void send(std::string_view text) const
+    {
+        if (::send(this->fd, text.data(), text.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(text.size()))
+            throw std::runtime_error("Failed to send rules");
+    }
+
+    // Reads until `text` has been received, returning false if nothing arrives for `idle`
+    bool readUntil(std::string_view text, std::chrono::milliseconds idle = 5s)
+    {
+        std::array<char, 4096> buf;
+        pollfd pfd{ this->fd, POLLIN, 0 };
+        while (this->received.find(text) == std::string::npos) {
+            if (::poll(&pfd, 1, static_cast<int>(idle.count())) <= 0)
+                return false;
+            auto const n = ::recv(this->fd, buf.data(), buf.size(), 0);
+            if (n <= 0)
+                return false;
+            this->received.append(buf.data(), static_cast<std::size_t>(n));
+        }
+        return true;
+    }
+};
+
+// Clients are accepted and their rules applied by the sink's worker thread, so the tests wait for their effect
+template <class Pred>
+bool waitUntil(Pred pred)
+{
+    auto const deadline = std::chrono::steady_clock::now() + 5s;
+    while (!pred()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+YALF::EntryMetadata metadata(YALF::LogLevel level, std::string_view domain)
+{
+    return YALF::EntryMetadata{
+        .level = level,
+        .domain = domain,
+        .instance = std::nullopt,
+        .source_location = std::source_location::current(),
+        .timestamp = std::chrono::time_point_cast<YALF::LogEntryTimestampDuration>(YALF::LogEntryTimestampClock::now()),
+        .fields = {},
+    };
+}
+
+std::unique_ptr<YALF::TcpServerSink> makeSink(YALF::TcpServerOptions options = {})
+{
+    auto sink = YALF::makeTcpServerSink(std::move(options));
+    sink->setFormat("%x\n");
+    return sink;
+}
+
+}
+
+YALF_TEST(check_filter_accepts_only_what_some_client_wants)
+{
+    auto const sink = makeSink();
+    auto const info_net = metadata(YALF::LogLevel::Info, "Net");
+    auto const debug_net = metadata(YALF::LogLevel::Debug, "Net");
+    auto const debug_disk = metadata(YALF::LogLevel::Debug, "Disk");
+    auto const warning_disk = metadata(YALF::LogLevel::Warning, "Disk");
+    CHECK(!sink->checkFilter(warning_disk));
+    {
+        TestClient client{ sink->getPort() };
+        // Until it sends rules a client gets everything
+        CHECK(waitUntil([&] { return sink->checkFilter(debug_disk); }));
+
+        client.send("Warning Net=Debug\n");
+        CHECK(waitUntil([&] { return !sink->checkFilter(debug_disk); }));
+        CHECK(sink->checkFilter(debug_net));
+        CHECK(sink->checkFilter(info_net));
+        CHECK(!sink->checkFilter(debug_disk));
+        CHECK(sink->checkFilter(warning_disk));
+
+        // The sink's own filter caps what any client gets
+        sink->setDefaultLogLevel(YALF::LogLevel::Info);
+        CHECK(!sink->checkFilter(debug_net));
+        sink->setDefaultLogLevel(YALF::LogLevel::Noise);
+
+        // Only the entries that the client wants are sent to it
+        sink->log(debug_disk, "skipped");
+        sink->log(debug_net, "sent");
+        CHECK(client.readUntil("sent\n"));
+        CHECK(client.received.find("skipped") == std::string::npos);
+    }
+    // With no clients left nothing is wanted; a client that has closed is only noticed once sending to it fails
+    CHECK(waitUntil([&] {
+        sink->log(warning_disk, "after close");
+        return !sink->checkFilter(warning_disk);
+    }));
+}
+
+YALF_TEST(invalid_rules_keep_the_previous_ones)
+{
+    auto const sink = makeSink();
+    TestClient client{ sink->getPort() };
+    CHECK(waitUntil([&] { return sink->checkFilter(metadata(YALF::LogLevel::Warning, "Disk")); }));
+    // Split across sends, with a CRLF line ending, and a wildcard domain
+    client.send("Error Ne");
+    client.send("t.*=Debug\r\n");
+    CHECK(waitUntil([&] { return !sink->checkFilter(metadata(YALF::LogLevel::Warning, "Disk")); }));
+    CHECK(sink->checkFilter(metadata(YALF::LogLevel::Debug, "Net.Tcp")));
+    CHECK(sink->checkFilter(metadata(YALF::LogLevel::Error, "Disk")));
+
+    // Lines with an unknown level or a missing one are ignored as a whole
+    client.send("Noise Net.*=Loud\n");
+    client.send("Noise Disk=\n");
+    std::this_thread::sleep_for(100ms);
+    CHECK(!sink->checkFilter(metadata(YALF::LogLevel::Warning, "Disk")));
+    CHECK(sink->checkFilter(metadata(YALF::LogLevel::Debug, "Net.Tcp")));
+    sink->log(metadata(YALF::LogLevel::Warning, "Disk"), "not sent");
+
+    client.send("Warning Net.*=Debug\n");
+    CHECK(waitUntil([&] { return sink->checkFilter(metadata(YALF::LogLevel::Warning, "Disk")); }));
+    CHECK(!sink->checkFilter(metadata(YALF::LogLevel::Info, "Disk")));
+    CHECK(sink->checkFilter(metadata(YALF::LogLevel::Debug, "Net.Tcp")));
+    sink->log(metadata(YALF::LogLevel::Warning, "Disk"), "sent");
+    CHECK(client.readUntil("sent\n"));
+    CHECK(client.received == "sent\n");
+}
+
+YALF_TEST(client_that_does_not_read_is_told_how_many_entries_were_dropped)
+{
+    auto const sink = makeSink({ .client_buffer_bytes = 4096 });
+    TestClient client{ sink->getPort(), 4096 };
+    auto const meta = metadata(YALF::LogLevel::Info, "Test");
+    CHECK(waitUntil([&] { return sink->checkFilter(meta); }));
+    auto const entryText = [](int i) { return std::format("entry {} {}", i, std::string(100, '.')); };
+
+    int logged = 0;
+    while (sink->getStats().dropped < 100 && logged < 1'000'000)
+        sink->log(meta, entryText(logged++));
+    CHECK(sink->getStats().dropped >= 100);
+    // Once the client reads again, the next entry that fits is preceded by the note
+    for (int attempt = 0; attempt < 100; attempt++) {
+        sink->log(meta, entryText(logged++));
+        if (client.readUntil(entryText(logged - 1) + "\n", 200ms))
+            break;
+    }
+
+    std::uint64_t received = 0;
+    std::uint64_t reported = 0;
+    std::size_t notes = 0;
+    std::string_view data = client.received;
+    for (auto nl = data.find('\n'); nl != std::string_view::npos; nl = data.find('\n')) {
+        std::string const line{ data.substr(0, nl) };
+        data.remove_prefix(nl + 1);
+        unsigned long long n = 0;
+        if (std::sscanf(line.c_str(), "-- %llu entries dropped --", &n) == 1) {
+            reported += n;
+            notes++;
+        }
+        else if (line.starts_with("entry ")) {
+            received++;
+        }
+        else {
+            CHECK_EQ(line, std::string{ "an entry or a note" });
+        }
+    }
+    CHECK(notes != 0);
+    CHECK_EQ(reported, sink->getStats().dropped);
+    CHECK_EQ(received + reported, static_cast<std::uint64_t>(logged));
+    CHECK(data.empty());
+}
+
+int main()
+{
+    return YALF::Test::testMain();
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+// A minimal harness for the standalone test programs in this directory.
+// Each program defines its tests with YALF_TEST, and returns testMain() from main(), which runs them and exits non-zero if any CHECK failed.
+#include <cstdio>
+#include <exception>
+#include <format>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace YALF::Test {
+
+struct TestCase
+{
+    char const* name;
+    std::function<void()> body;
+};
+
+inline std::vector<TestCase>& registry()
+{
+    static std::vector<TestCase> tests;
+    return tests;
+}
+inline int& failures()
+{
+    static int count = 0;
+    return count;
+}
+
+struct Registrar
+{
+    Registrar(char const* name, std::function<void()> body) { registry().push_back(TestCase{ name, std::move(body) }); }
+};
+
+inline void fail(char const* file, int line, std::string const& what)
+{
+    std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", file, line, what.c_str());
+    failures()++;
+}
+
+inline int testMain()
+{
+    for (auto const& test : registry()) {
+        int const before = failures();
+        try {
+            test.body();
+        }
+        catch (std::exception const& e) {
+            std::fprintf(stderr, "%s: threw %s\n", test.name, e.what());
+            failures()++;
+        }
+        std::printf("%s %s\n", failures() == before ? "PASS" : "FAIL", test.name);
+    }
+    return failures() == 0 ? 0 : 1;
+}
+
+}
+
+#define YALF_TEST_CONCAT2(a, b) a##b
+#define YALF_TEST_CONCAT(a, b) YALF_TEST_CONCAT2(a, b)
+#define YALF_TEST(name) \
+    static void name(); \
+    static YALF::Test::Registrar const YALF_TEST_CONCAT(yalf_test_registrar_, name){ #name, &name }; \
+    static void name()
+
+#define CHECK(cond) \
+    do { if (!(cond)) YALF::Test::fail(__FILE__, __LINE__, #cond); } while (false)
+// Also prints both values, which must be formattable
+#define CHECK_EQ(a, b) \
+    do { \
+        auto const& yalf_a_ = (a); \
+        auto const& yalf_b_ = (b); \
+        if (!(yalf_a_ == yalf_b_)) \
+            YALF::Test::fail(__FILE__, __LINE__, std::format("{} == {} ({} vs {})", #a, #b, yalf_a_, yalf_b_)); \
+    } while (false)
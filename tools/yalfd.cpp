@@ -0,0 +1,228 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+//
+// yalfd: Consumes the shared-memory ring that ShmSink writes to, and passes the entries to sinks on behalf of the logging processes.
+//
+// Usage: yalfd [options]
+//   --name <Name>       Name of the shared memory object (default: /yalf)
+//   --size <Bytes>      Capacity of the ring, a power of 2 up to 2G, with an optional K, M, or G suffix (default: 64M)
+//   --mode <Octal>      Permissions of the shared memory object if it is created (default: 600); every logging process needs read and write access
+//   --publish-timeout <Milliseconds>
+//                       After waiting this long for a producer to finish writing an entry, skip the entry if the producer no longer exists (default: 1000)
+//   --file <Path>       Append the formatted entries to this file (FileSink)
+//   --format <Format>   Format string for --file and --console (see the README's Format String Reference)
+//   --json <Path>       Append the entries to this file as JSON Lines (JsonLinesSink)
+//   --pb <Path>         Append the entries to this protobuf log file (PbFileSink, readable by yalfq)
+//   --pb-schema <V1|V2> Schema of the --pb file (default: V1)
+//   --console           Write the formatted entries to stdout (ConsoleSink)
+//   --level <Level>     Only entries of this level or more severe (eg. Warning)
+// An existing compatible ring is reused, so entries left in it by a previous yalfd are not lost.
+// Stops on SIGINT or SIGTERM, after draining the entries that were claimed before the signal, even while producers keep writing.
+#include "YALF_JsonLinesSink.h"
+#include "YALF_PbFileSink.h"
+#include "YALF_ShmSink.h"
+#include <charconv>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+
+namespace {
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+std::optional<std::uint64_t> parseSize(std::string_view str)
+{
+    std::uint64_t value = 0;
+    auto const [p, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (ec != std::errc{})
+        return std::nullopt;
+    std::string_view const suffix{ p, static_cast<std::size_t>(str.data() + str.size() - p) };
+    if (suffix == "K")
+        value <<= 10;
+    else if (suffix == "M")
+        value <<= 20;
+    else if (suffix == "G")
+        value <<= 30;
+    else if (!suffix.empty())
+        return std::nullopt;
+    return value;
+}
+
+int usage(char const* argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [--name N] [--size Bytes] [--mode Octal] [--publish-timeout Ms] [--file Path] [--format F] [--json Path] [--pb Path] [--pb-schema V1|V2] [--console] [--level L]\n";
+    return 2;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string name = "/yalf";
+    std::uint64_t size = 64 << 20;
+    mode_t mode = 0600;
+    std::chrono::milliseconds publish_timeout{ 1000 };
+    std::optional<std::filesystem::path> file_path;
+    std::optional<std::filesystem::path> json_path;
+    std::optional<std::filesystem::path> pb_path;
+    YALF::PbSchema pb_schema = YALF::PbSchema::V1;
+    std::string fmt = "%Y-%m-%d %H:%M:%S %F:%l %D[%I] %L:  %N%x%K%n";
+    bool console = false;
+    YALF::LogLevel level = YALF::LogLevel::Noise;
+    for (int i = 1; i < argc; i++) {
+        std::string_view const arg = argv[i];
+        auto value = [&]() -> std::optional<std::string_view> {
+            if (i + 1 >= argc)
+                return std::nullopt;
+            return std::string_view{ argv[++i] };
+        };
+        if (arg == "--name") {
+            auto const v = value();
+            if (!v)
+                return usage(argv[0]);
+            name = std::string{ *v };
+        }
+        else if (arg == "--size") {
+            auto const v = value();
+            auto const s = v ? parseSize(*v) : std::nullopt;
+            if (!s)
+                return usage(argv[0]);
+            size = *s;
+        }
+        else if (arg == "--mode" || arg == "--publish-timeout") {
+            auto const v = value();
+            if (!v)
+                return usage(argv[0]);
+            unsigned long n = 0;
+            auto const [p, ec] = std::from_chars(v->data(), v->data() + v->size(), n, arg == "--mode" ? 8 : 10);
+            if (ec != std::errc{} || p != v->data() + v->size())
+                return usage(argv[0]);
+            if (arg == "--mode") {
+                if (n > 0777)
+                    return usage(argv[0]);
+                mode = static_cast<mode_t>(n);
+            }
+            else {
+                publish_timeout = std::chrono::milliseconds{ n };
+            }
+        }
+        else if (arg == "--file" || arg == "--json" || arg == "--pb") {
+            auto const v = value();
+            if (!v)
+                return usage(argv[0]);
+            // Absolute, as the sink factories create the file's parent directory
+            (arg == "--file" ? file_path : arg == "--json" ? json_path : pb_path) = std::filesystem::absolute(std::filesystem::path{ *v });
+        }
+        else if (arg == "--pb-schema") {
+            auto const v = value();
+            if (v == "V1" || v == "v1")
+                pb_schema = YALF::PbSchema::V1;
+            else if (v == "V2" || v == "v2")
+                pb_schema = YALF::PbSchema::V2;
+            else
+                return usage(argv[0]);
+        }
+        else if (arg == "--format") {
+            auto const v = value();
+            if (!v)
+                return usage(argv[0]);
+            fmt = std::string{ *v };
+        }
+        else if (arg == "--console") {
+            console = true;
+        }
+        else if (arg == "--level") {
+            auto const v = value();
+            auto const l = v ? YALF::parseLogLevelString(*v) : std::nullopt;
+            if (!l)
+                return usage(argv[0]);
+            level = *l;
+        }
+        else {
+            return usage(argv[0]);
+        }
+    }
+    if (!file_path && !json_path && !pb_path && !console)
+        return usage(argv[0]);
+
+    // The ring outlives the sinks, as the source locations it gives them refer to strings it owns
+    std::unique_ptr<YALF::ShmRing> ring;
+    std::vector<std::unique_ptr<YALF::Sink>> sinks;
+    try {
+        ring = YALF::ShmRing::create(name, size, mode);
+        if (file_path) {
+            auto sink = YALF::makeFileSink(*file_path);
+            sink->setFormat(fmt);
+            sinks.push_back(std::move(sink));
+        }
+        if (console) {
+            auto sink = YALF::makeConsoleSink();
+            sink->setFormat(fmt);
+            sinks.push_back(std::move(sink));
+        }
+        if (json_path)
+            sinks.push_back(YALF::makeJsonLinesSink(*json_path));
+        if (pb_path)
+            sinks.push_back(YALF::makePbFileSink(*pb_path, pb_schema));
+    }
+    catch (std::exception const& e) {
+        std::cerr << argv[0] << ": " << e.what() << "\n";
+        return 1;
+    }
+    for (auto& sink : sinks)
+        sink->setDefaultLogLevel(level);
+    std::signal(SIGINT, [](int) { stop_requested = 1; });
+    std::signal(SIGTERM, [](int) { stop_requested = 1; });
+
+    auto& header = ring->header();
+    header.consumer_pid.store(static_cast<std::int32_t>(::getpid()), std::memory_order_relaxed);
+    auto const write = [&](YALF::EntryMetadata const& meta, std::string_view msg) {
+        for (auto const& sink : sinks) {
+            if (sink->checkFilter(meta))
+                sink->log(meta, msg);
+        }
+    };
+
+    // Poll the ring, backing off while it is empty; producers never wait for us, so they do not need waking.
+    auto idle = std::chrono::microseconds{ 50 };
+    std::uint64_t reported_skips = 0;
+    auto const reportSkips = [&] {
+        if (ring->skippedRecords() != reported_skips) {
+            std::cerr << argv[0] << ": skipped " << ring->skippedRecords() - reported_skips << " entries whose producer died before finishing them\n";
+            reported_skips = ring->skippedRecords();
+        }
+    };
+    while (!stop_requested) {
+        header.heartbeat.store(std::chrono::time_point_cast<YALF::LogEntryTimestampDuration>(YALF::LogEntryTimestampClock::now()).time_since_epoch().count(), std::memory_order_relaxed);
+        std::size_t n = 0;
+        while (n < 4096 && ring->read(write, publish_timeout))
+            n++;
+        reportSkips();
+        if (n != 0) {
+            idle = std::chrono::microseconds{ 50 };
+            continue;
+        }
+        for (auto& sink : sinks)
+            sink->flush();
+        std::this_thread::sleep_for(idle);
+        idle = std::min(idle * 2, std::chrono::microseconds{ 10000 });
+    }
+    // Drain what was claimed before the signal, but not what producers keep adding meanwhile.
+    // An entry that is still being written is waited for as long as a dead producer's would be.
+    auto const end = header.write_pos.load(std::memory_order_acquire);
+    auto const deadline = std::chrono::steady_clock::now() + publish_timeout + std::chrono::milliseconds{ 100 };
+    while (header.read_pos.load(std::memory_order_relaxed) < end) {
+        if (ring->read(write, publish_timeout))
+            continue;
+        if (std::chrono::steady_clock::now() >= deadline)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    }
+    reportSkips();
+    // Producers fall back once the heartbeat is stale
+    header.heartbeat.store(0, std::memory_order_relaxed);
+    header.consumer_pid.store(0, std::memory_order_relaxed);
+    for (auto& sink : sinks)
+        sink->flush();
+    return 0;
+}
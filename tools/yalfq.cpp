@@ -0,0 +1,137 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+//
+// yalfq: Filters and prints the entries of protobuf log files written by PbFileSink.
+//
+// Usage: yalfq [options] <file.pb>...
+//   --level <Level>     Only entries of this level or more severe (eg. Warning)
+//   --domain <Domain>   Only entries from this domain
+//   --from <Time>       Only entries at or after this time
+//   --to <Time>         Only entries at or before this time
+//   --grep <Substring>  Only entries whose message contains this substring
+//   --format <Format>   Format string used to print each entry (see the README's Format String Reference)
+//   --threads <N>       Number of decoding threads (default: all cores)
+//   --stats             Print entry counts to stderr
+// Times are either YYYY-MM-DDTHH:MM:SS[.ffffff] in the clock's time zone (usually UTC) or @<seconds since the clock's epoch>.
+#include "YALF_PbQuery.h"
+#include <charconv>
+#include <cstdio>
+#include <iostream>
+
+namespace {
+
+std::optional<YALF::LogEntryTimestamp> parseTime(std::string_view str)
+{
+    using namespace std::chrono;
+    if (str.starts_with('@')) {
+        double seconds = 0;
+        auto const [p, ec] = std::from_chars(str.data() + 1, str.data() + str.size(), seconds);
+        if (ec != std::errc{} || p != str.data() + str.size())
+            return std::nullopt;
+        return YALF::LogEntryTimestamp{ duration_cast<YALF::LogEntryTimestampDuration>(duration<double>{ seconds }) };
+    }
+    int y, mo, d, h = 0, mi = 0;
+    double s = 0;
+    std::string const tmp{ str };
+    if (std::sscanf(tmp.c_str(), "%d-%d-%dT%d:%d:%lf", &y, &mo, &d, &h, &mi, &s) < 3)
+        return std::nullopt;
+    year_month_day const ymd{ year{ y }, month{ static_cast<unsigned>(mo) }, day{ static_cast<unsigned>(d) } };
+    if (!ymd.ok())
+        return std::nullopt;
+    auto const since_epoch = sys_days{ ymd }.time_since_epoch() + hours{ h } + minutes{ mi } + duration<double>{ s };
+    return YALF::LogEntryTimestamp{ duration_cast<YALF::LogEntryTimestampDuration>(since_epoch) };
+}
+
+int usage(char const* argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [--level L] [--domain D] [--from T] [--to T] [--grep S] [--format F] [--threads N] [--stats] <file.pb>...\n";
+    return 2;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    YALF::PbQuery query;
+    std::string fmt = "%Y-%m-%d %H:%M:%S %F:%l %D[%I] %L:  %x%n";
+    unsigned threads = 0;
+    bool print_stats = false;
+    std::vector<std::filesystem::path> files;
+    for (int i = 1; i < argc; i++) {
+        std::string_view const arg = argv[i];
+        auto value = [&]() -> std::optional<std::string_view> {
+            if (i + 1 >= argc)
+                return std::nullopt;
+            return std::string_view{ argv[++i] };
+        };
+        if (arg == "--level") {
+            auto const v = value();
+            auto const level = v ? YALF::parseLogLevelString(*v) : std::nullopt;
+            if (!level)
+                return usage(argv[0]);
+            query.level = *level;
+        }
+        else if (arg == "--domain") {
+            auto const v = value();
+            if (!v)
+                return usage(argv[0]);
+            query.domain = std::string{ *v };
+        }
+        else if (arg == "--from" || arg == "--to") {
+            auto const v = value();
+            auto const t = v ? parseTime(*v) : std::nullopt;
+            if (!t)
+                return usage(argv[0]);
+            (arg == "--from" ? query.from : query.to) = t;
+        }
+        else if (arg == "--grep") {
+            auto const v = value();
+            if (!v)
+                return usage(argv[0]);
+            query.contains = std::string{ *v };
+        }
+        else if (arg == "--format") {
+            auto const v = value();
+            if (!v)
+                return usage(argv[0]);
+            fmt = std::string{ *v };
+        }
+        else if (arg == "--threads") {
+            auto const v = value();
+            if (!v || std::from_chars(v->data(), v->data() + v->size(), threads).ec != std::errc{})
+                return usage(argv[0]);
+        }
+        else if (arg == "--stats") {
+            print_stats = true;
+        }
+        else if (arg.starts_with("--")) {
+            return usage(argv[0]);
+        }
+        else {
+            files.emplace_back(arg);
+        }
+    }
+    if (files.empty())
+        return usage(argv[0]);
+
+    std::ios_base::sync_with_stdio(false);
+    int rc = 0;
+    for (auto const& file : files) {
+        try {
+            auto const start = std::chrono::steady_clock::now();
+            auto const stats = YALF::queryPbFile(file, query, fmt, std::cout, threads);
+            auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+            if (print_stats)
+                std::cerr << std::format("{}: {} entries, {} matched, {} corrupt regions, {:.3f}s ({:.0f} entries/s)\n",
+                    file.string(), stats.entries, stats.matches, stats.corrupt_regions, elapsed.count(), stats.entries / elapsed.count());
+            if (stats.corrupt_regions != 0)
+                rc = 1;
+        }
+        catch (std::exception const& e) {
+            std::cerr << file.string() << ": " << e.what() << "\n";
+            rc = 1;
+        }
+    }
+    std::cout.flush();
+    return rc;
+}